@@ -4,7 +4,7 @@
 #include "ast.h"
 
 static int
-is_rule(struct rule *rule, ...)
+is_rule(const struct rule *rule, ...)
 {
     int i, is_rule = 1;
     va_list list;
@@ -23,7 +23,7 @@ is_rule(struct rule *rule, ...)
 }
 
 struct astnode *
-create_translation_unit_node(struct listnode *list, struct rule *rule)
+create_translation_unit_node(struct astnode **nodes, const struct rule *rule)
 {
     unsigned int node_size;
     struct ast_translation_unit *node;
@@ -36,25 +36,22 @@ create_translation_unit_node(struct listnode *list, struct rule *rule)
         node = malloc(node_size);
         memset(node, 0, node_size);
 
-        /* index 1 is AST_EXTERNAL_DECLARATION astnode */
-        /* index 0 is AST_EXTERNAL_DECLARATION state */
-        node->translation_unit_items[0] = list_item(&list, 1);
+        /* nodes[0] is AST_EXTERNAL_DECLARATION */
+        node->translation_unit_items[0] = nodes[0];
         node->translation_unit_items_size = 1;
     }
     if (is_rule(rule, AST_TRANSLATION_UNIT, AST_EXTERNAL_DECLARATION))
     {
-        /* index 3 is AST_TRANSLATION_UNIT astnode */
-        /* index 2 is AST_TRANSLATION_UNIT state */
-        node = list_item(&list, 3);
+        /* nodes[0] is AST_TRANSLATION_UNIT */
+        node = (struct ast_translation_unit *)nodes[0];
 
         node_size = sizeof(struct ast_translation_unit) +
             sizeof(struct ast_translation_unit *) *
             (node->translation_unit_items_size + 1);
         node = realloc(node, node_size);
 
-        /* index 1 is AST_EXTERNAL_DECLARATION astnode */
-        /* index 0 is AST_EXTERNAL_DECLARATION state */
-        child = list_item(&list, 1);
+        /* nodes[1] is AST_EXTERNAL_DECLARATION */
+        child = nodes[1];
 
         node->translation_unit_items[node->translation_unit_items_size] = child;
         node->translation_unit_items_size += 1;
@@ -65,13 +62,13 @@ create_translation_unit_node(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_elided_node(struct listnode *list, struct rule *rule)
+create_elided_node(struct astnode **nodes, const struct rule *rule)
 {
     struct astnode *node;
 
     assert(rule->length_of_nodes == 1);
 
-    node = list_item(&list, 1);
+    node = nodes[0];
     node->type = rule->type;
 
     /*
@@ -87,7 +84,7 @@ create_elided_node(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_function_definition(struct listnode *list, struct rule *rule)
+create_function_definition(struct astnode **nodes, const struct rule *rule)
 {
     struct ast_function *node;
 
@@ -97,11 +94,11 @@ create_function_definition(struct listnode *list, struct rule *rule)
     if (is_rule(rule,
         AST_DECLARATION_SPECIFIERS, AST_DECLARATOR, AST_COMPOUND_STATEMENT))
     {
-        /* index 5 is AST_DECLARATION_SPECIFIERS astnode */
-        /* index 3 is AST_DECLARATOR state */
-        /* index 1 is AST_COMPOUND_STATEMENT state */
-        node->function_declarator = list_item(&list, 3);
-        node->statements = list_item(&list, 1);
+        /* nodes[0] is AST_DECLARATION_SPECIFIERS */
+        /* nodes[1] is AST_DECLARATOR */
+        /* nodes[2] is AST_COMPOUND_STATEMENT */
+        node->function_declarator = (struct ast_declarator *)nodes[1];
+        node->statements = (struct ast_compound_statement *)nodes[2];
     }
 
     node->type = rule->type;
@@ -109,24 +106,24 @@ create_function_definition(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_declaration(struct listnode *list, struct rule *rule)
+create_declaration(struct astnode **nodes, const struct rule *rule)
 {
     struct ast_declaration *node, *child;
 
     if (is_rule(rule, AST_DECLARATION_SPECIFIERS, AST_SEMICOLON))
     {
-        /* index 3 is AST_DECLARATION_SPECIFIERS astnode */
-        /* index 1 is AST_SEMICOLON state */
-        node = list_item(&list, 3);
+        /* nodes[0] is AST_DECLARATION_SPECIFIERS */
+        /* nodes[1] is AST_SEMICOLON */
+        node = (struct ast_declaration *)nodes[0];
     }
     else if (is_rule(rule,
              AST_DECLARATION_SPECIFIERS, AST_INIT_DECLARATOR_LIST, AST_SEMICOLON))
     {
-        /* index 5 is AST_DECLARATION_SPECIFIERS astnode */
-        /* index 3 is AST_INIT_DECLARATOR_LIST state */
-        /* index 1 is AST_SEMICOLON state */
-        node = list_item(&list, 5);
-        child = list_item(&list, 3);
+        /* nodes[0] is AST_DECLARATION_SPECIFIERS */
+        /* nodes[1] is AST_INIT_DECLARATOR_LIST */
+        /* nodes[2] is AST_SEMICOLON */
+        node = (struct ast_declaration *)nodes[0];
+        child = (struct ast_declaration *)nodes[1];
 
         node->declarators_size = child->declarators_size;
         memcpy(node->declarators, child->declarators,
@@ -138,7 +135,7 @@ create_declaration(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_declaration_list(struct listnode *list, struct rule *rule)
+create_declaration_list(struct astnode **nodes, const struct rule *rule)
 {
     unsigned int node_size;
     struct ast_declaration_list *node;
@@ -146,26 +143,26 @@ create_declaration_list(struct listnode *list, struct rule *rule)
 
     if (is_rule(rule, AST_DECLARATION_LIST, AST_DECLARATION))
     {
-        /* index 3 is AST_DECLARATION_LIST astnode */
-        /* index 1 is AST_DECLARATION astnode */
-        node = list_item(&list, 3);
+        /* nodes[0] is AST_DECLARATION_LIST */
+        /* nodes[1] is AST_DECLARATION */
+        node = (struct ast_declaration_list *)nodes[0];
 
         node_size = sizeof(struct ast_declaration_list) +
                     sizeof(struct ast_declaration *) * (node->size + 1);
         node = realloc(node, node_size);
-        child = list_item(&list, 1);
+        child = (struct ast_declaration *)nodes[1];
 
         node->items[node->size] = child;
         node->size += 1;
     }
     else if (is_rule(rule, AST_DECLARATION))
     {
-        /* index 1 is AST_DECLARATION astnode */
+        /* nodes[0] is AST_DECLARATION */
         node_size = sizeof(struct ast_declaration) +
                     sizeof(struct ast_declaration *);
         node = malloc(node_size);
 
-        node->items[0] = list_item(&list, 1);
+        node->items[0] = (struct ast_declaration *)nodes[0];
         node->size = 1;
     }
 
@@ -174,7 +171,7 @@ create_declaration_list(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_parameter_list(struct listnode *list, struct rule *rule)
+create_parameter_list(struct astnode **nodes, const struct rule *rule)
 {
     unsigned int node_size;
     struct ast_parameter_type_list *node;
@@ -182,22 +179,22 @@ create_parameter_list(struct listnode *list, struct rule *rule)
 
     if (is_rule(rule, AST_PARAMETER_LIST, AST_COMMA, AST_PARAMETER_DECLARATION))
     {
-        /* index 5 is AST_PARAMETER_LIST astnode */
-        /* index 1 is AST_PARAMETER_DECLARATION astnode */
-        node = list_item(&list, 5);
+        /* nodes[0] is AST_PARAMETER_LIST */
+        /* nodes[2] is AST_PARAMETER_DECLARATION */
+        node = (struct ast_parameter_type_list *)nodes[0];
 
         node_size = sizeof(struct ast_declaration) +
                     sizeof(struct ast_declaration *) * (node->size + 1);
         node = realloc(node, node_size);
-        child = list_item(&list, 1);
+        child = (struct ast_declaration *)nodes[2];
 
         node->items[node->size] = child;
         node->size += 1;
     }
     else if (is_rule(rule, AST_PARAMETER_DECLARATION))
     {
-        /* index 1 is AST_PARAMETER_DECLARATION astnode */
-        child = list_item(&list, 1);
+        /* nodes[0] is AST_PARAMETER_DECLARATION */
+        child = (struct ast_declaration *)nodes[0];
 
         node_size = sizeof(struct ast_declaration) +
                     sizeof(struct ast_declaration *);
@@ -212,26 +209,26 @@ create_parameter_list(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_parameter_declaration(struct listnode *list, struct rule *rule)
+create_parameter_declaration(struct astnode **nodes, const struct rule *rule)
 {
     struct ast_declaration *node;
     struct ast_declarator *child;
 
     if (is_rule(rule, AST_DECLARATION_SPECIFIERS))
     {
-        /* index 1 is AST_DECLARATION_SPECIFIERS astnode */
-        node = list_item(&list, 1);
+        /* nodes[0] is AST_DECLARATION_SPECIFIERS */
+        node = (struct ast_declaration *)nodes[0];
         node->type = rule->type;
         return (struct astnode *)node;
     }
     else if (is_rule(rule, AST_DECLARATION_SPECIFIERS, AST_DECLARATOR) ||
              is_rule(rule, AST_DECLARATION_SPECIFIERS, AST_ABSTRACT_DECLARATOR))
     {
-        /* index 3 is AST_DECLARATION_SPECIFIERS astnode */
-        node = list_item(&list, 3);
+        /* nodes[0] is AST_DECLARATION_SPECIFIERS */
+        node = (struct ast_declaration *)nodes[0];
 
-        /* index 1 is [ AST_DECLARATOR | AST_ABSTRACT_DECLARATOR ] astnode */
-        child = list_item(&list, 1);
+        /* nodes[1] is [ AST_DECLARATOR | AST_ABSTRACT_DECLARATOR ] */
+        child = (struct ast_declarator *)nodes[1];
 
         node->declarators[0] = child;
         node->declarators_size = 1;
@@ -242,14 +239,14 @@ create_parameter_declaration(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_initializer(struct listnode *list, struct rule *rule)
+create_initializer(struct astnode **nodes, const struct rule *rule)
 {
     struct ast_initializer *node;
 
     if (is_rule(rule, AST_ASSIGNMENT_EXPRESSION))
     {
         node = malloc(sizeof(struct ast_initializer));
-        node->expression = list_item(&list, 1);
+        node->expression = (struct ast_expression *)nodes[0];
     }
 
     node->type = rule->type;
@@ -257,13 +254,13 @@ create_initializer(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_expression_statement(struct listnode *list, struct rule *rule)
+create_expression_statement(struct astnode **nodes, const struct rule *rule)
 {
     struct astnode *node;
 
     if (is_rule(rule, AST_EXPRESSION, AST_SEMICOLON))
     {
-        node = list_item(&list, 3);
+        node = nodes[0];
     }
 
     node->type = rule->type;
@@ -271,7 +268,7 @@ create_expression_statement(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_compound_statement(struct listnode *list, struct rule *rule)
+create_compound_statement(struct astnode **nodes, const struct rule *rule)
 {
     struct ast_compound_statement *node;
 
@@ -280,17 +277,17 @@ create_compound_statement(struct listnode *list, struct rule *rule)
 
     if (is_rule(rule, AST_LBRACE, AST_STATEMENT_LIST, AST_RBRACE))
     {
-        node->statements = list_item(&list, 3);
+        node->statements = (struct ast_statement_list *)nodes[1];
     }
     else if (is_rule(rule, AST_LBRACE, AST_DECLARATION_LIST, AST_RBRACE))
     {
-        node->declarations = list_item(&list, 3);
+        node->declarations = (struct ast_declaration_list *)nodes[1];
     }
     else if (is_rule(rule,
              AST_LBRACE, AST_DECLARATION_LIST, AST_STATEMENT_LIST, AST_RBRACE))
     {
-        node->statements = list_item(&list, 3);
-        node->declarations = list_item(&list, 5);
+        node->statements = (struct ast_statement_list *)nodes[2];
+        node->declarations = (struct ast_declaration_list *)nodes[1];
     }
 
     node->type = rule->type;
@@ -298,7 +295,7 @@ create_compound_statement(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_statement_list(struct listnode *list, struct rule *rule)
+create_statement_list(struct astnode **nodes, const struct rule *rule)
 {
     unsigned int node_size;
     struct ast_statement_list *node, *child;
@@ -310,21 +307,21 @@ create_statement_list(struct listnode *list, struct rule *rule)
         node = malloc(node_size);
         memset(node, 0, node_size);
 
-        /* index 1 is AST_STATEMENT astnode */
-        node->items[0] = list_item(&list, 1);
+        /* nodes[0] is AST_STATEMENT */
+        node->items[0] = nodes[0];
         node->size = 1;
     }
     else if (is_rule(rule, AST_STATEMENT_LIST, AST_STATEMENT))
     {
-        /* index 3 is AST_STATEMENT_LIST astnode */
-        /* index 1 is AST_STATEMENT astnode */
-        child = list_item(&list, 3);
+        /* nodes[0] is AST_STATEMENT_LIST */
+        /* nodes[1] is AST_STATEMENT */
+        child = (struct ast_statement_list *)nodes[0];
 
         node_size = sizeof(struct ast_statement_list) +
             (sizeof(struct astnode *) * (child->size + 1));
         node = realloc(child, node_size);
 
-        node->items[node->size] = list_item(&list, 1);
+        node->items[node->size] = nodes[1];
         node->size += 1;
     }
     node->type = rule->type;
@@ -333,7 +330,7 @@ create_statement_list(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_selection_statement(struct listnode *list, struct rule *rule)
+create_selection_statement(struct astnode **nodes, const struct rule *rule)
 {
 
     struct astnode *expression;
@@ -346,16 +343,16 @@ create_selection_statement(struct listnode *list, struct rule *rule)
     if (is_rule(rule,
         AST_IF, AST_LPAREN, AST_EXPRESSION, AST_RPAREN, AST_STATEMENT))
     {
-        node->expression = list_item(&list, 5);
-        node->statement1 = list_item(&list, 1);
+        node->expression = (struct ast_binary_op *)nodes[2];
+        node->statement1 = nodes[4];
     }
     else if (is_rule(rule,
         AST_IF, AST_LPAREN, AST_EXPRESSION, AST_RPAREN, AST_STATEMENT,
         AST_ELSE, AST_STATEMENT))
     {
-        node->expression = list_item(&list, 9);
-        node->statement1 = list_item(&list, 5);
-        node->statement2 = list_item(&list, 1);
+        node->expression = (struct ast_binary_op *)nodes[2];
+        node->statement1 = nodes[4];
+        node->statement2 = nodes[6];
     }
 
     node->type = rule->type;
@@ -363,7 +360,7 @@ create_selection_statement(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_iteration_statement(struct listnode *list, struct rule *rule)
+create_iteration_statement(struct astnode **nodes, const struct rule *rule)
 {
     struct astnode *expression1;
     struct astnode *expression2;
@@ -378,10 +375,10 @@ create_iteration_statement(struct listnode *list, struct rule *rule)
         AST_FOR, AST_LPAREN, AST_EXPRESSION, AST_SEMICOLON, AST_EXPRESSION,
         AST_SEMICOLON, AST_EXPRESSION, AST_RPAREN, AST_STATEMENT))
     {
-        node->expression1 = list_item(&list, 13);
-        node->expression2 = list_item(&list, 9);
-        node->expression3 = list_item(&list, 5);
-        node->statement = list_item(&list, 1);
+        node->expression1 = nodes[2];
+        node->expression2 = nodes[4];
+        node->expression3 = nodes[6];
+        node->statement = nodes[8];
     }
 
     node->type = rule->type;
@@ -389,13 +386,13 @@ create_iteration_statement(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_jump_statement(struct listnode *list, struct rule *rule)
+create_jump_statement(struct astnode **nodes, const struct rule *rule)
 {
     struct astnode *node;
 
     if (is_rule(rule, AST_RETURN, AST_EXPRESSION, AST_SEMICOLON))
     {
-        node = list_item(&list, 3);
+        node = nodes[1];
     }
 
     node->type = rule->type;
@@ -403,7 +400,7 @@ create_jump_statement(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_assignment_expression(struct listnode *list, struct rule *rule)
+create_assignment_expression(struct astnode **nodes, const struct rule *rule)
 {
     /*
      * TODO: This is identical to create_binary_op(). Is a duplicate function
@@ -414,12 +411,12 @@ create_assignment_expression(struct listnode *list, struct rule *rule)
     node = malloc(sizeof(struct ast_binary_op));
     memset(node, 0, sizeof(struct ast_binary_op));
 
-    /* index 1 is right astnode */
-    /* index 3 is operator astnode */
-    /* index 5 is right astnode */
-    node->left = list_item(&list, 5);
-    node->op = ((struct astnode *)list_item(&list, 3))->type;
-    node->right = list_item(&list, 1);
+    /* nodes[0] is left astnode */
+    /* nodes[1] is operator astnode */
+    /* nodes[2] is right astnode */
+    node->left = nodes[0];
+    node->op = nodes[1]->type;
+    node->right = nodes[2];
 
     node->elided_type = rule->type;
     node->type = rule->type;
@@ -427,7 +424,7 @@ create_assignment_expression(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_declaration_specifiers(struct listnode *list, struct rule *rule)
+create_declaration_specifiers(struct astnode **nodes, const struct rule *rule)
 {
     struct ast_declaration *node, *child;
 
@@ -435,15 +432,14 @@ create_declaration_specifiers(struct listnode *list, struct rule *rule)
     {
         node = malloc(sizeof(struct ast_declaration));
         memset(node, 0, sizeof(struct ast_declaration));
-        child = list_item(&list, 1);
+        child = (struct ast_declaration *)nodes[0];
     }
     else if (rule->length_of_nodes == 2)
     {
-        /* index 1 is AST_DECLARATION_SPECIFIERS astnode */
-        /* index 0 is AST_DECLARATION_SPECIFIERS state */
-        node = list_item(&list, 1);
+        /* nodes[1] is AST_DECLARATION_SPECIFIERS */
+        node = (struct ast_declaration *)nodes[1];
 
-        child = list_item(&list, 3);
+        child = (struct ast_declaration *)nodes[0];
     }
 
     switch (child->type)
@@ -477,7 +473,7 @@ create_declaration_specifiers(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_init_declarator_list(struct listnode *list, struct rule *rule)
+create_init_declarator_list(struct astnode **nodes, const struct rule *rule)
 {
     struct ast_declaration *node, *init_declarator_list;
     struct ast_declarator *init_declarator;
@@ -487,8 +483,8 @@ create_init_declarator_list(struct listnode *list, struct rule *rule)
 
     if (is_rule(rule, AST_INIT_DECLARATOR))
     {
-        /* index 1 is AST_INIT_DECLARATOR astnode */
-        init_declarator = list_item(&list, 1);
+        /* nodes[0] is AST_INIT_DECLARATOR */
+        init_declarator = (struct ast_declarator *)nodes[0];
 
         node_size = sizeof(struct ast_declaration);
 
@@ -500,11 +496,11 @@ create_init_declarator_list(struct listnode *list, struct rule *rule)
     }
     else if (is_rule(rule, AST_INIT_DECLARATOR_LIST, AST_COMMA, AST_INIT_DECLARATOR))
     {
-        /* index 5 is AST_INIT_DECLARATOR_LIST astnode */
-        /* index 3 is AST_COMMA astnode */
-        /* index 1 is AST_INIT_DECLARATOR astnode */
-        init_declarator_list = list_item(&list, 5);
-        init_declarator = list_item(&list, 1);
+        /* nodes[0] is AST_INIT_DECLARATOR_LIST */
+        /* nodes[1] is AST_COMMA */
+        /* nodes[2] is AST_INIT_DECLARATOR */
+        init_declarator_list = (struct ast_declaration *)nodes[0];
+        init_declarator = (struct ast_declarator *)nodes[2];
 
         node_size = sizeof(struct ast_declaration) +
                     sizeof(struct ast_declarator *) *
@@ -524,7 +520,7 @@ create_init_declarator_list(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_init_declarator(struct listnode *list, struct rule *rule)
+create_init_declarator(struct astnode **nodes, const struct rule *rule)
 {
     struct ast_declarator *node;
     assert(rule->length_of_nodes == 3);
@@ -532,23 +528,23 @@ create_init_declarator(struct listnode *list, struct rule *rule)
 
     if (is_rule(rule, AST_DECLARATOR, AST_EQUAL, AST_INITIALIZER))
     {
-        /* index 5 is AST_DECLARATOR astnode */
-        /* index 3 is AST_EQUAL astnode */
-        /* index 1 is AST_INITIALIZER astnode */
-        node = list_item(&list, 5);
-        node->initializer = list_item(&list, 1);
+        /* nodes[0] is AST_DECLARATOR */
+        /* nodes[1] is AST_EQUAL */
+        /* nodes[2] is AST_INITIALIZER */
+        node = (struct ast_declarator *)nodes[0];
+        node->initializer = (struct ast_initializer *)nodes[2];
     }
     return (struct astnode *)node;
 }
 
 struct astnode *
-create_declarator(struct listnode *list, struct rule *rule)
+create_declarator(struct astnode **nodes, const struct rule *rule)
 {
     struct ast_declarator *node;
 
     if (is_rule(rule, AST_POINTER, AST_DIRECT_DECLARATOR))
     {
-        node = list_item(&list, 1);
+        node = (struct ast_declarator *)nodes[1];
         node->is_pointer = 1;
     }
 
@@ -557,25 +553,25 @@ create_declarator(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_direct_declarator(struct listnode *list, struct rule *rule)
+create_direct_declarator(struct astnode **nodes, const struct rule *rule)
 {
     struct ast_declarator *node;
     struct astnode *child;
 
     if (is_rule(rule, AST_IDENTIFIER))
     {
-        /* index 1 is AST_IDENTIFIER astnode */
-        child = list_item(&list, 1);
+        /* nodes[0] is AST_IDENTIFIER */
+        child = nodes[0];
 
         node = malloc(sizeof(struct ast_declarator));
         memset(node, 0, sizeof(struct ast_declarator));
 
-        node->declarator_identifier = child->token->value;
+        node->declarator_identifier = token_name(child->tokens, child->token);
         node->count = NULL;
     }
     else if (rule->length_of_nodes == 3)
     {
-        node = list_item(&list, 5);
+        node = (struct ast_declarator *)nodes[0];
         if (node->type == AST_DIRECT_DECLARATOR)
         {
             /* { AST_DIRECT_DECLARATOR, AST_LBRACKET, AST_RBRACKET } */
@@ -584,26 +580,26 @@ create_direct_declarator(struct listnode *list, struct rule *rule)
         else
         {
             /* { AST_LPAREN, AST_DECLARATOR, AST_RPAREN } */
-            node = list_item(&list, 3);
+            node = (struct ast_declarator *)nodes[1];
         }
     }
     else if (is_rule(rule,
         AST_DIRECT_DECLARATOR, AST_LBRACKET, AST_CONSTANT_EXPRESSION, AST_RBRACKET))
     {
-        node = list_item(&list, 7);
+        node = (struct ast_declarator *)nodes[0];
 
         /*
          * FIXME: Not guaranteed this is a literal int. May have to evaluate
          * expression...
          */
-        node->count = (struct ast_expression *)list_item(&list, 3);
+        node->count = (struct ast_expression *)nodes[2];
     }
     else if (rule->length_of_nodes == 4)
     {
-        /* index 7 is AST_DIRECT_DECLARATOR astnode */
-        /* index 3 is AST_PARAMETER_TYPE_LIST | AST_IDENTIFIER_LIST astnode */
-        node = list_item(&list, 7);
-        child = list_item(&list, 3);
+        /* nodes[0] is AST_DIRECT_DECLARATOR */
+        /* nodes[2] is AST_PARAMETER_TYPE_LIST | AST_IDENTIFIER_LIST */
+        node = (struct ast_declarator *)nodes[0];
+        child = nodes[2];
 
         switch (child->type)
         {
@@ -636,7 +632,7 @@ create_direct_declarator(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_pointer(struct listnode *list, struct rule *rule)
+create_pointer(struct astnode **nodes, const struct rule *rule)
 {
     struct astnode *node;
     node = malloc(sizeof(struct astnode));
@@ -647,7 +643,7 @@ create_pointer(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_storage_class_specifier(struct listnode *list, struct rule *rule)
+create_storage_class_specifier(struct astnode **nodes, const struct rule *rule)
 {
     struct ast_declaration *node;
     struct astnode *child;
@@ -656,7 +652,7 @@ create_storage_class_specifier(struct listnode *list, struct rule *rule)
 
     assert(rule->length_of_nodes == 1);
 
-    child = list_item(&list, 1);
+    child = nodes[0];
     switch (child->type)
     {
         case AST_AUTO:
@@ -696,7 +692,7 @@ create_storage_class_specifier(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_type_specifier(struct listnode *list, struct rule *rule)
+create_type_specifier(struct astnode **nodes, const struct rule *rule)
 {
     struct ast_declaration *node;
     struct astnode *child;
@@ -705,7 +701,7 @@ create_type_specifier(struct listnode *list, struct rule *rule)
 
     assert(rule->length_of_nodes == 1);
 
-    child = list_item(&list, 1);
+    child = nodes[0];
     switch (child->type)
     {
         case AST_VOID:
@@ -780,7 +776,7 @@ create_type_specifier(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_type_qualifier(struct listnode *list, struct rule *rule)
+create_type_qualifier(struct astnode **nodes, const struct rule *rule)
 {
     struct ast_declaration *node;
     struct astnode *child;
@@ -789,7 +785,7 @@ create_type_qualifier(struct listnode *list, struct rule *rule)
 
     assert(rule->length_of_nodes == 1);
 
-    child = list_item(&list, 1);
+    child = nodes[0];
     switch (child->type)
     {
         case AST_CONST:
@@ -814,7 +810,7 @@ create_type_qualifier(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_(struct listnode *list, struct rule *rule)
+create_(struct astnode **nodes, const struct rule *rule)
 {
     struct astnode *node;
     node = malloc(sizeof(struct astnode));
@@ -825,18 +821,18 @@ create_(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_binary_op(struct listnode *list, struct rule *rule)
+create_binary_op(struct astnode **nodes, const struct rule *rule)
 {
     struct ast_binary_op *node;
     node = malloc(sizeof(struct ast_binary_op));
     memset(node, 0, sizeof(struct ast_binary_op));
 
-    /* index 1 is right astnode */
-    /* index 3 is operator astnode */
-    /* index 5 is right astnode */
-    node->left = list_item(&list, 5);
-    node->op = ((struct astnode *)list_item(&list, 3))->type;
-    node->right = list_item(&list, 1);
+    /* nodes[0] is left astnode */
+    /* nodes[1] is operator astnode */
+    /* nodes[2] is right astnode */
+    node->left = nodes[0];
+    node->op = nodes[1]->type;
+    node->right = nodes[2];
 
     node->elided_type = rule->type;
     node->type = rule->type;
@@ -844,28 +840,28 @@ create_binary_op(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_unary_expression(struct listnode *list, struct rule *rule)
+create_unary_expression(struct astnode **nodes, const struct rule *rule)
 {
     struct ast_expression *node;
 
     if (is_rule(rule, AST_PLUS_PLUS, AST_UNARY_EXPRESSION))
     {
-        node = list_item(&list, 1);
+        node = (struct ast_expression *)nodes[1];
         node->inplace_op = PRE_INCREMENT;
     }
     else if (is_rule(rule, AST_MINUS_MINUS, AST_UNARY_EXPRESSION))
     {
-        node = list_item(&list, 1);
+        node = (struct ast_expression *)nodes[1];
         node->inplace_op = PRE_DECREMENT;
     }
     else if (is_rule(rule, AST_AMPERSAND, AST_CAST_EXPRESSION))
     {
-        node = list_item(&list, 1);
+        node = (struct ast_expression *)nodes[1];
         node->kind = PTR_VALUE;
     }
     else if (is_rule(rule, AST_ASTERISK, AST_CAST_EXPRESSION))
     {
-        node = list_item(&list, 1);
+        node = (struct ast_expression *)nodes[1];
         node->kind = PTR_VALUE;
     }
 
@@ -874,40 +870,40 @@ create_unary_expression(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_postfix_expression(struct listnode *list, struct rule *rule)
+create_postfix_expression(struct astnode **nodes, const struct rule *rule)
 {
     struct ast_expression *node, *child;
 
     if (is_rule(rule, AST_POSTFIX_EXPRESSION, AST_LPAREN, AST_RPAREN))
     {
-        node = list_item(&list, 5);
+        node = (struct ast_expression *)nodes[0];
         node->kind = FUNCTION_VALUE;
     }
     else if (is_rule(rule,
         AST_POSTFIX_EXPRESSION, AST_LBRACKET, AST_EXPRESSION, AST_RBRACKET))
     {
-        node = list_item(&list, 7);
-        node->extra = list_item(&list, 3);
+        node = (struct ast_expression *)nodes[0];
+        node->extra = (struct ast_expression *)nodes[2];
     }
     else if (is_rule(rule,
         AST_POSTFIX_EXPRESSION, AST_LPAREN, AST_ARGUMENT_EXPRESSION_LIST, AST_RPAREN))
     {
-        /* index 7 is AST_POSTFIX_EXPRESSION astnode */
-        /* index 3 is AST_ARGUMENT_EXPRESSION_LIST astnode */
-        child = list_item(&list, 7);
-        node = list_item(&list, 3);
+        /* nodes[0] is AST_POSTFIX_EXPRESSION */
+        /* nodes[2] is AST_ARGUMENT_EXPRESSION_LIST */
+        child = (struct ast_expression *)nodes[0];
+        node = (struct ast_expression *)nodes[2];
 
         node->identifier = child->identifier;
         node->kind = FUNCTION_VALUE;
     }
     else if (is_rule(rule, AST_POSTFIX_EXPRESSION, AST_PLUS_PLUS))
     {
-        node = list_item(&list, 3);
+        node = (struct ast_expression *)nodes[0];
         node->inplace_op = POST_INCREMENT;
     }
     else if (is_rule(rule, AST_POSTFIX_EXPRESSION, AST_MINUS_MINUS))
     {
-        node = list_item(&list, 3);
+        node = (struct ast_expression *)nodes[0];
         node->inplace_op = POST_DECREMENT;
     }
 
@@ -916,7 +912,7 @@ create_postfix_expression(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_primary_expression(struct listnode *list, struct rule *rule)
+create_primary_expression(struct astnode **nodes, const struct rule *rule)
 {
     struct ast_expression *node;
     struct astnode *child;
@@ -926,8 +922,8 @@ create_primary_expression(struct listnode *list, struct rule *rule)
         node = malloc(sizeof(struct ast_expression));
         memset(node, 0, sizeof(struct ast_expression));
 
-        child = list_item(&list, 1);
-        node->identifier = child->token->value;
+        child = nodes[0];
+        node->identifier = token_name(child->tokens, child->token);
         node->kind = IDENTIFIER_VALUE;
     }
     else if (is_rule(rule, AST_STRING_CONSTANT))
@@ -935,13 +931,13 @@ create_primary_expression(struct listnode *list, struct rule *rule)
         node = malloc(sizeof(struct ast_expression));
         memset(node, 0, sizeof(struct ast_expression));
 
-        child = list_item(&list, 1);
-        node->identifier = child->token->value;
+        child = nodes[0];
+        node->identifier = token_copy(child->tokens, child->token);
         node->kind = STRING_VALUE;
     }
     else if (is_rule(rule, AST_LPAREN, AST_EXPRESSION, AST_RPAREN))
     {
-        node = list_item(&list, 3);
+        node = (struct ast_expression *)nodes[1];
     }
 
     node->type = rule->type;
@@ -949,7 +945,7 @@ create_primary_expression(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_argument_expression_list(struct listnode *list, struct rule *rule)
+create_argument_expression_list(struct astnode **nodes, const struct rule *rule)
 {
     unsigned int node_size;
     struct ast_expression *node;
@@ -960,19 +956,19 @@ create_argument_expression_list(struct listnode *list, struct rule *rule)
         node = malloc(node_size);
         memset(node, 0, node_size);
 
-        node->arguments[0] = list_item(&list, 1);
+        node->arguments[0] = (struct ast_expression *)nodes[0];
         node->arguments_size = 1;
     }
     else if (is_rule(rule,
              AST_ARGUMENT_EXPRESSION_LIST, AST_COMMA, AST_ASSIGNMENT_EXPRESSION))
     {
-        node = list_item(&list, 5);
+        node = (struct ast_expression *)nodes[0];
 
         node_size = sizeof(struct ast_expression) +
             (sizeof(struct ast_expression *) * node->arguments_size + 1);
         node = realloc(node, node_size);
 
-        node->arguments[node->arguments_size] = list_item(&list, 1);
+        node->arguments[node->arguments_size] = (struct ast_expression *)nodes[2];
         node->arguments_size += 1;
     }
 
@@ -981,17 +977,22 @@ create_argument_expression_list(struct listnode *list, struct rule *rule)
 }
 
 struct astnode *
-create_constant(struct listnode *list, struct rule *rule)
+create_constant(struct astnode **nodes, const struct rule *rule)
 {
     struct ast_expression *node;
     struct astnode *child;
     node = malloc(sizeof(struct ast_expression));
     memset(node, 0, sizeof(struct ast_expression));
 
-    child = list_item(&list, 1);
+    child = nodes[0];
 
-    node->int_value = atoi(child->token->value);
+    /*
+     * The scanner decoded the value. The generator works in 32-bit ints.
+     * Decoded character constants are ints too, so both kinds of constant
+     * are integer constants from here on.
+     */
+    node->int_value = token_constant(child->tokens, child->token)->value;
     node->type = rule->type;
-    node->elided_type = rule->nodes[0];
+    node->elided_type = AST_INTEGER_CONSTANT;
     return (struct astnode *)node;
 }
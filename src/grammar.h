@@ -9,7 +9,7 @@
  * grammar as defined by K&R in "C Programming Language" 2nd edition reference
  * manual.
  */
-struct rule grammar[NUM_RULES] =
+const struct rule grammar[NUM_RULES] =
 {
     /* translation-unit: */
     {
@@ -1312,7 +1312,7 @@ struct rule grammar[NUM_RULES] =
     },
     {
         AST_CONSTANT,
-        create_,
+        create_constant,
         1,
         { AST_CHARACTER_CONSTANT }
     },
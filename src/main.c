@@ -6,58 +6,210 @@
 #include "parser.h"
 #include "generator.h"
 
+/*
+ * Returns the name of the assembly file for a source file: foo.c becomes foo.s
+ * and standard input becomes a.s.
+ */
 static char *
-read_file(const char *filename, long *filelength)
+assembly_filename(const char *filename)
 {
-    FILE *f;
-    long length;
-    char *buffer;
-
-    f = fopen(filename, "r");
-    fseek(f, 0, SEEK_END);
-    length = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    buffer = malloc(length);
-    if (buffer)
-    {
-        fread(buffer, 1, length, f);
-    }
-    fclose(f);
-    *filelength = length;
-    return buffer;
+    size_t length = strlen(filename);
+    char *name = malloc(length + sizeof(".s"));
+
+    if (strcmp(filename, "-") == 0)
+    {
+        return strcpy(name, "a.s");
+    }
+
+    strcpy(name, filename);
+    if (length > 2 && strcmp(&name[length - 2], ".c") == 0)
+    {
+        name[length - 1] = 's';
+    }
+    else
+    {
+        strcat(name, ".s");
+    }
+    return name;
 }
 
-char *
-assembly_filename(char *filename)
+/*
+ * Writes a name as make reads it in a rule, with spaces and other characters
+ * make treats specially escaped.
+ */
+static void
+write_make_name(FILE *output, const char *name)
 {
-    filename[strlen(filename) - 1] = 's';
-    return filename;
+    for (; *name != '\0'; name++)
+    {
+        if (*name == '$')
+        {
+            fputc('$', output);
+        }
+        else if (*name == ' ' || *name == '\t' || *name == '#')
+        {
+            fputc('\\', output);
+        }
+        fputc(*name, output);
+    }
+}
+
+/*
+ * Writes a make rule for target on the source file and every file it
+ * included, from what the scanner recorded as it read them.
+ */
+static int
+write_dependencies(const char *filename, const char *target,
+                   const char *source, struct listnode *dependencies)
+{
+    struct listnode *node;
+    FILE *output;
+
+    if ((output = fopen(filename, "w")) == NULL)
+    {
+        perror(filename);
+        return 1;
+    }
+
+    write_make_name(output, target);
+    fputc(':', output);
+    if (strcmp(source, "-") != 0)
+    {
+        fputc(' ', output);
+        write_make_name(output, source);
+    }
+    foreach(node, dependencies)
+    {
+        fputs(" \\\n  ", output);
+        write_make_name(output, node->data);
+    }
+    fputc('\n', output);
+
+    if (fclose(output) != 0)
+    {
+        perror(filename);
+        return 1;
+    }
+    return 0;
 }
 
 int
 main(int argc, char *argv[])
 {
-    int total_tokens;
-    struct listnode *tokens = NULL;
+    struct scanner scanner;
     struct astnode *ast;
+    struct listnode *include_paths, *node;
+    const struct preprocessor_stats *stats;
 
-    char filename[25];
-    char *buffer;
-    long filelength;
+    char *filename = NULL;
+    char *pch_directory = NULL;
+    char *dependency_filename = NULL;
+    char *assembly, *buffer;
+    size_t length;
+    int show_stats = 0;
+    int write_dependency_file = 0;
+    int i;
 
-    if (argc < 2)
+    /*
+     * clink [-I dir]... [-pch dir] [-MD] [-MF file] [-stats] file
+     */
+    list_init(&include_paths);
+    for (i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "-I", 2) == 0)
+        {
+            if (argv[i][2] != '\0')
+            {
+                list_append(&include_paths, &argv[i][2]);
+            }
+            else if (i + 1 < argc)
+            {
+                list_append(&include_paths, argv[++i]);
+            }
+        }
+        else if (strcmp(argv[i], "-pch") == 0 && i + 1 < argc)
+        {
+            pch_directory = argv[++i];
+        }
+        else if (strcmp(argv[i], "-MD") == 0)
+        {
+            write_dependency_file = 1;
+        }
+        else if (strcmp(argv[i], "-MF") == 0 && i + 1 < argc)
+        {
+            dependency_filename = argv[++i];
+        }
+        else if (strcmp(argv[i], "-stats") == 0)
+        {
+            show_stats = 1;
+        }
+        else
+        {
+            filename = argv[i];
+        }
+    }
+
+    if (filename == NULL)
     {
         printf("Not enough args. Must provide a file to compile.");
         return 1;
     }
-    strncpy(filename, argv[1], sizeof(filename));
 
-    buffer = read_file(filename, &filelength);
-    //preprocess("test.c", "_test.c");
-    scan(buffer, filelength, &tokens);
-    ast = parse(tokens);
+    if ((buffer = read_source(filename, &length)) == NULL)
+    {
+        perror(filename);
+        return 1;
+    }
+    scanner_init(&scanner, buffer, length);
+    if (strcmp(filename, "-") != 0)
+    {
+        scanner_set_filename(&scanner, filename);
+    }
+    foreach(node, include_paths)
+    {
+        scanner_add_include_path(&scanner, node->data);
+    }
+    if (pch_directory != NULL)
+    {
+        scanner_set_pch_directory(&scanner, pch_directory);
+    }
+#ifdef DIRECT_PARSER
+    ast = parse_direct(&scanner);
+#else
+    ast = parse(&scanner);
+#endif
+
+    assembly = assembly_filename(filename);
+    generate(ast, assembly);
 
-    generate(ast, assembly_filename(filename));
+    /*
+     * -MD writes the rule for the assembly file, in foo.d next to foo.s unless
+     * -MF names the file.
+     */
+    if (write_dependency_file)
+    {
+        if (dependency_filename == NULL)
+        {
+            dependency_filename = strcpy(malloc(strlen(assembly) + 1),
+                                         assembly);
+            dependency_filename[strlen(dependency_filename) - 1] = 'd';
+        }
+        if (write_dependencies(dependency_filename, assembly, filename,
+                               scanner.dependencies) != 0)
+        {
+            return 1;
+        }
+    }
+
+    if (show_stats)
+    {
+        stats = preprocessor_stats();
+        fprintf(stderr, "includes: %d, files read: %d, "
+                "re-inclusions skipped: %d, precompiled headers loaded: %d, "
+                "saved: %d\n",
+                stats->includes, stats->files_read, stats->includes_skipped,
+                stats->headers_loaded, stats->headers_saved);
+    }
 
     return 0;
 }
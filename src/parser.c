@@ -20,6 +20,14 @@
 
 #ifdef GENPT
 static struct parsetable_item *parsetable = NULL;
+static int *action_base = NULL;
+static short *action_table = NULL;
+static unsigned short *action_check = NULL;
+static int *goto_base = NULL;
+static short *goto_table = NULL;
+static unsigned short *goto_check = NULL;
+static short *default_action = NULL;
+static short *accessing_symbol = NULL;
 #else
 #include "parsetable.h"
 #endif
@@ -37,13 +45,33 @@ static struct state states[MAX_STATES];
 
 static struct state temp_states[MAX_STATES];
 
+/*
+ * state_index is an open-addressed hash table keyed on state fingerprints. Each
+ * slot holds the index into states plus one, so that zero marks an empty slot.
+ */
+#define STATE_INDEX_SIZE (MAX_STATES * 2)
+static int state_index[STATE_INDEX_SIZE];
+
+static void index_state(int index);
+static unsigned long mix_fingerprint(unsigned long h);
+
+/*
+ * first_sets maps each symbol to the set of terminals that can begin it and
+ * nullable marks the symbols that can derive the empty string. Both are
+ * computed once by generate_first_sets().
+ */
+#define NULLABLE_WORDS ((NUM_SYMBOLS + LOOKAHEAD_BITS - 1) / LOOKAHEAD_BITS)
+static struct lookahead first_sets[NUM_SYMBOLS];
+static unsigned long nullable[NULLABLE_WORDS];
+static int first_sets_generated = 0;
+
 /*
  * Print a state in the parser state machine.
  */
 void
 print_state(struct state *s)
 {
-    struct listnode *items, *lookaheads;
+    struct listnode *items;
     struct item *item;
     int i;
 
@@ -53,159 +81,326 @@ print_state(struct state *s)
         item = (struct item *)items->data;
         printf("  (%d,%d)", (int)(item->rewrite_rule-grammar), item->cursor_position);
 
-        for (lookaheads=item->lookahead; lookaheads!=NULL; lookaheads=lookaheads->next)
+        for (i=0; i<NUM_TERMINALS; i++)
         {
-            printf(" %d", (int)(lookaheads->data));
+            if (lookahead_contains(&item->lookahead, i))
+            {
+                printf(" %d", i);
+            }
         }
         printf("\n");
     }
 }
 
-static int
-checked_nodes_contains(struct listnode **items, enum astnode_t node)
+void
+lookahead_init(struct lookahead *lookahead)
 {
-    int contains = 0;
-    struct listnode *c;
+    memset(lookahead, 0, sizeof(struct lookahead));
+}
+
+void
+lookahead_add(struct lookahead *lookahead, enum astnode_t symbol)
+{
+    lookahead->words[symbol / LOOKAHEAD_BITS] |= 1UL << (symbol % LOOKAHEAD_BITS);
+}
+
+int
+lookahead_contains(const struct lookahead *lookahead, enum astnode_t symbol)
+{
+    return (lookahead->words[symbol / LOOKAHEAD_BITS] >>
+            (symbol % LOOKAHEAD_BITS)) & 1;
+}
+
+/*
+ * Adds all symbols of b into a. Returns whether a changed.
+ */
+int
+lookahead_union(struct lookahead *a, const struct lookahead *b)
+{
+    unsigned long changed = 0;
+    int i;
+
+    for (i=0; i<LOOKAHEAD_WORDS; i++)
+    {
+        changed |= b->words[i] & ~a->words[i];
+        a->words[i] |= b->words[i];
+    }
+    return changed != 0;
+}
 
-    c = *items;
-    while (c != NULL)
+int
+lookahead_equal(const struct lookahead *a, const struct lookahead *b)
+{
+    int i;
+
+    for (i=0; i<LOOKAHEAD_WORDS; i++)
     {
-        if ((enum astnode_t)c->data == node)
+        if (a->words[i] != b->words[i])
         {
-            contains = 1;
-            break;
+            return 0;
         }
-
-        c = c->next;
     }
-    return contains;
+    return 1;
 }
 
-void
-head_terminal_values(enum astnode_t node, struct listnode **checked_nodes,
-                     struct listnode **terminals)
+unsigned long
+lookahead_hash(const struct lookahead *lookahead)
 {
+    unsigned long hash = 0;
     int i;
 
-    if (checked_nodes_contains(checked_nodes, node))
+    for (i=0; i<LOOKAHEAD_WORDS; i++)
     {
-        /*
-         * If another iteration is already checking node, then there is nothing
-         * more to do here.
-         */
-        return;
+        hash = (hash ^ lookahead->words[i]) * 0x100000001b3UL;
     }
+    return hash;
+}
+
+/*
+ * Compute the FIRST and NULLABLE sets of every symbol in the grammar. Rules are
+ * applied repeatedly until neither set changes.
+ */
+void
+generate_first_sets(void)
+{
+    int i, j, changed;
+    const struct rule *r;
 
-    if (node < AST_INVALID)
+    memset(first_sets, 0, sizeof(first_sets));
+    memset(nullable, 0, sizeof(nullable));
+
+    for (i=0; i<NUM_TERMINALS; i++)
     {
-        /*
-         * If node is a terminal symbol then add it and return.
-         */
-        list_append(terminals, (void *)node);
-        return;
+        lookahead_add(&first_sets[i], i);
     }
 
-    /*
-     * Update checked_nodes to avoid trying to repeated work and infinite
-     * recursion.
-     */
-    list_append(checked_nodes, (void *)node);
-
-    for (i=0; i<NUM_RULES; i++)
+    do
     {
-        if (grammar[i].type == node)
+        changed = 0;
+        for (i=0; i<NUM_RULES; i++)
         {
-            if (grammar[i].nodes[0] < AST_INVALID &&
-                !checked_nodes_contains(terminals, grammar[i].nodes[0]))
+            r = &grammar[i];
+
+            for (j=0; j<r->length_of_nodes; j++)
             {
-                /*
-                 * If the symbol is a terminal value and we have not already
-                 * added it to terminals then add it
-                 */
-                list_append(terminals, (void *)grammar[i].nodes[0]);
+                changed |= lookahead_union(&first_sets[INDEX(r->type)],
+                                           &first_sets[INDEX(r->nodes[j])]);
+                if (!is_nullable(r->nodes[j]))
+                {
+                    break;
+                }
             }
-            else if (grammar[i].nodes[0] != node)
+
+            if (j == r->length_of_nodes && !is_nullable(r->type))
             {
-                /*
-                 * If the symbol is a non-terminal value then recurse and find
-                 * the head terminal
-                 */
-                head_terminal_values(grammar[i].nodes[0], checked_nodes,
-                                     terminals);
+                nullable[INDEX(r->type) / LOOKAHEAD_BITS] |=
+                    1UL << (INDEX(r->type) % LOOKAHEAD_BITS);
+                changed = 1;
             }
         }
+    } while (changed);
+
+    first_sets_generated = 1;
+}
+
+/*
+ * Returns the set of terminal values that can begin node.
+ */
+const struct lookahead *
+first_terminals(enum astnode_t node)
+{
+    if (!first_sets_generated)
+    {
+        generate_first_sets();
     }
+    return &first_sets[INDEX(node)];
 }
 
-static int
-items_contains(struct listnode **items, struct rule *r, int position, struct listnode *lookahead)
+/*
+ * Returns whether node can derive the empty string.
+ */
+int
+is_nullable(enum astnode_t node)
 {
-    int contains = 0;
-    struct listnode *c;
-    struct item *i;
+    return (nullable[INDEX(node) / LOOKAHEAD_BITS] >>
+            (INDEX(node) % LOOKAHEAD_BITS)) & 1;
+}
 
-    c = *items;
-    while (c != NULL)
+/*
+ * Set lookahead to the terminal values that can follow the symbol at position
+ * in rule. If every symbol after position is nullable then the symbols in
+ * follow are included too.
+ */
+static void
+rule_lookahead(const struct rule *rule, int position, const struct lookahead *follow,
+               struct lookahead *lookahead)
+{
+    int i;
+
+    lookahead_init(lookahead);
+    for (i=position+1; i<rule->length_of_nodes; i++)
     {
-        i = (struct item *)c->data;
-        if (i->rewrite_rule == r && i->cursor_position == position &&
-            list_equal(i->lookahead, lookahead))
+        lookahead_union(lookahead, first_terminals(rule->nodes[i]));
+        if (!is_nullable(rule->nodes[i]))
         {
-            contains = 1;
-            break;
+            return;
+        }
+    }
+    lookahead_union(lookahead, follow);
+}
+
+/*
+ * core_index is an open-addressed hash table of the items of the states being
+ * built, keyed on the state's list of items and the item's core (its rule and
+ * cursor position), so that a state holds one item per core. Slots left from
+ * an earlier generation are empty, so starting a generation clears the table.
+ */
+#define CORE_INDEX_SIZE 65536
+
+struct core_slot
+{
+    struct listnode **items;
+    struct item *item;
+    int generation;
+};
+
+static struct core_slot core_index[CORE_INDEX_SIZE];
+static int core_generation = 0;
+static int core_count = 0;
+
+static void
+begin_cores(void)
+{
+    core_generation += 1;
+    core_count = 0;
+}
+
+/*
+ * Returns the slot of the item in items with the given core, or the empty slot
+ * where it belongs.
+ */
+static struct core_slot *
+core_slot(struct listnode **items, const struct rule *rule, int position)
+{
+    unsigned long slot;
+    struct core_slot *c;
+
+    slot = mix_fingerprint(((unsigned long)items ^ (unsigned long)rule) << 4 |
+                           (unsigned long)position) % CORE_INDEX_SIZE;
+    for (;;)
+    {
+        c = &core_index[slot];
+        if (c->generation != core_generation ||
+            (c->items == items && c->item->rewrite_rule == rule &&
+             c->item->cursor_position == position))
+        {
+            return c;
         }
+        slot = (slot + 1) % CORE_INDEX_SIZE;
+    }
+}
+
+/*
+ * Adds lookahead to the item in items with the given core, appending the item
+ * if there is none. Returns the item if it is new or its lookahead grew, and
+ * NULL if items already covered it.
+ */
+static struct item *
+add_item(struct listnode **items, const struct rule *rule, int position,
+         const struct lookahead *lookahead)
+{
+    struct core_slot *c;
+    struct item *item;
 
-        c = c->next;
+    c = core_slot(items, rule, position);
+    if (c->generation == core_generation)
+    {
+        return lookahead_union(&c->item->lookahead, lookahead) ? c->item : NULL;
     }
-    return contains;
+
+    core_count += 1;
+    assert(core_count < CORE_INDEX_SIZE / 2);
+
+    item = malloc(sizeof(struct item));
+    item->rewrite_rule = rule;
+    item->cursor_position = position;
+    item->lookahead = *lookahead;
+    list_append(items, item);
+
+    c->items = items;
+    c->item = item;
+    c->generation = core_generation;
+    return item;
 }
 
 /*
- * Generate the items for a given production node.
+ * Add the items for a given production node to items, and then those of every
+ * node that begins one of its rules. The items that follow from an item are
+ * generated again only when its lookahead grows.
  */
-void
-generate_items(enum astnode_t node, struct listnode *lookahead, struct listnode **items)
+static void
+close_items(enum astnode_t node, const struct lookahead *lookahead,
+            struct listnode **items)
 {
     int i;
     struct item *item;
-    struct listnode *checked_nodes, *next_lookahead;
+    struct lookahead next_lookahead;
 
     for (i=0; i<NUM_RULES; i++)
     {
-        if (grammar[i].type == node && !items_contains(items, &grammar[i], 0, lookahead))
+        if (grammar[i].type != node)
         {
-            item = malloc(sizeof(struct item));
-            item->rewrite_rule = &grammar[i];
-            item->cursor_position = 0;
-            item->lookahead = lookahead;
+            continue;
+        }
 
-            list_append(items, item);
+        item = add_item(items, &grammar[i], 0, lookahead);
 
-            /*
-             * Recurse if the derivation begins with variable.
-             */
-            if (grammar[i].nodes[0] > AST_INVALID)
-            {
-                if (grammar[i].length_of_nodes > 1)
-                {
-                    list_init(&checked_nodes);
-                    list_init(&next_lookahead);
-
-                    head_terminal_values(
-                        grammar[i].nodes[1],
-                        &checked_nodes,
-                        &next_lookahead);
-                    generate_items(grammar[i].nodes[0], next_lookahead, items);
-                }
-                else
-                {
-                    generate_items(grammar[i].nodes[0], lookahead, items);
-                }
-            }
+        /*
+         * Recurse if the derivation begins with variable.
+         */
+        if (item != NULL && grammar[i].length_of_nodes > 0 &&
+            grammar[i].nodes[0] > AST_INVALID)
+        {
+            rule_lookahead(&grammar[i], 0, &item->lookahead, &next_lookahead);
+            close_items(grammar[i].nodes[0], &next_lookahead, items);
         }
     }
 }
 
+/*
+ * Generate the items for a given production node. A NULL lookahead means end
+ * of input.
+ */
+void
+generate_items(enum astnode_t node, const struct lookahead *lookahead,
+               struct listnode **items)
+{
+    struct listnode *l;
+    struct item *item;
+    struct core_slot *c;
+    struct lookahead end_of_input;
+
+    if (lookahead == NULL)
+    {
+        lookahead_init(&end_of_input);
+        lookahead_add(&end_of_input, AST_INVALID);
+        lookahead = &end_of_input;
+    }
+
+    begin_cores();
+    foreach(l, *items)
+    {
+        item = (struct item *)l->data;
+        c = core_slot(items, item->rewrite_rule, item->cursor_position);
+        c->items = items;
+        c->item = item;
+        c->generation = core_generation;
+        core_count += 1;
+    }
+
+    close_items(node, lookahead, items);
+}
+
 /*
  * Generate a state with items, recursively construct connecting states and
  * transitions.
@@ -213,11 +408,17 @@ generate_items(enum astnode_t node, struct listnode *lookahead, struct listnode
 void
 generate_transitions(struct state *s)
 {
-    struct listnode *items;
+    struct listnode *items, **next_items;
     struct item *i, *j;
-    struct rule *r;
+    const struct rule *r;
+    struct lookahead lookahead;
     int index, new_index;
 
+    /*
+     * The items of every state that s links to are built together, each
+     * keyed by its core.
+     */
+    begin_cores();
 
     for (items=s->items; items!=NULL; items=items->next)
     {
@@ -229,13 +430,7 @@ generate_transitions(struct state *s)
          */
         if (i->cursor_position < r->length_of_nodes)
         {
-            j = malloc(sizeof(struct item));
-            j->rewrite_rule = i->rewrite_rule;
-
-            j->lookahead = i->lookahead;
-            j->cursor_position = i->cursor_position + 1;
-
-            index = INDEX(i->rewrite_rule->nodes[i->cursor_position]);
+            index = INDEX(r->nodes[i->cursor_position]);
             if (s->links[index] == NULL)
             {
                 assert(tmp_state_identifier < MAX_STATES);
@@ -243,60 +438,33 @@ generate_transitions(struct state *s)
                 s->links[index] = &temp_states[tmp_state_identifier++];
                 memset(s->links[index], 0, sizeof(struct state));
             }
+            next_items = &s->links[index]->items;
 
-            if (items_contains(&s->links[index]->items, j->rewrite_rule,
-                                j->cursor_position, j->lookahead))
+            /*
+             * If state already contains the item's core with all of its
+             * lookahead then continue.
+             */
+            j = add_item(next_items, r, i->cursor_position + 1, &i->lookahead);
+            if (j == NULL)
             {
-                /*
-                 * If state already contains item then continue.
-                 */
-                free(j);
                 continue;
             }
 
-            list_append(&s->links[index]->items, j);
-
-            if (j->cursor_position < j->rewrite_rule->length_of_nodes &&
-                j->rewrite_rule->nodes[j->cursor_position] > AST_INVALID)
+            if (j->cursor_position < r->length_of_nodes &&
+                r->nodes[j->cursor_position] > AST_INVALID)
             {
                 /*
-                 * Append new states due to subsequent non-terminal.
+                 * Find terminal values that can follow the current symbol.
+                 * If there is no follow symbol, or all follow symbols are
+                 * nullable, this includes the current lookahead from the
+                 * previous state. Then generate items derived from the
+                 * current symbol and add them to state with the new
+                 * lookahead.
                  */
-                struct listnode *lookahead;
-                list_init(&lookahead);
-
-                if (j->cursor_position + 1 < j->rewrite_rule->length_of_nodes)
-                {
-                    /*
-                     * If a follow symbol exists then find terminal values of
-                     * the follow symbol. Then generate items derived from the
-                     * current symbol and add them to state with the new
-                     * lookahead.
-                     */
-                    struct listnode *checked_nodes;
-                    list_init(&checked_nodes);
-
-                    head_terminal_values(
-                        j->rewrite_rule->nodes[j->cursor_position + 1],
-                        &checked_nodes,
-                        &lookahead);
-
-                    generate_items(
-                        j->rewrite_rule->nodes[j->cursor_position],
-                        lookahead, &s->links[index]->items);
-                }
-                else
-                {
-                    /*
-                     * If there is no follow symbol then simply generate the
-                     * items derived fromthe current symbol and pass along the
-                     * current lookahead from the previous state.
-                     */
-                    generate_items(
-                        j->rewrite_rule->nodes[j->cursor_position],
-                        j->lookahead, &s->links[index]->items);
-                }
-
+                rule_lookahead(r, j->cursor_position, &j->lookahead,
+                               &lookahead);
+                close_items(r->nodes[j->cursor_position], &lookahead,
+                            next_items);
             }
         }
     }
@@ -318,6 +486,7 @@ generate_transitions(struct state *s)
 
             s->links[index]->identifier = new_index;
             states[new_index] = *s->links[index];
+            index_state(new_index);
 
             generate_transitions(&states[new_index]);
         }
@@ -342,11 +511,16 @@ generate_states(void)
     struct state *s;
 
     memset(states, 0, sizeof(struct state) * MAX_STATES);
+    memset(state_index, 0, sizeof(state_index));
+    state_identifier = 0;
+    tmp_state_identifier = 0;
 
     s = &states[0];
     s->identifier = state_identifier++;
 
     generate_items(AST_TRANSLATION_UNIT, NULL, &s->items);
+    s->fingerprint = state_fingerprint(s);
+    index_state(s->identifier);
     generate_transitions(s);
 
     return s;
@@ -368,7 +542,7 @@ state_contains_item(struct state *state, struct item *item)
 
         if (item->rewrite_rule == i->rewrite_rule &&
             item->cursor_position == i->cursor_position &&
-            list_equal(item->lookahead, i->lookahead))
+            lookahead_equal(&item->lookahead, &i->lookahead))
         {
             contains = 1;
             break;
@@ -417,6 +591,57 @@ compare_states(struct state *a, struct state *b)
     return compare;
 }
 
+static unsigned long
+mix_fingerprint(unsigned long h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdUL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53UL;
+    h ^= h >> 33;
+    return h;
+}
+
+/*
+ * Returns an order-independent hash of the items in a state. States with
+ * identical items have identical fingerprints.
+ */
+unsigned long
+state_fingerprint(struct state *state)
+{
+    unsigned long fingerprint = 0;
+    struct listnode *l;
+    struct item *item;
+
+    foreach(l, state->items)
+    {
+        item = (struct item *)l->data;
+        fingerprint += mix_fingerprint(
+            ((unsigned long)(item->rewrite_rule - grammar) << 8 |
+             (unsigned long)item->cursor_position) ^
+            lookahead_hash(&item->lookahead));
+    }
+
+    return fingerprint;
+}
+
+/*
+ * Add a state in global states to the state index.
+ */
+static void
+index_state(int index)
+{
+    unsigned long slot;
+
+    slot = states[index].fingerprint % STATE_INDEX_SIZE;
+    while (state_index[slot] != 0)
+    {
+        slot = (slot + 1) % STATE_INDEX_SIZE;
+    }
+
+    state_index[slot] = index + 1;
+}
+
 /*
  * Returns the index of a state in global states that has identical items or -1
  * if does not exist.
@@ -424,658 +649,1534 @@ compare_states(struct state *a, struct state *b)
 int
 index_of_state(struct state *state)
 {
-    int index, i, match;
-    struct listnode *l;
+    unsigned long slot;
+    int index;
 
-    index = -1;
-    for (i=0; i<state_identifier; i++)
+    if (state == NULL)
+    {
+        return -1;
+    }
+
+    state->fingerprint = state_fingerprint(state);
+
+    slot = state->fingerprint % STATE_INDEX_SIZE;
+    while (state_index[slot] != 0)
     {
-        if (compare_states(state, &states[i]) == 0)
+        index = state_index[slot] - 1;
+        if (states[index].fingerprint == state->fingerprint &&
+            compare_states(state, &states[index]) == 0)
         {
-            index = i;
-            break;
+            return index;
         }
+        slot = (slot + 1) % STATE_INDEX_SIZE;
     }
 
-    return index;
+    return -1;
 }
 
-#ifdef GENPT
-void
-init_parsetable(void)
+/*
+ * Returns the item in items with the same rule and cursor position as item,
+ * ignoring lookahead, or NULL if there is none.
+ */
+static struct item *
+find_core(struct listnode *items, struct item *item)
 {
-    int i, j;
-    struct parsetable_item *row, *cell;
-    struct state *state;
-    struct listnode *node, *inner_node;
-    struct item *item;
-    int lookahead;
-    FILE *fp;
+    struct listnode *l;
+    struct item *i;
 
-    if (parsetable != NULL)
+    foreach(l, items)
     {
-        return;
+        i = (struct item *)l->data;
+        if (i->rewrite_rule == item->rewrite_rule &&
+            i->cursor_position == item->cursor_position)
+        {
+            return i;
+        }
     }
+    return NULL;
+}
 
-    generate_states();
-
-    parsetable = malloc(sizeof(struct parsetable_item) * (NUM_SYMBOLS) * (state_identifier + 1));
-    memset(parsetable, 0, sizeof(struct parsetable_item) * NUM_SYMBOLS * (state_identifier + 1));
+/*
+ * Returns whether two states have the same set of rules and cursor positions.
+ */
+static int
+same_core(struct state *a, struct state *b)
+{
+    struct listnode *l;
 
-    for (i=0; i<state_identifier; i++)
+    foreach(l, a->items)
     {
-        state = &states[i];
-        row = &parsetable[state->identifier * NUM_SYMBOLS];
-
-        for (j=0; j<NUM_SYMBOLS; j++)
+        if (find_core(b->items, (struct item *)l->data) == NULL)
         {
-            cell = row + j;
-
-            if (state->links[j] != NULL && j > AST_INVALID)
-            {
-                /*
-                 * non-terminal value
-                 */
-                cell->state = state->links[j]->identifier;
-            }
-            else if (state->links[j] != NULL && j < AST_INVALID)
-            {
-                /*
-                 * terminal value
-                 */
-                cell->shift = 1;
-                cell->state = state->links[j]->identifier;
-            }
+            return 0;
+        }
+    }
+    foreach(l, b->items)
+    {
+        if (find_core(a->items, (struct item *)l->data) == NULL)
+        {
+            return 0;
         }
+    }
+    return 1;
+}
 
-        /*
-         * Iterate over all items and for each completed rules add to parse
-         * table based on lookahead.
-         */
-        foreach(node, state->items)
+/*
+ * Merge items into merged. Items with the same core share one item in merged
+ * whose lookahead is the union of their lookaheads.
+ */
+static void
+merge_items(struct listnode **merged, struct listnode *items)
+{
+    struct listnode *l;
+    struct item *item, *core;
+
+    foreach(l, items)
+    {
+        item = (struct item *)l->data;
+        core = find_core(*merged, item);
+        if (core != NULL)
         {
-            item = ((struct item *)node->data);
-            if (item->cursor_position == item->rewrite_rule->length_of_nodes)
-            {
-                foreach(inner_node, item->lookahead)
-                {
-                    lookahead = (int)inner_node->data;
-                    cell = row + lookahead;
+            lookahead_union(&core->lookahead, &item->lookahead);
+        }
+        else
+        {
+            core = malloc(sizeof(struct item));
+            *core = *item;
+            list_append(merged, core);
+        }
+    }
+}
 
-                    cell->reduce = 1;
-                    cell->rule = item->rewrite_rule;
-                }
+/*
+ * Collect the distinct rules that items reduce on the given lookahead symbol.
+ * Returns the number of rules.
+ */
+static int
+reduce_rules(struct listnode *items, enum astnode_t symbol,
+             const struct rule **rules)
+{
+    struct listnode *l;
+    struct item *item;
+    int i, size = 0;
 
-                if (item->lookahead == NULL)
-                {
-                    /*
-                     * NULL lookahead means end of input (e.g. $). Since
-                     * nothing should match AST_INVALID, let's use that column
-                     * for NULL lookahead items.
-                     */
-                    cell = row + AST_INVALID;
+    foreach(l, items)
+    {
+        item = (struct item *)l->data;
+        if (item->cursor_position != item->rewrite_rule->length_of_nodes ||
+            !lookahead_contains(&item->lookahead, symbol))
+        {
+            continue;
+        }
 
-                    cell->reduce = 1;
-                    cell->rule = item->rewrite_rule;
-                }
+        for (i=0; i<size && rules[i]!=item->rewrite_rule; i++);
+        if (i == size)
+        {
+            rules[size++] = item->rewrite_rule;
+        }
+    }
+    return size;
+}
+
+/*
+ * Count the shift/reduce and reduce/reduce conflicts of a set of items.
+ */
+static void
+count_conflicts(struct listnode *items, int *shift_reduce, int *reduce_reduce)
+{
+    const struct rule *rules[NUM_RULES];
+    struct listnode *l;
+    struct item *item;
+    int symbol, shift;
+
+    for (symbol=0; symbol<NUM_TERMINALS; symbol++)
+    {
+        shift = 0;
+        foreach(l, items)
+        {
+            item = (struct item *)l->data;
+            if (item->cursor_position < item->rewrite_rule->length_of_nodes &&
+                item->rewrite_rule->nodes[item->cursor_position] == symbol)
+            {
+                shift = 1;
+                break;
+            }
+        }
+
+        switch (reduce_rules(items, symbol, rules))
+        {
+            case 0:
+            {
+                break;
+            }
+            case 1:
+            {
+                *shift_reduce += shift;
+                break;
+            }
+            default:
+            {
+                *shift_reduce += shift;
+                *reduce_reduce += 1;
+                break;
             }
         }
     }
+}
 
-    fp = fopen("parsetable.h", "w");
-    fprintf(fp, "/*\n");
-    fprintf(fp, " * Generated parse table file:\n");
-    fprintf(fp, " */\n");
-    fprintf(fp, " #include \"grammar.h\"\n");
-    fprintf(fp, "struct parsetable_item parsetable[%d] =\n", state_identifier * NUM_SYMBOLS);
-    fprintf(fp, "{\n");
+/*
+ * Returns whether merging items into merged keeps the reduce actions of both.
+ * A reduce/reduce conflict that neither set had on its own makes them
+ * incompatible. Shift/reduce conflicts cannot appear by merging states with the
+ * same core since both have the same shifts.
+ */
+static int
+compatible_items(struct listnode *merged, struct listnode *items)
+{
+    const struct rule *a[NUM_RULES], *b[NUM_RULES], *u[NUM_RULES * 2];
+    int symbol, i, j, a_size, b_size, u_size;
 
-    for (i=0; i<state_identifier; i++)
+    for (symbol=0; symbol<NUM_TERMINALS; symbol++)
     {
-        state = &states[i];
-        row = &parsetable[state->identifier * NUM_SYMBOLS];
+        a_size = reduce_rules(merged, symbol, a);
+        b_size = reduce_rules(items, symbol, b);
 
-        for (j=0; j<NUM_SYMBOLS; j++)
+        memcpy(u, a, sizeof(struct rule *) * a_size);
+        u_size = a_size;
+        for (i=0; i<b_size; i++)
         {
-            cell = row + j;
+            for (j=0; j<u_size && u[j]!=b[i]; j++);
+            if (j == u_size)
+            {
+                u[u_size++] = b[i];
+            }
+        }
 
-            fprintf(fp, "{ &grammar[%ld], %d, %d, %d },",
-                    cell->reduce ? cell->rule-grammar : 0,
-                    cell->shift, cell->reduce, cell->state);
+        if (u_size > 1 && u_size != a_size && u_size != b_size)
+        {
+            return 0;
         }
-        fprintf(fp, "\n");
     }
+    return 1;
+}
 
-    fprintf(fp, "};\n");
-    fclose(fp);
+/*
+ * Returns the index of the state reached from a global state on symbol or -1.
+ */
+static int
+successor(int index, int symbol)
+{
+    struct state *link = states[index].links[symbol];
+    return link != NULL ? link->identifier : -1;
 }
-#endif
 
-struct astnode *
-token_to_astnode(struct token *token)
+/*
+ * Assign every global state to a group of states that are merged together for
+ * the given mode. Groups are numbered in order of their lowest state so that
+ * the start state stays in group 0. Returns the number of groups.
+ */
+static int
+group_states(enum table_mode mode, int *group_of)
 {
-    struct astnode *node;
-    if (token->type == TOK_INTEGER)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_INTEGER_CONSTANT;
-        node->token = token;
-    }
-    if (token->type == TOK_STRING)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_STRING_CONSTANT;
-        node->token = token;
-    }
-    else if (token->type == TOK_IDENTIFIER)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_IDENTIFIER;
-        node->token = token;
-    }
-    else if (token->type == TOK_PLUS)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_PLUS;
-        node->token = token;
-    }
-    else if (token->type == TOK_PLUS_PLUS)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_PLUS_PLUS;
-        node->token = token;
-    }
-    else if (token->type == TOK_PLUS_EQUAL)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_PLUS_EQUAL;
-        node->token = token;
-    }
-    else if (token->type == TOK_MINUS)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_MINUS;
-        node->token = token;
-    }
-    else if (token->type == TOK_MINUS_MINUS)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_MINUS_MINUS;
-        node->token = token;
-    }
-    else if (token->type == TOK_MINUS_EQUAL)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_MINUS_EQUAL;
-        node->token = token;
-    }
-    else if (token->type == TOK_AMPERSAND)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_AMPERSAND;
-        node->token = token;
-    }
-    else if (token->type == TOK_AMPERSAND_AMPERSAND)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_AMPERSAND_AMPERSAND;
-        node->token = token;
-    }
-    else if (token->type == TOK_ASTERISK)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_ASTERISK;
-        node->token = token;
-    }
-    else if (token->type == TOK_ASTERISK_EQUAL)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_ASTERISK_EQUAL;
-        node->token = token;
-    }
-    else if (token->type == TOK_BACKSLASH)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_BACKSLASH;
-        node->token = token;
-    }
-    else if (token->type == TOK_BACKSLASH_EQUAL)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_BACKSLASH_EQUAL;
-        node->token = token;
-    }
-    else if (token->type == TOK_CARET)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_CARET;
-        node->token = token;
-    }
-    else if (token->type == TOK_COMMA)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_COMMA;
-        node->token = token;
-    }
-    else if (token->type == TOK_ELLIPSIS)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_ELLIPSIS;
-        node->token = token;
-    }
-    else if (token->type == TOK_MOD)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_MOD;
-        node->token = token;
-    }
-    else if (token->type == TOK_MOD_EQUAL)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_MOD_EQUAL;
-        node->token = token;
-    }
-    else if (token->type == TOK_QUESTIONMARK)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_QUESTIONMARK;
-        node->token = token;
-    }
-    else if (token->type == TOK_COLON)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_COLON;
-        node->token = token;
-    }
-    else if (token->type == TOK_SEMICOLON)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_SEMICOLON;
-        node->token = token;
-    }
-    else if (token->type == TOK_LPAREN)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_LPAREN;
-        node->token = token;
-    }
-    else if (token->type == TOK_RPAREN)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_RPAREN;
-        node->token = token;
-    }
-    else if (token->type == TOK_LBRACKET)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_LBRACKET;
-        node->token = token;
-    }
-    else if (token->type == TOK_RBRACKET)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_RBRACKET;
-        node->token = token;
-    }
-    else if (token->type == TOK_LBRACE)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_LBRACE;
-        node->token = token;
-    }
-    else if (token->type == TOK_RBRACE)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_RBRACE;
-        node->token = token;
-    }
-    else if (token->type == TOK_VERTICALBAR)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_VERTICALBAR;
-        node->token = token;
-    }
-    else if (token->type == TOK_VERTICALBAR_VERTICALBAR)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_VERTICALBAR_VERTICALBAR;
-        node->token = token;
-    }
-    else if (token->type == TOK_SHIFTLEFT)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_SHIFTLEFT;
-        node->token = token;
-    }
-    else if (token->type == TOK_SHIFTRIGHT)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_SHIFTRIGHT;
-        node->token = token;
-    }
-    else if (token->type == TOK_LESSTHAN)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_LT;
-        node->token = token;
-    }
-    else if (token->type == TOK_GREATERTHAN)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_GT;
-        node->token = token;
-    }
-    else if (token->type == TOK_LESSTHANEQUAL)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_LTEQ;
-        node->token = token;
-    }
-    else if (token->type == TOK_GREATERTHANEQUAL)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_GTEQ;
-        node->token = token;
-    }
-    else if (token->type == TOK_EQ)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_EQ;
-        node->token = token;
-    }
-    else if (token->type == TOK_NEQ)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_NEQ;
-        node->token = token;
-    }
-    else if (token->type == TOK_EQUAL)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_EQUAL;
-        node->token = token;
-    }
-    else if (token->type == TOK_VOID)
-    {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_VOID;
-        node->token = token;
-    }
-    else if (token->type == TOK_SHORT)
+    struct listnode **merged;
+    int *core_of, *renumber;
+    int i, j, k, symbol, groups, changed;
+
+    core_of = malloc(sizeof(int) * state_identifier);
+    renumber = malloc(sizeof(int) * state_identifier);
+    merged = malloc(sizeof(struct listnode *) * state_identifier);
+
+    /*
+     * core_of maps each state to the lowest state with the same core.
+     */
+    for (i=0; i<state_identifier; i++)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_SHORT;
-        node->token = token;
+        core_of[i] = i;
+        for (j=0; j<i; j++)
+        {
+            if (core_of[j] == j && same_core(&states[i], &states[j]))
+            {
+                core_of[i] = j;
+                break;
+            }
+        }
     }
-    else if (token->type == TOK_INT)
+
+    groups = 0;
+    for (i=0; i<state_identifier; i++)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_INT;
-        node->token = token;
+        group_of[i] = -1;
+
+        if (mode == TABLE_LALR && core_of[i] != i)
+        {
+            group_of[i] = group_of[core_of[i]];
+        }
+        else if (mode == TABLE_MINIMAL && core_of[i] != i)
+        {
+            /*
+             * Greedily merge into the first group with the same core that
+             * does not introduce a new conflict.
+             */
+            for (j=core_of[i]; j<i; j++)
+            {
+                k = group_of[j];
+                if (core_of[j] == core_of[i] && merged[k] != NULL &&
+                    compatible_items(merged[k], states[i].items))
+                {
+                    group_of[i] = k;
+                    merge_items(&merged[k], states[i].items);
+                    break;
+                }
+            }
+        }
+
+        if (group_of[i] == -1)
+        {
+            group_of[i] = groups;
+            list_init(&merged[groups]);
+            if (mode == TABLE_MINIMAL)
+            {
+                merge_items(&merged[groups], states[i].items);
+            }
+            groups++;
+        }
     }
-    else if (token->type == TOK_CHAR)
+
+    /*
+     * States in a group must agree on the group of every successor. Otherwise
+     * the merged state would have more than one transition on a symbol, so
+     * split groups until every transition is deterministic.
+     */
+    do
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_CHAR;
-        node->token = token;
-    }
-    else if (token->type == TOK_LONG)
+        changed = 0;
+        for (i=0; i<state_identifier; i++)
+        {
+            renumber[i] = -1;
+        }
+
+        for (i=0; i<state_identifier; i++)
+        {
+            /*
+             * Compare each state against the lowest state of its group.
+             */
+            for (j=0; group_of[j]!=group_of[i]; j++);
+
+            for (symbol=0; symbol<NUM_SYMBOLS && i!=j; symbol++)
+            {
+                if (successor(i, symbol) == -1 ||
+                    group_of[successor(i, symbol)] ==
+                    group_of[successor(j, symbol)])
+                {
+                    continue;
+                }
+
+                if (renumber[group_of[i]] == -1)
+                {
+                    renumber[group_of[i]] = groups++;
+                }
+                group_of[i] = renumber[group_of[i]];
+                changed = 1;
+                break;
+            }
+        }
+    } while (changed);
+
+    /*
+     * Renumber groups by their lowest state.
+     */
+    for (i=0; i<state_identifier; i++)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_LONG;
-        node->token = token;
+        renumber[i] = -1;
     }
-    else if (token->type == TOK_FLOAT)
+    for (i=0, k=0; i<state_identifier; i++)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_FLOAT;
-        node->token = token;
+        if (renumber[group_of[i]] == -1)
+        {
+            renumber[group_of[i]] = k++;
+        }
+        group_of[i] = renumber[group_of[i]];
     }
-    else if (token->type == TOK_DOUBLE)
+
+    free(core_of);
+    free(renumber);
+    free(merged);
+    return k;
+}
+
+/*
+ * Returns the items of a group, which are the items of its states with the
+ * lookaheads of identical cores merged.
+ */
+static struct listnode *
+group_items(int group, int *group_of)
+{
+    struct listnode *items;
+    int i, size = 0;
+
+    list_init(&items);
+    for (i=0; i<state_identifier; i++)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_DOUBLE;
-        node->token = token;
+        if (group_of[i] == group)
+        {
+            merge_items(&items, states[i].items);
+            size += 1;
+        }
     }
-    else if (token->type == TOK_SIGNED)
+
+    if (size == 1)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_SIGNED;
-        node->token = token;
+        /*
+         * Keep the items of a state that was not merged as they are.
+         */
+        for (i=0; group_of[i]!=group; i++);
+        return states[i].items;
     }
-    else if (token->type == TOK_UNSIGNED)
+    return items;
+}
+
+/*
+ * Count the states and conflicts of the automaton for the given mode without
+ * changing global states.
+ */
+void
+count_states(enum table_mode mode, int *size, int *shift_reduce,
+             int *reduce_reduce)
+{
+    int *group_of;
+    int group;
+
+    group_of = malloc(sizeof(int) * state_identifier);
+
+    *size = group_states(mode, group_of);
+    *shift_reduce = 0;
+    *reduce_reduce = 0;
+
+    for (group=0; group<*size; group++)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_UNSIGNED;
-        node->token = token;
+        count_conflicts(group_items(group, group_of), shift_reduce,
+                        reduce_reduce);
     }
-    else if (token->type == TOK_AUTO)
+
+    free(group_of);
+}
+
+/*
+ * Merge global states for the given mode. TABLE_CLR keeps the canonical
+ * states. TABLE_LALR merges every state with the same core. TABLE_MINIMAL
+ * merges states with the same core only when no new conflict is introduced.
+ */
+void
+merge_states(enum table_mode mode)
+{
+    struct state *merged;
+    int *group_of;
+    int i, group, size, symbol;
+
+    if (mode == TABLE_CLR)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_AUTO;
-        node->token = token;
+        return;
     }
-    else if (token->type == TOK_REGISTER)
+
+    group_of = malloc(sizeof(int) * state_identifier);
+    size = group_states(mode, group_of);
+    merged = malloc(sizeof(struct state) * size);
+
+    for (group=0, i=0; group<size; group++)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_REGISTER;
-        node->token = token;
+        /*
+         * Groups are numbered by their lowest state, so the first state of
+         * each group is found in order.
+         */
+        for (; group_of[i]!=group; i++);
+
+        memset(&merged[group], 0, sizeof(struct state));
+        merged[group].identifier = group;
+        merged[group].items = group_items(group, group_of);
+
+        for (symbol=0; symbol<NUM_SYMBOLS; symbol++)
+        {
+            if (successor(i, symbol) != -1)
+            {
+                merged[group].links[symbol] =
+                    &states[group_of[successor(i, symbol)]];
+            }
+        }
     }
-    else if (token->type == TOK_STATIC)
+
+    memset(states, 0, sizeof(struct state) * state_identifier);
+    memcpy(states, merged, sizeof(struct state) * size);
+    state_identifier = size;
+
+    /*
+     * Rebuild the state index for the merged states.
+     */
+    memset(state_index, 0, sizeof(state_index));
+    for (i=0; i<state_identifier; i++)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_STATIC;
-        node->token = token;
+        states[i].fingerprint = state_fingerprint(&states[i]);
+        index_state(i);
     }
-    else if (token->type == TOK_EXTERN)
+
+    free(merged);
+    free(group_of);
+}
+
+#ifdef GENPT
+/*
+ * Pack the rows of a dense table into a single comb vector. Rows with the most
+ * cells are placed first, each at the lowest base where none of its cells
+ * collide with cells already placed. Returns the size of the packed table.
+ */
+static int
+pack_rows(short *dense, unsigned char *used, int rows, int columns,
+          int *base, short **table, unsigned short **check)
+{
+    int *order, *cells;
+    int i, j, k, row, size, first_free, capacity;
+
+    order = malloc(sizeof(int) * rows);
+    cells = malloc(sizeof(int) * rows);
+    for (i=0; i<rows; i++)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_EXTERN;
-        node->token = token;
+        order[i] = i;
+        cells[i] = 0;
+        for (j=0; j<columns; j++)
+        {
+            cells[i] += used[i * columns + j];
+        }
     }
-    else if (token->type == TOK_TYPEDEF)
+
+    /*
+     * Sort rows by number of cells, most first.
+     */
+    for (i=1; i<rows; i++)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_TYPEDEF;
-        node->token = token;
+        row = order[i];
+        for (j=i; j>0 && cells[order[j - 1]]<cells[row]; j--)
+        {
+            order[j] = order[j - 1];
+        }
+        order[j] = row;
     }
-    else if (token->type == TOK_GOTO)
+
+    capacity = rows * columns + columns;
+    *table = malloc(sizeof(short) * capacity);
+    *check = malloc(sizeof(unsigned short) * capacity);
+    for (i=0; i<capacity; i++)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_GOTO;
-        node->token = token;
+        (*table)[i] = NO_ACTION;
+        (*check)[i] = NO_CHECK;
     }
-    else if (token->type == TOK_CONTINUE)
+
+    size = 0;
+    first_free = 0;
+    for (i=0; i<rows; i++)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_CONTINUE;
-        node->token = token;
+        row = order[i];
+        base[row] = 0;
+        if (cells[row] == 0)
+        {
+            continue;
+        }
+
+        for (k=first_free; ; k++)
+        {
+            for (j=0; j<columns; j++)
+            {
+                if (used[row * columns + j] && (*check)[k + j] != NO_CHECK)
+                {
+                    break;
+                }
+            }
+            if (j == columns)
+            {
+                break;
+            }
+        }
+
+        base[row] = k;
+        for (j=0; j<columns; j++)
+        {
+            if (used[row * columns + j])
+            {
+                (*table)[k + j] = dense[row * columns + j];
+                (*check)[k + j] = row;
+            }
+        }
+
+        if (k + columns > size)
+        {
+            size = k + columns;
+        }
+        while ((*check)[first_free] != NO_CHECK)
+        {
+            first_free++;
+        }
     }
-    else if (token->type == TOK_BREAK)
+
+    free(order);
+    free(cells);
+    return size;
+}
+
+/*
+ * Returns the rule of a state whose items all complete the same unit rule that
+ * is built by create_elided_node(), or NULL. Such a state always reduces
+ * regardless of the lookahead.
+ */
+static const struct rule *
+unit_rule(struct state *state)
+{
+    struct listnode *l;
+    const struct rule *rule = NULL;
+    struct item *item;
+
+    foreach(l, state->items)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_BREAK;
-        node->token = token;
+        item = (struct item *)l->data;
+        if ((rule != NULL && item->rewrite_rule != rule) ||
+            item->rewrite_rule->length_of_nodes != 1 ||
+            item->cursor_position != 1 ||
+            item->rewrite_rule->create != create_elided_node)
+        {
+            return NULL;
+        }
+        rule = item->rewrite_rule;
     }
-    else if (token->type == TOK_RETURN)
+    return rule;
+}
+
+static void
+write_array(FILE *fp, char *type, char *name, void *values, int size)
+{
+    int i, value;
+
+    fprintf(fp, "const %s %s[%d] =\n{", type, name, size);
+    for (i=0; i<size; i++)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_RETURN;
-        node->token = token;
+        if (strcmp(type, "int") == 0)
+        {
+            value = ((int *)values)[i];
+        }
+        else if (strcmp(type, "short") == 0)
+        {
+            value = ((short *)values)[i];
+        }
+        else
+        {
+            value = ((unsigned short *)values)[i];
+        }
+        fprintf(fp, "%s%d,", i % 16 == 0 ? "\n    " : " ", value);
     }
-    else if (token->type == TOK_FOR)
+    fprintf(fp, "\n};\n\n");
+}
+
+void
+init_parsetable(enum table_mode mode)
+{
+    int i, j;
+    struct parsetable_item *row, *cell;
+    struct state *state;
+    struct listnode *node;
+    struct item *item;
+    int lookahead;
+    int size, shift_reduce, reduce_reduce;
+    int action_size, goto_size, defaults, collapsed;
+    int rule_counts[NUM_RULES];
+    const struct rule *unit;
+    short *dense;
+    unsigned char *used;
+    char *mode_names[] = {"clr", "lalr", "minimal"};
+    FILE *fp;
+
+    if (parsetable != NULL)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_FOR;
-        node->token = token;
+        return;
     }
-    else if (token->type == TOK_DO)
+
+    generate_states();
+
+    /*
+     * Report the size of the automaton for every mode before merging states
+     * for the selected one.
+     */
+    for (i=TABLE_CLR; i<=TABLE_MINIMAL; i++)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_DO;
-        node->token = token;
+        count_states(i, &size, &shift_reduce, &reduce_reduce);
+        printf("%s%-7s %5d states, %d shift/reduce, %d reduce/reduce conflicts\n",
+               i == mode ? "*" : " ", mode_names[i], size, shift_reduce,
+               reduce_reduce);
     }
-    else if (token->type == TOK_WHILE)
+
+    merge_states(mode);
+
+    parsetable = malloc(sizeof(struct parsetable_item) * (NUM_SYMBOLS) * (state_identifier + 1));
+    memset(parsetable, 0, sizeof(struct parsetable_item) * NUM_SYMBOLS * (state_identifier + 1));
+
+    for (i=0; i<state_identifier; i++)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_WHILE;
-        node->token = token;
+        state = &states[i];
+        row = &parsetable[state->identifier * NUM_SYMBOLS];
+
+        for (j=0; j<NUM_SYMBOLS; j++)
+        {
+            cell = row + j;
+
+            if (state->links[j] != NULL && j > AST_INVALID)
+            {
+                /*
+                 * non-terminal value
+                 */
+                cell->state = state->links[j]->identifier;
+            }
+            else if (state->links[j] != NULL && j < AST_INVALID)
+            {
+                /*
+                 * terminal value
+                 */
+                cell->shift = 1;
+                cell->state = state->links[j]->identifier;
+            }
+        }
+
+        /*
+         * Iterate over all items and for each completed rules add to parse
+         * table based on lookahead.
+         */
+        foreach(node, state->items)
+        {
+            item = ((struct item *)node->data);
+            if (item->cursor_position == item->rewrite_rule->length_of_nodes)
+            {
+                for (lookahead=0; lookahead<NUM_TERMINALS; lookahead++)
+                {
+                    if (!lookahead_contains(&item->lookahead, lookahead))
+                    {
+                        continue;
+                    }
+
+                    /*
+                     * End of input (e.g. $) is the AST_INVALID column since
+                     * no token should otherwise match it.
+                     */
+                    cell = row + lookahead;
+
+                    cell->reduce = 1;
+                    cell->rule = item->rewrite_rule - grammar;
+                }
+            }
+        }
     }
-    else if (token->type == TOK_IF)
+
+    /*
+     * The default action of a state is its most common reduce. It is taken
+     * whenever the ACTION table has no cell for the lookahead, so those cells
+     * are left out of the table. Errors are then detected at the next shift.
+     */
+    default_action = malloc(sizeof(short) * state_identifier);
+    defaults = 0;
+
+    for (i=0; i<state_identifier; i++)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_IF;
-        node->token = token;
+        memset(rule_counts, 0, sizeof(rule_counts));
+        for (j=0; j<NUM_TERMINALS; j++)
+        {
+            cell = &parsetable[i * NUM_SYMBOLS + j];
+            if (!cell->shift && cell->reduce)
+            {
+                rule_counts[cell->rule] += 1;
+            }
+        }
+
+        default_action[i] = NO_ACTION;
+        for (j=0, lookahead=0; j<NUM_RULES; j++)
+        {
+            if (rule_counts[j] > lookahead)
+            {
+                lookahead = rule_counts[j];
+                default_action[i] = REDUCE_ACTION(j);
+            }
+        }
+        defaults += default_action[i] != NO_ACTION;
     }
-    else if (token->type == TOK_ELSE)
+
+    /*
+     * Encode and pack the ACTION table. A shift takes precedence over a
+     * reduce in the same cell.
+     */
+    dense = malloc(sizeof(short) * state_identifier * NUM_SYMBOLS);
+    used = malloc(state_identifier * NUM_SYMBOLS);
+    memset(used, 0, state_identifier * NUM_SYMBOLS);
+
+    for (i=0; i<state_identifier; i++)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_ELSE;
-        node->token = token;
+        for (j=0; j<NUM_TERMINALS; j++)
+        {
+            cell = &parsetable[i * NUM_SYMBOLS + j];
+            if (cell->shift)
+            {
+                dense[i * NUM_TERMINALS + j] = SHIFT_ACTION(cell->state);
+                used[i * NUM_TERMINALS + j] = 1;
+            }
+            else if (cell->reduce &&
+                     REDUCE_ACTION(cell->rule) != default_action[i])
+            {
+                dense[i * NUM_TERMINALS + j] = REDUCE_ACTION(cell->rule);
+                used[i * NUM_TERMINALS + j] = 1;
+            }
+        }
     }
-    else if (token->type == TOK_SWITCH)
+
+    action_base = malloc(sizeof(int) * state_identifier);
+    action_size = pack_rows(dense, used, state_identifier, NUM_TERMINALS,
+                            action_base, &action_table, &action_check);
+
+    /*
+     * The accessing symbol of a state is the symbol consumed to enter it.
+     */
+    accessing_symbol = malloc(sizeof(short) * state_identifier);
+    for (i=0; i<state_identifier; i++)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_SWITCH;
-        node->token = token;
+        accessing_symbol[i] = AST_INVALID;
+        foreach(node, states[i].items)
+        {
+            item = (struct item *)node->data;
+            if (item->cursor_position > 0)
+            {
+                accessing_symbol[i] =
+                    item->rewrite_rule->nodes[item->cursor_position - 1];
+                break;
+            }
+        }
     }
-    else if (token->type == TOK_CASE)
+
+    /*
+     * Encode and pack the GOTO table. If a goto enters a state that can only
+     * reduce a unit rule built by create_elided_node(), the goto is replaced
+     * by the goto of that rule from the same state, and so on along the
+     * chain. parse() applies the elided node type from the accessing symbol
+     * of the final state instead of reducing each unit rule.
+     */
+    memset(used, 0, state_identifier * NUM_SYMBOLS);
+    collapsed = 0;
+
+    for (i=0; i<state_identifier; i++)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_CASE;
-        node->token = token;
+        for (j=0; j<NUM_NONTERMINALS; j++)
+        {
+            if (states[i].links[NUM_TERMINALS + j] == NULL)
+            {
+                continue;
+            }
+
+            state = states[i].links[NUM_TERMINALS + j];
+            while ((unit = unit_rule(state)) != NULL &&
+                   states[i].links[INDEX(unit->type)] != NULL)
+            {
+                state = states[i].links[INDEX(unit->type)];
+                collapsed += 1;
+            }
+
+            dense[i * NUM_NONTERMINALS + j] = state->identifier;
+            used[i * NUM_NONTERMINALS + j] = 1;
+        }
     }
-    else if (token->type == TOK_DEFAULT)
+
+    goto_base = malloc(sizeof(int) * state_identifier);
+    goto_size = pack_rows(dense, used, state_identifier, NUM_NONTERMINALS,
+                          goto_base, &goto_table, &goto_check);
+
+    printf("default reductions: %d states, unit reductions collapsed: %d\n",
+           defaults, collapsed);
+    printf("action table: %d cells, goto table: %d cells, %ld bytes\n",
+           action_size, goto_size,
+           (long)(action_size + goto_size) * (sizeof(short) +
+           sizeof(unsigned short)) + (sizeof(int) * 2 + sizeof(short) * 2) *
+           state_identifier);
+
+    fp = fopen("parsetable.h", "w");
+    fprintf(fp, "/*\n");
+    fprintf(fp, " * Generated parse table file:\n");
+    fprintf(fp, " */\n");
+    fprintf(fp, "\n");
+    write_array(fp, "int", "action_base", action_base, state_identifier);
+    write_array(fp, "short", "action_table", action_table, action_size);
+    write_array(fp, "unsigned short", "action_check", action_check, action_size);
+    write_array(fp, "int", "goto_base", goto_base, state_identifier);
+    write_array(fp, "short", "goto_table", goto_table, goto_size);
+    write_array(fp, "unsigned short", "goto_check", goto_check, goto_size);
+    write_array(fp, "short", "default_action", default_action,
+                state_identifier);
+    write_array(fp, "short", "accessing_symbol", accessing_symbol,
+                state_identifier);
+    fclose(fp);
+
+    free(dense);
+    free(used);
+}
+
+/*
+ * Writes parse_direct(), a parser with the tables compiled into code. Every
+ * state is a label that switches on the lookahead and jumps straight to the
+ * next state or to the reduce of a rule. A reduce jumps to the goto block of
+ * its non-terminal, which switches on the exposed state. The macros used by
+ * the generated code are defined in parser.c.
+ */
+static void
+write_direct_parser(const char *path)
+{
+    int i, j, k, action, target, column, start_label;
+    int *reachable, *reduced, *gone_to;
+    int *targets;
+    FILE *fp;
+
+    reachable = calloc(state_identifier, sizeof(int));
+    reduced = calloc(NUM_RULES, sizeof(int));
+    gone_to = calloc(NUM_NONTERMINALS, sizeof(int));
+    targets = malloc(sizeof(int) * state_identifier);
+
+    /*
+     * Only emit blocks that can be jumped to, so that states bypassed by
+     * collapsed unit rules and unused rules do not leave dead labels.
+     */
+    for (i=0; i<state_identifier; i++)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_DEFAULT;
-        node->token = token;
+        for (j=0; j<NUM_TERMINALS; j++)
+        {
+            action = parse_action(i, AST_CHARACTER_CONSTANT + j);
+            if (IS_SHIFT(action))
+            {
+                reachable[ACTION_STATE(action)] = 1;
+            }
+        }
+        for (j=0; j<NUM_NONTERMINALS; j++)
+        {
+            column = goto_base[i] + j;
+            if (goto_check[column] == i)
+            {
+                reachable[goto_table[column]] = 1;
+            }
+        }
     }
-    else if (token->type == TOK_ENUM)
+
+    /*
+     * The start state is entered by falling through, so it only needs a label
+     * if something jumps back to it.
+     */
+    start_label = reachable[0];
+    reachable[0] = 1;
+
+    for (i=0; i<state_identifier; i++)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_ENUM;
-        node->token = token;
+        for (j=0; reachable[i] && j<NUM_TERMINALS; j++)
+        {
+            action = parse_action(i, AST_CHARACTER_CONSTANT + j);
+            if (IS_REDUCE(action))
+            {
+                reduced[ACTION_RULE(action)] = 1;
+                gone_to[GOTO_COLUMN(grammar[ACTION_RULE(action)].type)] = 1;
+            }
+        }
     }
-    else if (token->type == TOK_STRUCT)
+
+    fp = fopen(path, "w");
+    fprintf(fp, "/*\n");
+    fprintf(fp, " * Generated direct coded parser file:\n");
+    fprintf(fp, " */\n");
+    fprintf(fp, "\n");
+    fprintf(fp, "struct astnode *\n");
+    fprintf(fp, "parse_direct(struct scanner *scanner)\n");
+    fprintf(fp, "{\n");
+    fprintf(fp, "    DIRECT_PARSER_BEGIN(scanner);\n");
+
+    for (i=0; i<state_identifier; i++)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_STRUCT;
-        node->token = token;
+        if (!reachable[i])
+        {
+            continue;
+        }
+
+        if (i > 0 || start_label)
+        {
+            fprintf(fp, "\nstate_%d:\n", i);
+        }
+        fprintf(fp, "    switch (DIRECT_LOOKAHEAD())\n");
+        fprintf(fp, "    {\n");
+
+        /*
+         * Group the terminals that share an action into one case.
+         */
+        for (j=0; j<NUM_TERMINALS; j++)
+        {
+            action = parse_action(i, AST_CHARACTER_CONSTANT + j);
+            if (action == default_action[i])
+            {
+                continue;
+            }
+            for (k=0; k<j; k++)
+            {
+                if (parse_action(i, AST_CHARACTER_CONSTANT + k) == action)
+                {
+                    break;
+                }
+            }
+            if (k < j)
+            {
+                continue;
+            }
+
+            for (k=j; k<NUM_TERMINALS; k++)
+            {
+                if (parse_action(i, AST_CHARACTER_CONSTANT + k) == action)
+                {
+                    fprintf(fp, "        case %d:\n",
+                            AST_CHARACTER_CONSTANT + k);
+                }
+            }
+
+            if (IS_SHIFT(action))
+            {
+                fprintf(fp, "            DIRECT_SHIFT(%d);\n",
+                        ACTION_STATE(action));
+                fprintf(fp, "            goto state_%d;\n",
+                        ACTION_STATE(action));
+            }
+            else if (IS_REDUCE(action))
+            {
+                fprintf(fp, "            goto reduce_%d;\n",
+                        ACTION_RULE(action));
+            }
+            else
+            {
+                fprintf(fp, "            goto reject;\n");
+            }
+        }
+
+        fprintf(fp, "        default:\n");
+        if (IS_REDUCE(default_action[i]))
+        {
+            fprintf(fp, "            goto reduce_%d;\n",
+                    ACTION_RULE(default_action[i]));
+        }
+        else
+        {
+            fprintf(fp, "            goto reject;\n");
+        }
+        fprintf(fp, "    }\n");
     }
-    else if (token->type == TOK_UNION)
+
+    for (i=0; i<NUM_RULES; i++)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_UNION;
-        node->token = token;
+        if (!reduced[i])
+        {
+            continue;
+        }
+
+        fprintf(fp, "\nreduce_%d:\n", i);
+        fprintf(fp, "    DIRECT_REDUCE(%d);\n", i);
+        fprintf(fp, "    goto goto_%d;\n", GOTO_COLUMN(grammar[i].type));
     }
-    else if (token->type == TOK_CONST)
+
+    for (j=0; j<NUM_NONTERMINALS; j++)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_CONST;
-        node->token = token;
+        if (!gone_to[j])
+        {
+            continue;
+        }
+
+        for (i=0; i<state_identifier; i++)
+        {
+            column = goto_base[i] + j;
+            targets[i] = goto_check[column] == i ? goto_table[column] : -1;
+        }
+
+        fprintf(fp, "\ngoto_%d:\n", j);
+        fprintf(fp, "    switch (DIRECT_EXPOSED_STATE())\n");
+        fprintf(fp, "    {\n");
+
+        for (i=0; i<state_identifier; i++)
+        {
+            target = targets[i];
+            if (target < 0)
+            {
+                continue;
+            }
+            for (k=0; k<i; k++)
+            {
+                if (targets[k] == target)
+                {
+                    break;
+                }
+            }
+            if (k < i)
+            {
+                continue;
+            }
+
+            for (k=i; k<state_identifier; k++)
+            {
+                if (targets[k] == target)
+                {
+                    fprintf(fp, "        case %d:\n", k);
+                }
+            }
+
+            /*
+             * The goto of a collapsed unit rule also changes the node type.
+             */
+            if (accessing_symbol[target] != NUM_TERMINALS + j +
+                AST_CHARACTER_CONSTANT)
+            {
+                fprintf(fp, "            DIRECT_ELIDE(%d);\n",
+                        accessing_symbol[target]);
+            }
+            fprintf(fp, "            DIRECT_GOTO(%d);\n", target);
+            fprintf(fp, "            goto state_%d;\n", target);
+        }
+
+        fprintf(fp, "    }\n");
+        fprintf(fp, "    assert(0);\n");
     }
-    else if (token->type == TOK_VOLATILE)
+
+    fprintf(fp, "\nreject:\n");
+    fprintf(fp, "    DIRECT_REJECT();\n");
+    fprintf(fp, "\naccept:\n");
+    fprintf(fp, "    DIRECT_PARSER_END();\n");
+    fprintf(fp, "}\n");
+    fclose(fp);
+
+    free(reachable);
+    free(reduced);
+    free(gone_to);
+    free(targets);
+}
+#endif
+
+/*
+ * Terminal symbol of each token type, indexed by the type plus one so that
+ * TOK_EOF maps to AST_INVALID, the end of input. Tokens the grammar has no
+ * terminal for map to AST_ERROR, and are a syntax error wherever they appear.
+ * There is an entry for every token type in order, which the typedef below
+ * checks by failing to compile if the counts differ.
+ */
+static const enum astnode_t token_symbols[] =
+{
+    AST_INVALID,                   /* TOK_EOF */
+    AST_INTEGER_CONSTANT,          /* TOK_INTEGER */
+    AST_STRING_CONSTANT,           /* TOK_STRING */
+    AST_CHARACTER_CONSTANT,        /* TOK_CHARACTER */
+    AST_IDENTIFIER,                /* TOK_IDENTIFIER */
+    AST_LPAREN,                    /* TOK_LPAREN */
+    AST_RPAREN,                    /* TOK_RPAREN */
+    AST_LBRACKET,                  /* TOK_LBRACKET */
+    AST_RBRACKET,                  /* TOK_RBRACKET */
+    AST_LBRACE,                    /* TOK_LBRACE */
+    AST_RBRACE,                    /* TOK_RBRACE */
+    AST_SEMICOLON,                 /* TOK_SEMICOLON */
+    AST_EQUAL,                     /* TOK_EQUAL */
+    AST_BACKSLASH,                 /* TOK_BACKSLASH */
+    AST_BACKSLASH_EQUAL,           /* TOK_BACKSLASH_EQUAL */
+    AST_MOD,                       /* TOK_MOD */
+    AST_MOD_EQUAL,                 /* TOK_MOD_EQUAL */
+    AST_ERROR,                     /* TOK_BANG */
+    AST_PLUS,                      /* TOK_PLUS */
+    AST_PLUS_PLUS,                 /* TOK_PLUS_PLUS */
+    AST_PLUS_EQUAL,                /* TOK_PLUS_EQUAL */
+    AST_MINUS,                     /* TOK_MINUS */
+    AST_MINUS_MINUS,               /* TOK_MINUS_MINUS */
+    AST_MINUS_EQUAL,               /* TOK_MINUS_EQUAL */
+    AST_ARROW,                     /* TOK_ARROW */
+    AST_ASTERISK,                  /* TOK_ASTERISK */
+    AST_ASTERISK_EQUAL,            /* TOK_ASTERISK_EQUAL */
+    AST_AMPERSAND,                 /* TOK_AMPERSAND */
+    AST_AMPERSAND_AMPERSAND,       /* TOK_AMPERSAND_AMPERSAND */
+    AST_CARET,                     /* TOK_CARET */
+    AST_ERROR,                     /* TOK_TILDE */
+    AST_COMMA,                     /* TOK_COMMA */
+    AST_DOT,                       /* TOK_DOT */
+    AST_ELLIPSIS,                  /* TOK_ELLIPSIS */
+    AST_QUESTIONMARK,              /* TOK_QUESTIONMARK */
+    AST_COLON,                     /* TOK_COLON */
+    AST_VERTICALBAR,               /* TOK_VERTICALBAR */
+    AST_VERTICALBAR_VERTICALBAR,   /* TOK_VERTICALBAR_VERTICALBAR */
+    AST_ERROR,                     /* TOK_SINGLEQUOTE */
+    AST_SHIFTLEFT,                 /* TOK_SHIFTLEFT */
+    AST_SHIFTRIGHT,                /* TOK_SHIFTRIGHT */
+    AST_LT,                        /* TOK_LESSTHAN */
+    AST_GT,                        /* TOK_GREATERTHAN */
+    AST_LTEQ,                      /* TOK_LESSTHANEQUAL */
+    AST_GTEQ,                      /* TOK_GREATERTHANEQUAL */
+    AST_EQ,                        /* TOK_EQ */
+    AST_NEQ,                       /* TOK_NEQ */
+    AST_ERROR,                     /* TOK_HASH */
+    AST_ERROR,                     /* TOK_HASH_HASH */
+    AST_ERROR,                     /* TOK_OTHER */
+    AST_VOID,                      /* TOK_VOID */
+    AST_CHAR,                      /* TOK_CHAR */
+    AST_SHORT,                     /* TOK_SHORT */
+    AST_INT,                       /* TOK_INT */
+    AST_LONG,                      /* TOK_LONG */
+    AST_FLOAT,                     /* TOK_FLOAT */
+    AST_DOUBLE,                    /* TOK_DOUBLE */
+    AST_SIGNED,                    /* TOK_SIGNED */
+    AST_UNSIGNED,                  /* TOK_UNSIGNED */
+    AST_GOTO,                      /* TOK_GOTO */
+    AST_CONTINUE,                  /* TOK_CONTINUE */
+    AST_BREAK,                     /* TOK_BREAK */
+    AST_RETURN,                    /* TOK_RETURN */
+    AST_FOR,                       /* TOK_FOR */
+    AST_DO,                        /* TOK_DO */
+    AST_WHILE,                     /* TOK_WHILE */
+    AST_IF,                        /* TOK_IF */
+    AST_ELSE,                      /* TOK_ELSE */
+    AST_SWITCH,                    /* TOK_SWITCH */
+    AST_CASE,                      /* TOK_CASE */
+    AST_DEFAULT,                   /* TOK_DEFAULT */
+    AST_ENUM,                      /* TOK_ENUM */
+    AST_STRUCT,                    /* TOK_STRUCT */
+    AST_UNION,                     /* TOK_UNION */
+    AST_CONST,                     /* TOK_CONST */
+    AST_VOLATILE,                  /* TOK_VOLATILE */
+    AST_AUTO,                      /* TOK_AUTO */
+    AST_REGISTER,                  /* TOK_REGISTER */
+    AST_STATIC,                    /* TOK_STATIC */
+    AST_EXTERN,                    /* TOK_EXTERN */
+    AST_TYPEDEF,                   /* TOK_TYPEDEF */
+};
+
+typedef char token_symbols_match_token_types[
+    sizeof(token_symbols) / sizeof(token_symbols[0]) == NUM_TOKEN_TYPES + 1 ?
+    1 : -1];
+
+/*
+ * Terminal nodes are allocated from an arena since they are created for every
+ * token and live as long as the tree.
+ */
+static struct arena terminal_nodes;
+
+struct astnode *
+token_to_astnode(const struct tokens *tokens, int token)
+{
+    struct astnode *node;
+
+    node = arena_alloc(&terminal_nodes, sizeof(struct astnode));
+    node->type = token_symbols[tokens->types[token] + 1];
+    node->tokens = tokens;
+    node->token = token;
+    return node;
+}
+
+/*
+ * Reports a syntax error at a token and exits.
+ */
+static void
+syntax_error(struct scanner *scanner, int token)
+{
+    const struct tokens *tokens = &scanner->tokens;
+
+    if (tokens->types[token] == TOK_EOF)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_VOLATILE;
-        node->token = token;
+        scanner_error(scanner, "syntax error at end of input");
     }
-    else if (token->type == TOK_EOF)
+    scanner_error(scanner, "syntax error at \"%.*s\"",
+                  (int)tokens->lengths[token], token_text(tokens, token));
+}
+
+/*
+ * Scans the next token into token and returns its terminal node. A token the
+ * grammar has no terminal for is a syntax error.
+ */
+static struct astnode *
+next_terminal(struct scanner *scanner, int *token)
+{
+    struct astnode *node;
+
+    *token = next_token(scanner);
+    node = token_to_astnode(&scanner->tokens, *token);
+    if (node->type == AST_ERROR)
     {
-        node = malloc(sizeof(struct astnode));
-        node->type = AST_INVALID;
-        node->token = token;
+        syntax_error(scanner, *token);
     }
-
     return node;
 }
 
+/*
+ * Returns the packed ACTION cell for a state and terminal, or the default
+ * action of the state if the table has no cell.
+ */
+int
+parse_action(int state, enum astnode_t symbol)
+{
+    int i = action_base[state] + INDEX(symbol);
+    return action_check[i] == state ? action_table[i] : default_action[state];
+}
+
+/*
+ * Returns the state to go to after reducing to a non-terminal.
+ */
+int
+parse_goto(int state, enum astnode_t symbol)
+{
+    int i = goto_base[state] + GOTO_COLUMN(symbol);
+    assert(goto_check[i] == state);
+    return goto_table[i];
+}
+
+/*
+ * Doubles the size of the parse stack.
+ */
+static void
+grow_parse_stack(int **state_stack, struct astnode ***node_stack, int *size)
+{
+    *size *= 2;
+    *state_stack = realloc(*state_stack, sizeof(int) * *size);
+    *node_stack = realloc(*node_stack, sizeof(struct astnode *) * *size);
+}
+
 struct astnode *
-parse(struct listnode *tokens)
+parse(struct scanner *scanner)
 {
-    struct astnode *node, *root;
-    struct listnode *stack;
-    struct listnode *token;
-    struct parsetable_item *row, *cell;
-    static int zero = 0;
-    int i;
+    struct astnode *node, *root = NULL;
+    const struct rule *rule;
+    int token, action, state, top, size;
 
-    list_init(&stack);
+    /*
+     * The parse stack is kept as parallel arrays of states and nodes, so the
+     * children of a rule are contiguous at the top of the node stack. The node
+     * of an entry is the symbol shifted or reduced to enter its state.
+     */
+    int *state_stack;
+    struct astnode **node_stack;
+
+    size = INITIAL_PARSE_STACK_SIZE;
+    state_stack = malloc(sizeof(int) * size);
+    node_stack = malloc(sizeof(struct astnode *) * size);
 
     /*
      * Stack starts at state 0.
      */
-    list_prepend(&stack, &zero);
+    top = 0;
+    state_stack[top] = 0;
+    node_stack[top] = NULL;
+
+    /*
+     * Tokens are pulled from the scanner one at a time. The node of the
+     * lookahead token is made once, when the token is reached, and reused
+     * while reductions are made on it.
+     */
+    node = next_terminal(scanner, &token);
 
-    for (token=tokens; token!=NULL; )
+    for (;;)
     {
-        row = parsetable + *(int *)stack->data * NUM_SYMBOLS;
+        action = parse_action(state_stack[top], node->type);
+
+        if (top + 1 == size)
+        {
+            /*
+             * Both shift and reduce push at most one entry.
+             */
+            grow_parse_stack(&state_stack, &node_stack, &size);
+        }
 
-        node = token_to_astnode((struct token *)token->data);
-        cell = row + INDEX(node->type);
-        if (cell->shift)
+        if (IS_SHIFT(action))
         {
             /*
              * Shift involves pushing node and state onto stack.
              */
-            list_prepend(&stack, node);
-            list_prepend(&stack, &cell->state);
+            top += 1;
+            state_stack[top] = ACTION_STATE(action);
+            node_stack[top] = node;
 
             /*
              * Consume a token
              */
-            token=token->next;
+            if (scanner->tokens.types[token] == TOK_EOF)
+            {
+                break;
+            }
+            node = next_terminal(scanner, &token);
         }
-        else if (cell->reduce)
+        else if (IS_REDUCE(action))
         {
-            root = cell->rule->create(stack, cell->rule);
+            rule = &grammar[ACTION_RULE(action)];
 
             /*
              * Reduce involves removing the astnodes that compose the rule from
              * the stack. Then create the reduced astnode and push it onto the
              * stack.
              */
-            for (i=0; i<cell->rule->length_of_nodes; i++)
-            {
-                /*
-                 * Remove astnode and cell state from the stack.
-                 */
-                stack = stack->next->next;
-            }
+            top -= rule->length_of_nodes;
+            root = rule->create(&node_stack[top + 1], rule);
 
             /*
              * Push the reduced node and the next state number.
              */
-            row = parsetable + *(int *)stack->data * NUM_SYMBOLS;
-            cell = row + INDEX(root->type);
+            state = parse_goto(state_stack[top], root->type);
+            if (accessing_symbol[state] != root->type)
+            {
+                /*
+                 * The goto skipped unit reductions by create_elided_node(),
+                 * so apply the same change to the node.
+                 */
+                if (!root->elided_type)
+                {
+                    root->elided_type = root->type;
+                }
+                root->type = accessing_symbol[state];
+            }
 
-            list_prepend(&stack, root);
-            list_prepend(&stack, &cell->state);
+            top += 1;
+            state_stack[top] = state;
+            node_stack[top] = root;
 
             /*
-             * Next iteration will use the cell->state, but should reuse the
-             * current input token. (Do not increment token->next)
+             * Next iteration will use the goto state, but should reuse the
+             * current input token. (Do not pull the next token)
              */
         }
         else
         {
             /*
              * We expect to be neither shift nor reduce iff this is the last
-             * token.
+             * token. Otherwise the token cannot follow what came before it.
              */
-            assert(token->next == NULL);
+            if (scanner->tokens.types[token] != TOK_EOF)
+            {
+                syntax_error(scanner, token);
+            }
             break;
         }
     }
 
+    free(state_stack);
+    free(node_stack);
     return root;
 }
 
 #ifdef GENPT
 int
-main(int argc, char *agv[])
+main(int argc, char *argv[])
 {
-    init_parsetable();
+    enum table_mode mode = TABLE_CLR;
+    int direct = 0;
+
+    if (argc > 1 && strcmp(argv[1], "lalr") == 0)
+    {
+        mode = TABLE_LALR;
+    }
+    else if (argc > 1 && strcmp(argv[1], "minimal") == 0)
+    {
+        mode = TABLE_MINIMAL;
+    }
+    else if (argc > 1 && strcmp(argv[1], "clr") != 0)
+    {
+        printf("Unknown mode %s. Must be one of clr, lalr or minimal.\n",
+               argv[1]);
+        return 1;
+    }
+
+    if (argc > 2 && strcmp(argv[2], "direct") == 0)
+    {
+        direct = 1;
+    }
+    else if (argc > 2 && strcmp(argv[2], "table") != 0)
+    {
+        printf("Unknown parser %s. Must be one of table or direct.\n",
+               argv[2]);
+        return 1;
+    }
+
+    init_parsetable(mode);
+    if (direct)
+    {
+        write_direct_parser("parse_direct.h");
+    }
+    return 0;
 }
 #endif
+
+#ifdef DIRECT_PARSER
+/*
+ * Macros used by the generated parse_direct(). It keeps the same stacks as
+ * parse(), but the current state is the label being run instead of a value
+ * read back from the stack. Growing the stack stays out of line, since it is
+ * expanded at every shift and goto.
+ */
+#define DIRECT_PARSER_BEGIN(scanner) \
+    struct astnode *node, *root = NULL; \
+    int token; \
+    const struct rule *rule; \
+    int top = 0, size = INITIAL_PARSE_STACK_SIZE; \
+    int *state_stack = malloc(sizeof(int) * size); \
+    struct astnode **node_stack = malloc(sizeof(struct astnode *) * size); \
+    state_stack[0] = 0; \
+    node_stack[0] = NULL; \
+    node = next_terminal(scanner, &token)
+
+#define DIRECT_LOOKAHEAD() (node->type)
+
+#define DIRECT_EXPOSED_STATE() (state_stack[top])
+
+#define DIRECT_PUSH(state, pushed) \
+    do \
+    { \
+        if (top + 1 == size) \
+        { \
+            grow_parse_stack(&state_stack, &node_stack, &size); \
+        } \
+        top += 1; \
+        state_stack[top] = (state); \
+        node_stack[top] = (pushed); \
+    } while (0)
+
+#define DIRECT_SHIFT(state) \
+    do \
+    { \
+        DIRECT_PUSH(state, node); \
+        if (scanner->tokens.types[token] == TOK_EOF) \
+        { \
+            goto accept; \
+        } \
+        node = next_terminal(scanner, &token); \
+    } while (0)
+
+#define DIRECT_REDUCE(index) \
+    do \
+    { \
+        rule = &grammar[index]; \
+        top -= rule->length_of_nodes; \
+        root = rule->create(&node_stack[top + 1], rule); \
+    } while (0)
+
+#define DIRECT_ELIDE(symbol) \
+    do \
+    { \
+        if (!root->elided_type) \
+        { \
+            root->elided_type = root->type; \
+        } \
+        root->type = (symbol); \
+    } while (0)
+
+#define DIRECT_GOTO(state) DIRECT_PUSH(state, root)
+
+#define DIRECT_REJECT() \
+    do \
+    { \
+        if (scanner->tokens.types[token] != TOK_EOF) \
+        { \
+            syntax_error(scanner, token); \
+        } \
+    } while (0)
+
+#define DIRECT_PARSER_END() \
+    do \
+    { \
+        free(state_stack); \
+        free(node_stack); \
+        return root; \
+    } while (0)
+
+#include "parse_direct.h"
+#endif
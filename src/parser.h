@@ -156,7 +156,13 @@ enum astnode_t
     AST_DECLARATION,
     AST_FUNCTION_DEFINITION,
     AST_EXTERNAL_DECLARATION,
-    AST_TRANSLATION_UNIT
+    AST_TRANSLATION_UNIT,
+
+    /*
+     * symbol of a token the grammar has no terminal for, which is not in the
+     * parse table
+     */
+    AST_ERROR
 };
 
 
@@ -165,23 +171,44 @@ enum astnode_t
 struct rule
 {
     enum astnode_t type;
-    struct astnode *(*create)(struct listnode *list, struct rule *rule);
+    /*
+     * create builds the node of the rule from its length_of_nodes children,
+     * which are passed in rule order.
+     */
+    struct astnode *(*create)(struct astnode **nodes, const struct rule *rule);
     int length_of_nodes;
     enum astnode_t nodes[MAX_ASTNODES];
 };
 
 #define NUM_RULES 207
 
+#define NUM_TERMINALS (AST_INVALID - AST_CHARACTER_CONSTANT+ 1)
+#define NUM_SYMBOLS (AST_TRANSLATION_UNIT - AST_CHARACTER_CONSTANT + 1)
+#define INDEX(s) ((s) - AST_CHARACTER_CONSTANT)
+
+#define LOOKAHEAD_BITS 64
+#define LOOKAHEAD_WORDS ((NUM_TERMINALS + LOOKAHEAD_BITS - 1) / LOOKAHEAD_BITS)
+
+/*
+ * lookahead is a set of terminal symbols stored as a bitset. AST_INVALID is
+ * used for the end of input (e.g. $).
+ */
+struct lookahead
+{
+    unsigned long words[LOOKAHEAD_WORDS];
+};
+
 /*
  * item is a rule with a cursor position to indicate how many symbols have been
- * consumed.
+ * consumed. The rule and cursor position are the item's core, and a state has
+ * one item per core with the union of the lookaheads it was reached with.
  */
 struct item
 {
     /*
      * rule that is being used.
      */
-    struct rule *rewrite_rule;
+    const struct rule *rewrite_rule;
 
     /*
      * position into the rule.
@@ -189,15 +216,11 @@ struct item
     int cursor_position;
 
     /*
-     * list of lookahead symbols.
+     * set of lookahead symbols.
      */
-    struct listnode *lookahead;
+    struct lookahead lookahead;
 };
 
-#define NUM_TERMINALS (AST_INVALID - AST_CHARACTER_CONSTANT+ 1)
-#define NUM_SYMBOLS (AST_TRANSLATION_UNIT - AST_CHARACTER_CONSTANT + 1)
-#define INDEX(s) ((s) - AST_CHARACTER_CONSTANT)
-
 /*
  * state contains information of a set of items.
  */
@@ -213,6 +236,11 @@ struct state
      */
     struct listnode *items;
 
+    /*
+     * order-independent hash of items used to find duplicate states.
+     */
+    unsigned long fingerprint;
+
     /*
      * links maps symbol transitions to other states.
      */
@@ -221,40 +249,115 @@ struct state
 
 #define MAX_STATES 32768
 
+/*
+ * table_mode selects how states of the canonical LR(1) automaton are merged
+ * before building the parse table.
+ */
+enum table_mode
+{
+    /*
+     * canonical LR(1), states are not merged.
+     */
+    TABLE_CLR,
+
+    /*
+     * LALR(1), all states with the same core are merged.
+     */
+    TABLE_LALR,
+
+    /*
+     * minimal LR(1), states with the same core are merged only if that does
+     * not introduce a reduce/reduce conflict.
+     */
+    TABLE_MINIMAL
+};
+
 /*
  * item inside a parse table row.
  */
 struct parsetable_item
 {
     /*
-     * rule to reduce, if this is a reduce operation.
+     * index into grammar of the rule to reduce, if this is a reduce operation.
      */
-    struct rule *rule;
+    short rule;
 
     /*
      * shift indicates whether this is a shift operation. It cannot be both a
      * shift and reduce operation.
      */
-    int shift;
+    char shift;
 
     /*
      * reduce indicates whether this is a shift operation. It cannot be both a
      * shift and reduce operation.
      */
-    int reduce;
+    char reduce;
 
     /*
      * state indicates the next state to shift to.
      */
-    int state;
+    unsigned short state;
 };
 
+/*
+ * The parse table is packed into ACTION and GOTO tables of 16-bit cells using
+ * row displacement. The cell of a state and symbol is at base[state] + column
+ * and is only valid if check holds the state at that position.
+ *
+ * An ACTION cell is indexed by terminal. It is NO_ACTION for an error, a
+ * positive value to shift to ACTION_STATE(value), or a negative value to
+ * reduce by grammar[ACTION_RULE(value)]. A GOTO cell is indexed by
+ * non-terminal and holds the next state.
+ */
+#define NO_ACTION 0
+#define SHIFT_ACTION(state) ((state) + 1)
+#define REDUCE_ACTION(rule) (-(rule) - 1)
+#define IS_SHIFT(action) ((action) > 0)
+#define IS_REDUCE(action) ((action) < 0)
+#define ACTION_STATE(action) ((action) - 1)
+#define ACTION_RULE(action) (-(action) - 1)
+
+#define GOTO_COLUMN(s) (INDEX(s) - NUM_TERMINALS)
+#define NUM_NONTERMINALS (NUM_SYMBOLS - NUM_TERMINALS)
+
+/*
+ * check value of a packed cell that belongs to no state.
+ */
+#define NO_CHECK 0xFFFF
+
+#define INITIAL_PARSE_STACK_SIZE 256
+
+void
+lookahead_init(struct lookahead *lookahead);
+
+void
+lookahead_add(struct lookahead *lookahead, enum astnode_t symbol);
+
+int
+lookahead_contains(const struct lookahead *lookahead, enum astnode_t symbol);
+
+int
+lookahead_union(struct lookahead *a, const struct lookahead *b);
+
+int
+lookahead_equal(const struct lookahead *a, const struct lookahead *b);
+
+unsigned long
+lookahead_hash(const struct lookahead *lookahead);
+
 void
-head_terminal_values(enum astnode_t node, struct listnode **checked_nodes,
-                     struct listnode **terminals);
+generate_first_sets(void);
+
+const struct lookahead *
+first_terminals(enum astnode_t node);
+
+int
+is_nullable(enum astnode_t node);
 
 void
-generate_items(enum astnode_t node, struct listnode *lookahead, struct listnode **items);
+generate_items(enum astnode_t node, const struct lookahead *lookahead,
+               struct listnode **items);
 
 void
 generate_transitions(struct state *state);
@@ -268,16 +371,44 @@ state_contains_item(struct state *state, struct item *item);
 int
 compare_states(struct state *a, struct state *b);
 
+unsigned long
+state_fingerprint(struct state *state);
+
 int
 index_of_state(struct state *state);
 
 void
-init_parsetable(void);
+count_states(enum table_mode mode, int *size, int *shift_reduce,
+             int *reduce_reduce);
+
+void
+merge_states(enum table_mode mode);
+
+void
+init_parsetable(enum table_mode mode);
+
+int
+parse_action(int state, enum astnode_t symbol);
+
+int
+parse_goto(int state, enum astnode_t symbol);
 
 struct astnode *
-token_to_astnode(struct token * token);
+token_to_astnode(const struct tokens *tokens, int token);
 
+/*
+ * Parses the tokens of a scanner into an AST, pulling one token at a time.
+ */
 struct astnode *
-parse(struct listnode *tokens);
+parse(struct scanner *scanner);
+
+#ifdef DIRECT_PARSER
+/*
+ * Same as parse(), but generated by genpt as direct coded states instead of
+ * interpreting the parse table. parse() is kept as the reference.
+ */
+struct astnode *
+parse_direct(struct scanner *scanner);
+#endif
 
 #endif
@@ -1,537 +1,4249 @@
+#include <limits.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "scanner.h"
 
-static enum token_t reserved_word_token(char *str, size_t len);
-
-struct token reserved_map[] =
-{
-    { TOK_VOID, "void" },
-    { TOK_CHAR, "char" },
-    { TOK_SHORT, "short" },
-    { TOK_INT, "int" },
-    { TOK_LONG, "long" },
-    { TOK_FLOAT, "float" },
-    { TOK_DOUBLE, "double" },
-    { TOK_SIGNED, "signed" },
-    { TOK_UNSIGNED, "unsigned" },
-    { TOK_GOTO, "goto" },
-    { TOK_CONTINUE, "continue" },
-    { TOK_BREAK, "break" },
-    { TOK_RETURN, "return" },
-    { TOK_FOR, "for" },
-    { TOK_DO, "do" },
-    { TOK_WHILE, "while" },
-    { TOK_IF, "if" },
-    { TOK_ELSE, "else" },
-    { TOK_SWITCH, "switch" },
-    { TOK_CASE, "case" },
-    { TOK_DEFAULT, "default" },
-    { TOK_ENUM, "enum" },
-    { TOK_STRUCT, "struct" },
-    { TOK_UNION, "union" },
-    { TOK_CONST, "const" },
-    { TOK_VOLATILE, "volatile" },
-    { TOK_AUTO, "auto" },
-    { TOK_REGISTER, "register" },
-    { TOK_STATIC, "static" },
-    { TOK_EXTERN, "extern" },
-    { TOK_TYPEDEF, "typedef" },
-    { TOK_EOF, "" } /* TOK_EOF must be last entry */
+#if defined(__GNUC__) && defined(__SSE2__)
+#define SCANNER_SIMD 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Reserved words are found with a perfect hash of the length and the first and
+ * last characters: len + keyword_hash_values[first] + keyword_hash_values[last].
+ * The values were searched offline so that no two reserved words share a slot.
+ * Letters that do not begin or end a reserved word are out of range, so any
+ * word that uses them is rejected without a compare.
+ */
+#define KEYWORD_HASH_SIZE 41
+#define MIN_KEYWORD_LENGTH 2
+#define MAX_KEYWORD_LENGTH 8
+
+static const unsigned char keyword_hash_values[26] =
+{
+    0, /* a */
+    3, /* b */
+    6, /* c */
+    0, /* d */
+    7, /* e */
+    22, /* f */
+    1, /* g */
+    15, /* h */
+    5, /* i */
+    KEYWORD_HASH_SIZE, /* j */
+    31, /* k */
+    2, /* l */
+    4, /* m */
+    20, /* n */
+    1, /* o */
+    KEYWORD_HASH_SIZE, /* p */
+    KEYWORD_HASH_SIZE, /* q */
+    9, /* r */
+    16, /* s */
+    3, /* t */
+    15, /* u */
+    12, /* v */
+    26, /* w */
+    KEYWORD_HASH_SIZE, /* x */
+    KEYWORD_HASH_SIZE, /* y */
+    KEYWORD_HASH_SIZE, /* z */
+};
+
+struct keyword
+{
+    char value[MAX_KEYWORD_LENGTH + 1];
+    size_t length;
+    enum token_t type;
+};
+
+static const struct keyword keyword_table[KEYWORD_HASH_SIZE] =
+{
+    { "", 0, TOK_EOF },
+    { "", 0, TOK_EOF },
+    { "", 0, TOK_EOF },
+    { "do", 2, TOK_DO },
+    { "", 0, TOK_EOF },
+    { "auto", 4, TOK_AUTO },
+    { "goto", 4, TOK_GOTO },
+    { "long", 4, TOK_LONG },
+    { "", 0, TOK_EOF },
+    { "", 0, TOK_EOF },
+    { "default", 7, TOK_DEFAULT },
+    { "int", 3, TOK_INT },
+    { "", 0, TOK_EOF },
+    { "double", 6, TOK_DOUBLE },
+    { "const", 5, TOK_CONST },
+    { "enum", 4, TOK_ENUM },
+    { "void", 4, TOK_VOID },
+    { "case", 4, TOK_CASE },
+    { "else", 4, TOK_ELSE },
+    { "char", 4, TOK_CHAR },
+    { "", 0, TOK_EOF },
+    { "continue", 8, TOK_CONTINUE },
+    { "signed", 6, TOK_SIGNED },
+    { "unsigned", 8, TOK_UNSIGNED },
+    { "short", 5, TOK_SHORT },
+    { "struct", 6, TOK_STRUCT },
+    { "register", 8, TOK_REGISTER },
+    { "volatile", 8, TOK_VOLATILE },
+    { "static", 6, TOK_STATIC },
+    { "if", 2, TOK_IF },
+    { "float", 5, TOK_FLOAT },
+    { "", 0, TOK_EOF },
+    { "typedef", 7, TOK_TYPEDEF },
+    { "extern", 6, TOK_EXTERN },
+    { "for", 3, TOK_FOR },
+    { "return", 6, TOK_RETURN },
+    { "", 0, TOK_EOF },
+    { "switch", 6, TOK_SWITCH },
+    { "while", 5, TOK_WHILE },
+    { "break", 5, TOK_BREAK },
+    { "union", 5, TOK_UNION },
 };
 
 static enum token_t
 reserved_word_token(char *str, size_t len)
 {
-    enum token_t t = TOK_EOF;
-    int i;
+    const struct keyword *keyword;
+    unsigned int hash;
 
-    for (i = 0; reserved_map[i].type != TOK_EOF; i++)
+    if (len < MIN_KEYWORD_LENGTH || len > MAX_KEYWORD_LENGTH ||
+        str[0] < 'a' || str[0] > 'z' ||
+        str[len - 1] < 'a' || str[len - 1] > 'z')
     {
-        if (len != strlen(reserved_map[i].value))
-        {
-            continue;
-        }
-        if (strncmp(str, reserved_map[i].value, len) == 0)
-        {
-            t = reserved_map[i].type;
-            break;
-        }
+        return TOK_EOF;
     }
 
-    return t;
-}
-
-void
-preprocess(char *infile, char *outfile)
-{
-    char *in_content;
-    char *out_content;
-    int in_index;
-    int out_index;
-    struct listnode *transforms;
-
-    list_init(&transforms);
+    hash = len + keyword_hash_values[str[0] - 'a'] +
+           keyword_hash_values[str[len - 1] - 'a'];
+    if (hash >= KEYWORD_HASH_SIZE)
+    {
+        return TOK_EOF;
+    }
 
     /*
-     * Find macros and includes inside infile in order to construct outfile
-     * replacing  macros and includes
+     * Confirm the candidate with a single compare of the word.
      */
-    for (;;)
+    keyword = &keyword_table[hash];
+    if (keyword->length == len && memcmp(str, keyword->value, len) == 0)
     {
+        return keyword->type;
     }
+    return TOK_EOF;
 }
 
+static size_t (*scan_run)(const unsigned char *content, size_t i,
+                          size_t content_len, int run);
+static void init_scanner_tables(void);
+static int line_ends_between(const char *content, size_t from, size_t to);
+
 void
-scan(char *content, size_t content_len, struct listnode **tokens)
+scanner_init(struct scanner *scanner, char *content, size_t content_len)
 {
-    struct token *tok;
-    size_t i, tok_start, tok_end, tok_size;
-
-    for (i=0; i<content_len;)
+    if (scan_run == NULL)
     {
-        if (isalpha(content[i]) || content[i] == '_')
-        {
-            tok_start = i;
+        scanner_use_simd(SCANNER_AVX2);
+    }
+    init_scanner_tables();
 
-            /* consume characters */
-            while (i < content_len && (isalpha(content[i]) ||
-                                       isdigit(content[i]) ||
-                                       content[i] == '_'))
-            {
-                i += 1;
-            }
-            tok_end = i;
-            tok_size = tok_end - tok_start;
+    scanner->content = content;
+    scanner->content_len = content_len;
+    scanner->position = 0;
+    scanner->hash_starts_line = 0;
+    tokens_init(&scanner->tokens);
+    scanner->base = tokens_add_source(&scanner->tokens, content, content_len);
 
-            tok = (struct token *)malloc(sizeof(struct token));
+    scanner->filename = NULL;
+    scanner->file = NULL;
+    list_init(&scanner->includes);
+    scanner->include_depth = 0;
+    list_init(&scanner->include_paths);
+    list_init(&scanner->dependencies);
 
-            /*
-             * Check if this token is a reserved word. If not then consider it
-             * a label.
-             */
-            tok->type = reserved_word_token(&content[tok_start], tok_size);
-            if (tok->type == TOK_EOF)
-            {
-                tok->type = TOK_IDENTIFIER;
-                tok->value = (char *)malloc(sizeof(char) * tok_size + 1);
-                strncpy(tok->value, content + tok_start, tok_size);
-                tok->value[tok_size] = '\0';
-            }
+    list_init(&scanner->conditionals);
+    scanner->guard_name = -1;
+    scanner->guard_end = 0;
 
-            list_append(tokens, tok);
-        }
-        else if (isdigit(content[i]))
-        {
-            tok_start = i;
+    scanner->macros = NULL;
+    scanner->macros_size = 0;
+    memset(scanner->keyword_macros, 0, sizeof(scanner->keyword_macros));
+    scanner->macros_digest = 0;
+    scanner->pending.items = NULL;
+    scanner->pending.count = 0;
+    scanner->pending.size = 0;
+    scanner->arguments_depth = 0;
 
-            /* consume digits */
-            while (i < content_len && isdigit(content[i]))
-            {
-                i += 1;
-            }
-            tok_end = i;
-            tok_size = tok_end - tok_start;
+    scanner->pch_directory = NULL;
+    scanner->recording = NULL;
+    scanner->replay = NULL;
+    scanner->replay_count = 0;
+    scanner->replay_base = 0;
+    scanner->replay_names = NULL;
+    scanner->replay_constants = NULL;
 
-            tok = (struct token *)malloc(sizeof(struct token));
+    arena_init(&scanner->arena);
+}
 
-            tok->type = TOK_INTEGER;
-            tok->value = (char *)malloc(sizeof(char) * tok_size);
-            strncpy(tok->value, content + tok_start, tok_size);
-            tok->value[tok_size] = '\0';
+void
+scanner_set_filename(struct scanner *scanner, const char *filename)
+{
+    scanner->filename = filename;
+}
 
-            list_append(tokens, tok);
-        }
-        else if (content[i] == '(')
-        {
-            i += 1;
+void
+scanner_add_include_path(struct scanner *scanner, const char *path)
+{
+    list_append(&scanner->include_paths, (void *)path);
+}
 
-            tok = (struct token *)malloc(sizeof(struct token));
-            tok->type = TOK_LPAREN;
+void
+scanner_set_pch_directory(struct scanner *scanner, const char *directory)
+{
+    scanner->pch_directory = directory;
+}
 
-            list_append(tokens, tok);
-        }
-        else if (content[i] == ')')
-        {
-            i += 1;
+void
+tokens_init(struct tokens *tokens)
+{
+    tokens->count = 0;
+    tokens->size = INITIAL_TOKENS_SIZE;
+    tokens->types = malloc(sizeof(signed char) * tokens->size);
+    tokens->offsets = malloc(sizeof(unsigned int) * tokens->size);
+    tokens->lengths = malloc(sizeof(unsigned int) * tokens->size);
+    tokens->values = malloc(sizeof(int) * tokens->size);
 
-            tok = (struct token *)malloc(sizeof(struct token));
-            tok->type = TOK_RPAREN;
+    tokens->constants_count = 0;
+    tokens->constants_size = INITIAL_TOKENS_SIZE;
+    tokens->constants = malloc(sizeof(struct constant) *
+                               tokens->constants_size);
 
-            list_append(tokens, tok);
-        }
-        else if (content[i] == '[')
-        {
-            i += 1;
+    tokens->sources_count = 0;
+    tokens->sources_size = INITIAL_SOURCES_SIZE;
+    tokens->sources = malloc(sizeof(struct source) * tokens->sources_size);
+    tokens->end = 0;
+}
 
-            tok = (struct token *)malloc(sizeof(struct token));
-            tok->type = TOK_LBRACKET;
+unsigned int
+tokens_add_source(struct tokens *tokens, const char *content, size_t length)
+{
+    struct source *source;
 
-            list_append(tokens, tok);
-        }
-        else if (content[i] == ']')
-        {
-            i += 1;
+    if (tokens->sources_count == tokens->sources_size)
+    {
+        tokens->sources_size *= 2;
+        tokens->sources = realloc(tokens->sources,
+                                  sizeof(struct source) * tokens->sources_size);
+    }
 
-            tok = (struct token *)malloc(sizeof(struct token));
-            tok->type = TOK_RBRACKET;
+    /*
+     * Leave room after the last byte for the offset of a TOK_EOF.
+     */
+    source = &tokens->sources[tokens->sources_count++];
+    source->content = content;
+    source->base = tokens->end;
+    tokens->end += length + 1;
+    return source->base;
+}
 
-            list_append(tokens, tok);
-        }
-        else if (content[i] == '{')
-        {
-            i += 1;
+int
+tokens_append(struct tokens *tokens, enum token_t type, size_t offset,
+              size_t length, int value)
+{
+    if (tokens->count == tokens->size)
+    {
+        tokens->size *= 2;
+        tokens->types = realloc(tokens->types,
+                                sizeof(signed char) * tokens->size);
+        tokens->offsets = realloc(tokens->offsets,
+                                  sizeof(unsigned int) * tokens->size);
+        tokens->lengths = realloc(tokens->lengths,
+                                  sizeof(unsigned int) * tokens->size);
+        tokens->values = realloc(tokens->values, sizeof(int) * tokens->size);
+    }
+
+    tokens->types[tokens->count] = type;
+    tokens->offsets[tokens->count] = offset;
+    tokens->lengths[tokens->count] = length;
+    tokens->values[tokens->count] = value;
+    return tokens->count++;
+}
 
-            tok = (struct token *)malloc(sizeof(struct token));
-            tok->type = TOK_LBRACE;
+/*
+ * Returns the text at an offset, in the last source that starts at or before
+ * it.
+ */
+static const char *
+source_text(const struct tokens *tokens, unsigned int offset)
+{
+    int low = 0, high = tokens->sources_count - 1, middle;
 
-            list_append(tokens, tok);
+    while (low < high)
+    {
+        middle = (low + high + 1) / 2;
+        if (tokens->sources[middle].base <= offset)
+        {
+            low = middle;
         }
-        else if (content[i] == '}')
+        else
         {
-            i += 1;
+            high = middle - 1;
+        }
+    }
+    return &tokens->sources[low].content[offset - tokens->sources[low].base];
+}
 
-            tok = (struct token *)malloc(sizeof(struct token));
-            tok->type = TOK_RBRACE;
+const char *
+token_text(const struct tokens *tokens, int token)
+{
+    return source_text(tokens, tokens->offsets[token]);
+}
 
-            list_append(tokens, tok);
-        }
-        else if (content[i] == ';')
-        {
-            i += 1;
+const char *
+token_name(const struct tokens *tokens, int token)
+{
+    return interned_string(tokens->values[token]);
+}
 
-            tok = (struct token *)malloc(sizeof(struct token));
-            tok->type = TOK_SEMICOLON;
+char *
+token_copy(const struct tokens *tokens, int token)
+{
+    size_t length = tokens->lengths[token];
+    char *copy = malloc(sizeof(char) * length + 1);
 
-            list_append(tokens, tok);
-        }
-        else if (content[i] == '=')
-        {
-            i += 1;
+    memcpy(copy, token_text(tokens, token), length);
+    copy[length] = '\0';
+    return copy;
+}
 
-            tok = (struct token *)malloc(sizeof(struct token));
-            tok->type = TOK_EQUAL;
+void
+tokens_free(struct tokens *tokens)
+{
+    free(tokens->types);
+    free(tokens->offsets);
+    free(tokens->lengths);
+    free(tokens->values);
+    free(tokens->constants);
+    free(tokens->sources);
+}
 
-            if (i < content_len && content[i] == '=')
-            {
-                i += 1;
-                tok->type = TOK_EQ;
-            }
+/*
+ * Adds a decoded constant to the buffer and returns its index.
+ */
+static int
+tokens_add_constant(struct tokens *tokens, unsigned long long value,
+                    enum constant_type type)
+{
+    if (tokens->constants_count == tokens->constants_size)
+    {
+        tokens->constants_size *= 2;
+        tokens->constants = realloc(tokens->constants,
+                                    sizeof(struct constant) *
+                                    tokens->constants_size);
+    }
 
-            list_append(tokens, tok);
-        }
-        else if (content[i] == '!')
-        {
-            i += 1;
+    tokens->constants[tokens->constants_count].value = value;
+    tokens->constants[tokens->constants_count].type = type;
+    return tokens->constants_count++;
+}
+
+const struct constant *
+token_constant(const struct tokens *tokens, int token)
+{
+    return &tokens->constants[tokens->values[token]];
+}
 
-            tok = (struct token *)malloc(sizeof(struct token));
-            tok->type = TOK_BANG;
+static int
+digit_value(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    return (c | 0x20) - 'a' + 10;
+}
 
-            if (i < content_len && content[i] == '=')
-            {
-                i += 1;
-                tok->type = TOK_NEQ;
-            }
+/*
+ * Decodes the text of an integer token, which the DFA has already checked, and
+ * gives it the first type of its list in C99 6.4.4.1 that can hold it.
+ */
+static int
+decode_integer(struct tokens *tokens, const char *text, size_t length)
+{
+    unsigned long long value = 0;
+    int base = 10, is_unsigned = 0, is_long = 0;
+    enum constant_type type;
+    size_t i = 0;
+
+    if (length > 1 && text[0] == '0' && (text[1] | 0x20) == 'x')
+    {
+        base = 16;
+        i = 2;
+    }
+    else if (text[0] == '0')
+    {
+        base = 8;
+    }
 
-            list_append(tokens, tok);
+    for (; i < length && (text[i] | 0x20) != 'u' && (text[i] | 0x20) != 'l';
+         i++)
+    {
+        value = value * base + digit_value(text[i]);
+    }
+    for (; i < length; i++)
+    {
+        if ((text[i] | 0x20) == 'u')
+        {
+            is_unsigned = 1;
         }
-        else if (content[i] == '+')
+        else
         {
-            i += 1;
+            is_long = 1;
+        }
+    }
 
-            tok = (struct token *)malloc(sizeof(struct token));
-            tok->type = TOK_PLUS;
+    if (is_unsigned)
+    {
+        type = !is_long && value <= UINT_MAX ? CONSTANT_UNSIGNED_INT
+                                             : CONSTANT_UNSIGNED_LONG;
+    }
+    else if (!is_long && value <= INT_MAX)
+    {
+        type = CONSTANT_INT;
+    }
+    else if (!is_long && base != 10 && value <= UINT_MAX)
+    {
+        type = CONSTANT_UNSIGNED_INT;
+    }
+    else if (value <= LONG_MAX)
+    {
+        type = CONSTANT_LONG;
+    }
+    else
+    {
+        type = CONSTANT_UNSIGNED_LONG;
+    }
 
-            if (i < content_len && content[i] == '+')
-            {
-                i += 1;
-                tok->type = TOK_PLUS_PLUS;
-            }
-            else if (i < content_len && content[i] == '=')
-            {
-                i += 1;
-                tok->type = TOK_PLUS_EQUAL;
-            }
+    return tokens_add_constant(tokens, value, type);
+}
 
-            list_append(tokens, tok);
-        }
-        else if (content[i] == '-')
-        {
-            i += 1;
+/*
+ * Characters that name a character in an escape sequence. Escaping any other
+ * character, such as \\ or \', gives the character itself.
+ */
+static const char simple_escapes[256] =
+{
+    ['a'] = '\a',
+    ['b'] = '\b',
+    ['f'] = '\f',
+    ['n'] = '\n',
+    ['r'] = '\r',
+    ['t'] = '\t',
+    ['v'] = '\v',
+};
 
-            tok = (struct token *)malloc(sizeof(struct token));
-            tok->type = TOK_MINUS;
+/*
+ * Decodes the text between the quotes of a character constant. It has type
+ * int and the value of the character as a (signed) char.
+ */
+static int
+decode_character(struct tokens *tokens, const char *text, size_t length)
+{
+    char c = text[0];
+    size_t i;
 
-            if (i < content_len && content[i] == '-')
-            {
-                i += 1;
-                tok->type = TOK_MINUS_MINUS;
-            }
-            else if (i < content_len && content[i] == '=')
-            {
-                i += 1;
-                tok->type = TOK_MINUS_EQUAL;
-            }
-            else if (i < content_len && content[i] == '>')
+    if (c == '\\')
+    {
+        c = text[1];
+        if (c == 'x')
+        {
+            for (c = 0, i = 2; i < length; i++)
             {
-                i += 1;
-                tok->type = TOK_ARROW;
+                c = c * 16 + digit_value(text[i]);
             }
-
-            list_append(tokens, tok);
         }
-        else if (content[i] == '*')
+        else if (c >= '0' && c <= '7')
         {
-            i += 1;
-
-            tok = (struct token *)malloc(sizeof(struct token));
-            tok->type = TOK_ASTERISK;
-
-            if (i < content_len && content[i] == '=')
+            for (c = 0, i = 1; i < length && i < 4; i++)
             {
-                i += 1;
-                tok->type = TOK_ASTERISK_EQUAL;
+                c = c * 8 + digit_value(text[i]);
             }
-
-            list_append(tokens, tok);
         }
-        else if (content[i] == '&')
+        else if (simple_escapes[(unsigned char)c])
         {
-            i += 1;
+            c = simple_escapes[(unsigned char)c];
+        }
+    }
 
-            tok = (struct token *)malloc(sizeof(struct token));
-            tok->type = TOK_AMPERSAND;
+    return tokens_add_constant(tokens, (long long)c, CONSTANT_INT);
+}
 
-            if (content[i] == '&')
-            {
-                i += 1;
-                tok->type = TOK_AMPERSAND_AMPERSAND;
-            }
+/*
+ * The scanner is a DFA over character classes. Every byte maps to a class and
+ * every state maps a class to the next state, where S_STOP ends the token. The
+ * longest prefix that ends in an accepting state is the token (maximal munch),
+ * so for example ".." is scanned as two dots and "..." as an ellipsis.
+ */
+enum character_class
+{
+    CC_OTHER = 0,
+    CC_SPACE,
+    CC_NEWLINE,
 
-            list_append(tokens, tok);
-        }
-        else if (content[i] == '\'')
-        {
-            i += 1;
+    /* identifier characters, kept together */
+    CC_ZERO,
+    CC_OCTAL_DIGIT,
+    CC_DIGIT,
+    CC_LETTER,
+    CC_HEX_LETTER,
+    CC_U,
+    CC_L,
+    CC_X,
 
-            tok = (struct token *)malloc(sizeof(struct token));
-            tok->type = TOK_SINGLEQUOTE;
+    CC_LPAREN,
+    CC_RPAREN,
+    CC_LBRACKET,
+    CC_RBRACKET,
+    CC_LBRACE,
+    CC_RBRACE,
+    CC_SEMICOLON,
+    CC_EQUAL,
+    CC_BANG,
+    CC_PLUS,
+    CC_MINUS,
+    CC_ASTERISK,
+    CC_AMPERSAND,
+    CC_SINGLEQUOTE,
+    CC_DOUBLEQUOTE,
+    CC_SLASH,
+    CC_MOD,
+    CC_GREATERTHAN,
+    CC_LESSTHAN,
+    CC_CARET,
+    CC_TILDE,
+    CC_COMMA,
+    CC_QUESTIONMARK,
+    CC_COLON,
+    CC_VERTICALBAR,
+    CC_DOT,
+    CC_BACKSLASH,
+    CC_HASH,
+    NUM_CHARACTER_CLASSES
+};
 
-            list_append(tokens, tok);
-        }
-        else if (content[i] == '"')
-        {
-            /* consume first " */
-            i += 1;
-            tok_start = i;
+enum scanner_state
+{
+    S_STOP = 0,
+    S_START,
+    S_SPACE,
+    S_OTHER,
+    S_BACKSLASH,
+    S_LINE_SPLICE,
+    S_IDENTIFIER,
+    S_ZERO,
+    S_OCTAL,
+    S_INTEGER,
+    S_HEX_PREFIX,
+    S_HEX,
+    S_INTEGER_U,
+    S_INTEGER_L,
+    S_INTEGER_UL,
+    S_INTEGER_LU,
+    S_INTEGER_LL,
+    S_INTEGER_ULL,
+    S_STRING,
+    S_STRING_END,
+    S_COMMENT,
+    S_COMMENT_STAR,
+    S_COMMENT_END,
+    S_LPAREN,
+    S_RPAREN,
+    S_LBRACKET,
+    S_RBRACKET,
+    S_LBRACE,
+    S_RBRACE,
+    S_SEMICOLON,
+    S_EQUAL,
+    S_EQ,
+    S_BANG,
+    S_NEQ,
+    S_PLUS,
+    S_PLUS_PLUS,
+    S_PLUS_EQUAL,
+    S_MINUS,
+    S_MINUS_MINUS,
+    S_MINUS_EQUAL,
+    S_ARROW,
+    S_ASTERISK,
+    S_ASTERISK_EQUAL,
+    S_AMPERSAND,
+    S_AMPERSAND_AMPERSAND,
+    S_SINGLEQUOTE,
+    S_CHARACTER,
+    S_CHARACTER_ESCAPE,
+    S_CHARACTER_ESCAPED,
+    S_CHARACTER_END,
+    S_SLASH,
+    S_SLASH_EQUAL,
+    S_MOD,
+    S_MOD_EQUAL,
+    S_GREATERTHAN,
+    S_SHIFTRIGHT,
+    S_GREATERTHANEQUAL,
+    S_LESSTHAN,
+    S_SHIFTLEFT,
+    S_LESSTHANEQUAL,
+    S_CARET,
+    S_TILDE,
+    S_COMMA,
+    S_QUESTIONMARK,
+    S_COLON,
+    S_VERTICALBAR,
+    S_VERTICALBAR_VERTICALBAR,
+    S_DOT,
+    S_DOT_DOT,
+    S_ELLIPSIS,
+    S_HASH,
+    S_HASH_HASH,
+    NUM_SCANNER_STATES
+};
 
-            tok = (struct token *)malloc(sizeof(struct token));
+static const unsigned char character_classes[256] =
+{
+    [' '] = CC_SPACE,
+    ['\t'] = CC_SPACE,
+    ['\n'] = CC_NEWLINE,
+    ['\v'] = CC_SPACE,
+    ['\f'] = CC_SPACE,
+    ['\r'] = CC_SPACE,
+    ['a' ... 'f'] = CC_HEX_LETTER,
+    ['g' ... 'k'] = CC_LETTER,
+    ['l'] = CC_L,
+    ['m' ... 't'] = CC_LETTER,
+    ['u'] = CC_U,
+    ['v' ... 'w'] = CC_LETTER,
+    ['x'] = CC_X,
+    ['y' ... 'z'] = CC_LETTER,
+    ['A' ... 'F'] = CC_HEX_LETTER,
+    ['G' ... 'K'] = CC_LETTER,
+    ['L'] = CC_L,
+    ['M' ... 'T'] = CC_LETTER,
+    ['U'] = CC_U,
+    ['V' ... 'W'] = CC_LETTER,
+    ['X'] = CC_X,
+    ['Y' ... 'Z'] = CC_LETTER,
+    ['_'] = CC_LETTER,
+    ['0'] = CC_ZERO,
+    ['1' ... '7'] = CC_OCTAL_DIGIT,
+    ['8' ... '9'] = CC_DIGIT,
+    ['('] = CC_LPAREN,
+    [')'] = CC_RPAREN,
+    ['['] = CC_LBRACKET,
+    [']'] = CC_RBRACKET,
+    ['{'] = CC_LBRACE,
+    ['}'] = CC_RBRACE,
+    [';'] = CC_SEMICOLON,
+    ['='] = CC_EQUAL,
+    ['!'] = CC_BANG,
+    ['+'] = CC_PLUS,
+    ['-'] = CC_MINUS,
+    ['*'] = CC_ASTERISK,
+    ['&'] = CC_AMPERSAND,
+    ['\''] = CC_SINGLEQUOTE,
+    ['"'] = CC_DOUBLEQUOTE,
+    ['/'] = CC_SLASH,
+    ['%'] = CC_MOD,
+    ['>'] = CC_GREATERTHAN,
+    ['<'] = CC_LESSTHAN,
+    ['^'] = CC_CARET,
+    ['~'] = CC_TILDE,
+    [','] = CC_COMMA,
+    ['?'] = CC_QUESTIONMARK,
+    [':'] = CC_COLON,
+    ['|'] = CC_VERTICALBAR,
+    ['.'] = CC_DOT,
+    ['\\'] = CC_BACKSLASH,
+    ['#'] = CC_HASH,
+};
 
-            /* consume characters */
-            while (i < content_len && content[i] != '"')
-            {
-                i += 1;
-            }
-            tok_end = i;
+/*
+ * Transitions out of each state by class. A state that takes most classes to
+ * one state names it in state_fills, and transition_overrides lists the rest.
+ * init_scanner_tables() fills transitions from both, so no initializer writes
+ * over another.
+ */
+static const unsigned char state_fills[NUM_SCANNER_STATES] =
+{
+    [S_SINGLEQUOTE] = S_CHARACTER,
+    [S_CHARACTER_ESCAPE] = S_CHARACTER_ESCAPED,
+    [S_STRING] = S_STRING,
+    [S_COMMENT] = S_COMMENT,
+    [S_COMMENT_STAR] = S_COMMENT,
+};
 
-            /* consume next " */
-            i += 1;
+static const unsigned char
+transition_overrides[NUM_SCANNER_STATES][NUM_CHARACTER_CLASSES] =
+{
+    [S_START] =
+    {
+        [CC_OTHER] = S_OTHER,
+        [CC_SPACE ... CC_NEWLINE] = S_SPACE,
+        [CC_ZERO] = S_ZERO,
+        [CC_OCTAL_DIGIT ... CC_DIGIT] = S_INTEGER,
+        [CC_LETTER ... CC_X] = S_IDENTIFIER,
+        [CC_LPAREN] = S_LPAREN,
+        [CC_RPAREN] = S_RPAREN,
+        [CC_LBRACKET] = S_LBRACKET,
+        [CC_RBRACKET] = S_RBRACKET,
+        [CC_LBRACE] = S_LBRACE,
+        [CC_RBRACE] = S_RBRACE,
+        [CC_SEMICOLON] = S_SEMICOLON,
+        [CC_EQUAL] = S_EQUAL,
+        [CC_BANG] = S_BANG,
+        [CC_PLUS] = S_PLUS,
+        [CC_MINUS] = S_MINUS,
+        [CC_ASTERISK] = S_ASTERISK,
+        [CC_AMPERSAND] = S_AMPERSAND,
+        [CC_SINGLEQUOTE] = S_SINGLEQUOTE,
+        [CC_DOUBLEQUOTE] = S_STRING,
+        [CC_SLASH] = S_SLASH,
+        [CC_MOD] = S_MOD,
+        [CC_GREATERTHAN] = S_GREATERTHAN,
+        [CC_LESSTHAN] = S_LESSTHAN,
+        [CC_CARET] = S_CARET,
+        [CC_TILDE] = S_TILDE,
+        [CC_COMMA] = S_COMMA,
+        [CC_QUESTIONMARK] = S_QUESTIONMARK,
+        [CC_COLON] = S_COLON,
+        [CC_VERTICALBAR] = S_VERTICALBAR,
+        [CC_DOT] = S_DOT,
+        [CC_BACKSLASH] = S_BACKSLASH,
+        [CC_HASH] = S_HASH,
+    },
+    [S_SPACE] = { [CC_SPACE ... CC_NEWLINE] = S_SPACE },
 
-            tok_size = tok_end - tok_start;
-            tok->value = malloc(sizeof(char) * tok_size);
-            strncpy(tok->value, &content[tok_start], tok_size);
+    /*
+     * A backslash at the end of a line joins it to the next. Anywhere else it
+     * is a stray character, like any other that starts no token.
+     */
+    [S_BACKSLASH] = { [CC_NEWLINE] = S_LINE_SPLICE },
+    [S_IDENTIFIER] = { [CC_ZERO ... CC_X] = S_IDENTIFIER },
 
-            tok->type = TOK_STRING;
+    /*
+     * Integers are decimal, octal after a leading 0 or hex after 0x, with
+     * any of the u, l, ul, lu, ll and ull suffixes in either case. A digit
+     * that does not belong to the base ends the constant.
+     */
+    [S_ZERO] =
+    {
+        [CC_ZERO ... CC_OCTAL_DIGIT] = S_OCTAL,
+        [CC_X] = S_HEX_PREFIX,
+        [CC_U] = S_INTEGER_U,
+        [CC_L] = S_INTEGER_L,
+    },
+    [S_OCTAL] =
+    {
+        [CC_ZERO ... CC_OCTAL_DIGIT] = S_OCTAL,
+        [CC_U] = S_INTEGER_U,
+        [CC_L] = S_INTEGER_L,
+    },
+    [S_INTEGER] =
+    {
+        [CC_ZERO ... CC_DIGIT] = S_INTEGER,
+        [CC_U] = S_INTEGER_U,
+        [CC_L] = S_INTEGER_L,
+    },
+    [S_HEX_PREFIX] =
+    {
+        [CC_ZERO ... CC_DIGIT] = S_HEX,
+        [CC_HEX_LETTER] = S_HEX,
+    },
+    [S_HEX] =
+    {
+        [CC_ZERO ... CC_DIGIT] = S_HEX,
+        [CC_HEX_LETTER] = S_HEX,
+        [CC_U] = S_INTEGER_U,
+        [CC_L] = S_INTEGER_L,
+    },
+    [S_INTEGER_U] = { [CC_L] = S_INTEGER_UL },
+    [S_INTEGER_L] =
+    {
+        [CC_U] = S_INTEGER_LU,
+        [CC_L] = S_INTEGER_LL,
+    },
+    [S_INTEGER_UL] = { [CC_L] = S_INTEGER_ULL },
+    [S_INTEGER_LL] = { [CC_U] = S_INTEGER_ULL },
 
-            list_append(tokens, tok);
-        }
-        else if (content[i] == '/')
-        {
-            i += 1;
+    /*
+     * A character constant is one character or one escape sequence between
+     * quotes. Anything else backs up to a lone quote.
+     */
+    [S_SINGLEQUOTE] = { [CC_BACKSLASH] = S_CHARACTER_ESCAPE },
+    [S_CHARACTER] = { [CC_SINGLEQUOTE] = S_CHARACTER_END },
+    [S_CHARACTER_ESCAPED] =
+    {
+        [CC_ZERO ... CC_X] = S_CHARACTER_ESCAPED,
+        [CC_SINGLEQUOTE] = S_CHARACTER_END,
+    },
+    [S_STRING] = { [CC_DOUBLEQUOTE] = S_STRING_END },
+    [S_COMMENT] = { [CC_ASTERISK] = S_COMMENT_STAR },
+    [S_COMMENT_STAR] =
+    {
+        [CC_ASTERISK] = S_COMMENT_STAR,
+        [CC_SLASH] = S_COMMENT_END,
+    },
+    [S_EQUAL] = { [CC_EQUAL] = S_EQ },
+    [S_BANG] = { [CC_EQUAL] = S_NEQ },
+    [S_PLUS] =
+    {
+        [CC_PLUS] = S_PLUS_PLUS,
+        [CC_EQUAL] = S_PLUS_EQUAL,
+    },
+    [S_MINUS] =
+    {
+        [CC_MINUS] = S_MINUS_MINUS,
+        [CC_EQUAL] = S_MINUS_EQUAL,
+        [CC_GREATERTHAN] = S_ARROW,
+    },
+    [S_ASTERISK] = { [CC_EQUAL] = S_ASTERISK_EQUAL },
+    [S_AMPERSAND] = { [CC_AMPERSAND] = S_AMPERSAND_AMPERSAND },
+    [S_SLASH] =
+    {
+        [CC_EQUAL] = S_SLASH_EQUAL,
+        [CC_ASTERISK] = S_COMMENT,
+    },
+    [S_MOD] = { [CC_EQUAL] = S_MOD_EQUAL },
+    [S_GREATERTHAN] =
+    {
+        [CC_GREATERTHAN] = S_SHIFTRIGHT,
+        [CC_EQUAL] = S_GREATERTHANEQUAL,
+    },
+    [S_LESSTHAN] =
+    {
+        [CC_LESSTHAN] = S_SHIFTLEFT,
+        [CC_EQUAL] = S_LESSTHANEQUAL,
+    },
+    [S_VERTICALBAR] = { [CC_VERTICALBAR] = S_VERTICALBAR_VERTICALBAR },
+    [S_DOT] = { [CC_DOT] = S_DOT_DOT },
+    [S_DOT_DOT] = { [CC_DOT] = S_ELLIPSIS },
+    [S_HASH] = { [CC_HASH] = S_HASH_HASH },
+};
 
-            if (i < content_len && content[i] == '=')
-            {
-                i += 1;
+/*
+ * Token made by each accepting state. Whitespace and comments are accepted
+ * but skipped, and other states do not accept. An unterminated comment or
+ * string runs to the end of the buffer.
+ */
+#define NOT_ACCEPTING (TOK_EOF - 1)
+#define SKIP_TOKEN (TOK_EOF - 2)
 
-                tok = (struct token *)malloc(sizeof(struct token));
-                tok->type = TOK_BACKSLASH_EQUAL;
+struct accepting_state
+{
+    unsigned char state;
+    signed char token;
+};
 
-                list_append(tokens, tok);
-            }
-            else if (i < content_len && content[i] == '*')
-            {
-                i += 1;
+static const struct accepting_state accepting_states[] =
+{
+    { S_SPACE, SKIP_TOKEN },
+    { S_OTHER, TOK_OTHER },
+    { S_BACKSLASH, TOK_OTHER },
+    { S_LINE_SPLICE, SKIP_TOKEN },
+    { S_COMMENT, SKIP_TOKEN },
+    { S_COMMENT_STAR, SKIP_TOKEN },
+    { S_COMMENT_END, SKIP_TOKEN },
+    { S_IDENTIFIER, TOK_IDENTIFIER },
+    { S_ZERO, TOK_INTEGER },
+    { S_OCTAL, TOK_INTEGER },
+    { S_INTEGER, TOK_INTEGER },
+    { S_HEX, TOK_INTEGER },
+    { S_INTEGER_U, TOK_INTEGER },
+    { S_INTEGER_L, TOK_INTEGER },
+    { S_INTEGER_UL, TOK_INTEGER },
+    { S_INTEGER_LU, TOK_INTEGER },
+    { S_INTEGER_LL, TOK_INTEGER },
+    { S_INTEGER_ULL, TOK_INTEGER },
+    { S_STRING, TOK_STRING },
+    { S_STRING_END, TOK_STRING },
+    { S_LPAREN, TOK_LPAREN },
+    { S_RPAREN, TOK_RPAREN },
+    { S_LBRACKET, TOK_LBRACKET },
+    { S_RBRACKET, TOK_RBRACKET },
+    { S_LBRACE, TOK_LBRACE },
+    { S_RBRACE, TOK_RBRACE },
+    { S_SEMICOLON, TOK_SEMICOLON },
+    { S_EQUAL, TOK_EQUAL },
+    { S_EQ, TOK_EQ },
+    { S_BANG, TOK_BANG },
+    { S_NEQ, TOK_NEQ },
+    { S_PLUS, TOK_PLUS },
+    { S_PLUS_PLUS, TOK_PLUS_PLUS },
+    { S_PLUS_EQUAL, TOK_PLUS_EQUAL },
+    { S_MINUS, TOK_MINUS },
+    { S_MINUS_MINUS, TOK_MINUS_MINUS },
+    { S_MINUS_EQUAL, TOK_MINUS_EQUAL },
+    { S_ARROW, TOK_ARROW },
+    { S_ASTERISK, TOK_ASTERISK },
+    { S_ASTERISK_EQUAL, TOK_ASTERISK_EQUAL },
+    { S_AMPERSAND, TOK_AMPERSAND },
+    { S_AMPERSAND_AMPERSAND, TOK_AMPERSAND_AMPERSAND },
+    { S_SINGLEQUOTE, TOK_SINGLEQUOTE },
+    { S_CHARACTER_END, TOK_CHARACTER },
+    { S_SLASH, TOK_BACKSLASH },
+    { S_SLASH_EQUAL, TOK_BACKSLASH_EQUAL },
+    { S_MOD, TOK_MOD },
+    { S_MOD_EQUAL, TOK_MOD_EQUAL },
+    { S_GREATERTHAN, TOK_GREATERTHAN },
+    { S_SHIFTRIGHT, TOK_SHIFTRIGHT },
+    { S_GREATERTHANEQUAL, TOK_GREATERTHANEQUAL },
+    { S_LESSTHAN, TOK_LESSTHAN },
+    { S_SHIFTLEFT, TOK_SHIFTLEFT },
+    { S_LESSTHANEQUAL, TOK_LESSTHANEQUAL },
+    { S_CARET, TOK_CARET },
+    { S_TILDE, TOK_TILDE },
+    { S_COMMA, TOK_COMMA },
+    { S_QUESTIONMARK, TOK_QUESTIONMARK },
+    { S_COLON, TOK_COLON },
+    { S_VERTICALBAR, TOK_VERTICALBAR },
+    { S_VERTICALBAR_VERTICALBAR, TOK_VERTICALBAR_VERTICALBAR },
+    { S_DOT, TOK_DOT },
+    { S_ELLIPSIS, TOK_ELLIPSIS },
+    { S_HASH, TOK_HASH },
+    { S_HASH_HASH, TOK_HASH_HASH },
+};
 
-                /* skip over comment contents */
-                while (i + 1 < content_len &&
-                       !(content[i] == '*' && content[i+1] == '/'))
-                {
-                    i += 1;
-                }
-                /* consume the ending '*' and '/' characters */
-                if (i < content_len)
-                {
-                    i += 2;
-                }
-            }
-            else
-            {
-                tok = (struct token *)malloc(sizeof(struct token));
-                tok->type = TOK_BACKSLASH;
+static unsigned char transitions[NUM_SCANNER_STATES][NUM_CHARACTER_CLASSES];
+static signed char state_tokens[NUM_SCANNER_STATES];
 
-                list_append(tokens, tok);
-            }
-        }
-        else if (content[i] == '%')
-        {
-            i += 1;
+/*
+ * Builds transitions and state_tokens, the first time a scanner is made.
+ */
+static void
+init_scanner_tables(void)
+{
+    static int initialized = 0;
+    size_t i;
+    int state, cc;
 
-            tok = (struct token *)malloc(sizeof(struct token));
-            tok->type = TOK_MOD;
+    if (initialized)
+    {
+        return;
+    }
+    initialized = 1;
 
-            if (i < content_len && content[i] == '=')
+    for (state = 0; state < NUM_SCANNER_STATES; state++)
+    {
+        for (cc = 0; cc < NUM_CHARACTER_CLASSES; cc++)
+        {
+            transitions[state][cc] = state_fills[state];
+            if (transition_overrides[state][cc] != S_STOP)
             {
-                i += 1;
-                tok->type = TOK_MOD_EQUAL;
+                transitions[state][cc] = transition_overrides[state][cc];
             }
-
-            list_append(tokens, tok);
         }
-        else if (content[i] == '>')
-        {
-            i += 1;
+        state_tokens[state] = NOT_ACCEPTING;
+    }
 
-            if (i < content_len && content[i] == '>')
-            {
-                i += 1;
+    /*
+     * An empty character constant backs up to a lone quote.
+     */
+    transitions[S_SINGLEQUOTE][CC_SINGLEQUOTE] = S_STOP;
 
-                tok = (struct token *)malloc(sizeof(struct token));
-                tok->type = TOK_SHIFTRIGHT;
+    for (i = 0; i < sizeof(accepting_states) / sizeof(accepting_states[0]);
+         i++)
+    {
+        state_tokens[accepting_states[i].state] = accepting_states[i].token;
+    }
+}
+
+/*
+ * Runs are states that loop on most input, so once the DFA enters one the rest
+ * of the run is skipped in bulk. scan_run returns the position of the byte
+ * that ends the run, and the DFA takes it from there one byte at a time.
+ */
+enum scanner_run
+{
+    RUN_NONE = 0,
+    RUN_SPACE,
+    RUN_IDENTIFIER,
+    RUN_STRING,
+    RUN_COMMENT,
+};
+
+static const unsigned char state_runs[NUM_SCANNER_STATES] =
+{
+    [S_SPACE] = RUN_SPACE,
+    [S_IDENTIFIER] = RUN_IDENTIFIER,
+    [S_STRING] = RUN_STRING,
+    [S_COMMENT] = RUN_COMMENT,
+};
+
+/*
+ * A comment run only stops at a "*" followed by "/" or at the end of the
+ * buffer, since any other "*" leads straight back into the comment.
+ */
+static inline int
+comment_ends_at(const unsigned char *content, size_t i, size_t content_len)
+{
+    return i + 1 >= content_len || content[i + 1] == '/';
+}
+
+static size_t
+scan_run_scalar(const unsigned char *content, size_t i, size_t content_len,
+                int run)
+{
+    const unsigned char *end;
+
+    switch (run)
+    {
+    case RUN_SPACE:
+        while (i < content_len &&
+               (character_classes[content[i]] == CC_SPACE ||
+                character_classes[content[i]] == CC_NEWLINE))
+        {
+            i += 1;
+        }
+        break;
+    case RUN_IDENTIFIER:
+        while (i < content_len &&
+               character_classes[content[i]] >= CC_ZERO &&
+               character_classes[content[i]] <= CC_X)
+        {
+            i += 1;
+        }
+        break;
+    case RUN_STRING:
+        end = memchr(&content[i], '"', content_len - i);
+        i = end == NULL ? content_len : (size_t)(end - content);
+        break;
+    case RUN_COMMENT:
+        while ((end = memchr(&content[i], '*', content_len - i)) != NULL)
+        {
+            i = end - content;
+            if (comment_ends_at(content, i, content_len))
+            {
+                return i;
+            }
+            i += 1;
+        }
+        i = content_len;
+        break;
+    }
+    return i;
+}
+
+#ifdef SCANNER_SIMD
+/*
+ * Byte lanes of v that are in [lo, hi]. There is no unsigned byte compare, so
+ * v - lo is biased by 128 and compared signed against hi - lo.
+ */
+#define SSE2_IN_RANGE(v, lo, hi) \
+    _mm_cmpgt_epi8(_mm_set1_epi8((char)((hi) - (lo) - 127)), \
+                   _mm_sub_epi8((v), _mm_set1_epi8((char)((lo) + 128))))
+#define AVX2_IN_RANGE(v, lo, hi) \
+    _mm256_cmpgt_epi8(_mm256_set1_epi8((char)((hi) - (lo) - 127)), \
+                      _mm256_sub_epi8((v), _mm256_set1_epi8((char)((lo) + 128))))
+
+/*
+ * Returns a bit for each of the 16 bytes of v that is in the class run.
+ */
+static inline unsigned int
+sse2_class_run(__m128i v, int run)
+{
+    if (run == RUN_SPACE)
+    {
+        return _mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                         SSE2_IN_RANGE(v, '\t', '\r')));
+    }
+
+    /* setting 0x20 folds upper case letters onto lower case */
+    return _mm_movemask_epi8(
+        _mm_or_si128(
+            SSE2_IN_RANGE(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z'),
+            _mm_or_si128(SSE2_IN_RANGE(v, '0', '9'),
+                         _mm_cmpeq_epi8(v, _mm_set1_epi8('_')))));
+}
+
+static size_t
+scan_run_sse2(const unsigned char *content, size_t i, size_t content_len,
+              int run)
+{
+    __m128i c;
+    unsigned int stops;
+
+    if (run == RUN_SPACE || run == RUN_IDENTIFIER)
+    {
+        while (i + 16 <= content_len)
+        {
+            stops = ~sse2_class_run(
+                _mm_loadu_si128((const __m128i *)&content[i]), run) & 0xffff;
+            if (stops != 0)
+            {
+                return i + __builtin_ctz(stops);
+            }
+            i += 16;
+        }
+        return scan_run_scalar(content, i, content_len, run);
+    }
+
+    /* strings and comments end at a single byte */
+    c = _mm_set1_epi8(run == RUN_STRING ? '"' : '*');
+    while (i + 16 <= content_len)
+    {
+        stops = _mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&content[i]), c));
+        for (; stops != 0; stops &= stops - 1)
+        {
+            if (run == RUN_STRING ||
+                comment_ends_at(content, i + __builtin_ctz(stops), content_len))
+            {
+                return i + __builtin_ctz(stops);
+            }
+        }
+        i += 16;
+    }
+    return scan_run_scalar(content, i, content_len, run);
+}
+
+/*
+ * The same as sse2_class_run for the 32 bytes of v.
+ */
+__attribute__((target("avx2")))
+static inline unsigned int
+avx2_class_run(__m256i v, int run)
+{
+    if (run == RUN_SPACE)
+    {
+        return _mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                            AVX2_IN_RANGE(v, '\t', '\r')));
+    }
+
+    return _mm256_movemask_epi8(
+        _mm256_or_si256(
+            AVX2_IN_RANGE(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z'),
+            _mm256_or_si256(AVX2_IN_RANGE(v, '0', '9'),
+                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')))));
+}
+
+/*
+ * Strings and comments are searched 64 bytes at a time, which is where long
+ * comments spend their time.
+ */
+__attribute__((target("avx2")))
+static size_t
+scan_run_avx2(const unsigned char *content, size_t i, size_t content_len,
+              int run)
+{
+    __m256i c, lo, hi;
+    unsigned int stops;
+
+    if (run == RUN_SPACE || run == RUN_IDENTIFIER)
+    {
+        while (i + 32 <= content_len)
+        {
+            stops = ~avx2_class_run(
+                _mm256_loadu_si256((const __m256i *)&content[i]), run);
+            if (stops != 0)
+            {
+                return i + __builtin_ctz(stops);
+            }
+            i += 32;
+        }
+        return scan_run_sse2(content, i, content_len, run);
+    }
+
+    c = _mm256_set1_epi8(run == RUN_STRING ? '"' : '*');
+    while (i + 64 <= content_len)
+    {
+        lo = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *)&content[i]), c);
+        hi = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *)&content[i + 32]), c);
+        if (_mm256_testz_si256(_mm256_or_si256(lo, hi),
+                               _mm256_or_si256(lo, hi)))
+        {
+            i += 64;
+            continue;
+        }
+        for (stops = _mm256_movemask_epi8(lo);
+             stops != 0;
+             stops &= stops - 1)
+        {
+            if (run == RUN_STRING ||
+                comment_ends_at(content, i + __builtin_ctz(stops), content_len))
+            {
+                return i + __builtin_ctz(stops);
+            }
+        }
+        for (stops = _mm256_movemask_epi8(hi);
+             stops != 0;
+             stops &= stops - 1)
+        {
+            if (run == RUN_STRING ||
+                comment_ends_at(content, i + 32 + __builtin_ctz(stops),
+                                content_len))
+            {
+                return i + 32 + __builtin_ctz(stops);
+            }
+        }
+        i += 64;
+    }
+    return scan_run_sse2(content, i, content_len, run);
+}
+#endif
+
+enum scanner_simd
+scanner_use_simd(enum scanner_simd level)
+{
+#ifdef SCANNER_SIMD
+    if (level >= SCANNER_AVX2 && __builtin_cpu_supports("avx2"))
+    {
+        scan_run = scan_run_avx2;
+        return SCANNER_AVX2;
+    }
+    if (level >= SCANNER_SSE2)
+    {
+        scan_run = scan_run_sse2;
+        return SCANNER_SSE2;
+    }
+#endif
+    scan_run = scan_run_scalar;
+    return SCANNER_SCALAR;
+}
+
+/*
+ * Scans the next token of the file being read into token, without any
+ * preprocessing.
+ */
+static void
+lex(struct scanner *scanner, struct pp_token *token)
+{
+    const unsigned char *content = (const unsigned char *)scanner->content;
+    size_t content_len = scanner->content_len;
+    size_t i = scanner->position, tok_start, tok_end;
+    int state, accept_state, type, value;
+
+    token->hideset = NULL;
+
+    for (;;)
+    {
+        if (i >= content_len)
+        {
+            scanner->position = i;
+            token->type = TOK_EOF;
+            token->offset = scanner->base + i;
+            token->length = 0;
+            token->value = -1;
+            return;
+        }
+
+        /*
+         * Run the DFA until it stops, remembering the last accepting state.
+         * Every class leaves S_START for an accepting state, so at least one
+         * character is always consumed.
+         */
+        tok_start = i;
+        tok_end = i;
+        accept_state = S_STOP;
+        state = S_START;
+        while (i < content_len &&
+               (state = transitions[state][character_classes[content[i]]]) !=
+               S_STOP)
+        {
+            i += 1;
+            if (state_runs[state] != RUN_NONE)
+            {
+                i = scan_run(content, i, content_len, state_runs[state]);
+            }
+            if (state_tokens[state] != NOT_ACCEPTING)
+            {
+                accept_state = state;
+                tok_end = i;
+            }
+        }
+        i = tok_end;
+
+        type = state_tokens[accept_state];
+        if (type != SKIP_TOKEN)
+        {
+            break;
+        }
+    }
+
+    /*
+     * A # runs a directive only if it is the first token of its line, with
+     * nothing but spaces and comments since the start of the file or the end
+     * of a line.
+     */
+    if (type == TOK_HASH)
+    {
+        scanner->hash_starts_line = scanner->position == 0 ||
+            line_ends_between((const char *)content, scanner->position,
+                              tok_start);
+    }
+
+    scanner->position = i;
+    value = -1;
+
+    if (type == TOK_IDENTIFIER)
+    {
+        /*
+         * Check if this token is a reserved word. If not then consider it
+         * a label, and intern its name so later phases compare ids.
+         */
+        type = reserved_word_token((char *)&content[tok_start],
+                                   tok_end - tok_start);
+        if (type == TOK_EOF)
+        {
+            type = TOK_IDENTIFIER;
+            value = intern((char *)&content[tok_start], tok_end - tok_start);
+        }
+    }
+    else if (type == TOK_INTEGER)
+    {
+        value = decode_integer(&scanner->tokens, (char *)&content[tok_start],
+                               tok_end - tok_start);
+    }
+    else if (type == TOK_CHARACTER)
+    {
+        /*
+         * Leave out the quotes.
+         */
+        tok_start += 1;
+        tok_end -= 1;
+        value = decode_character(&scanner->tokens,
+                                 (char *)&content[tok_start],
+                                 tok_end - tok_start);
+    }
+    else if (type == TOK_STRING)
+    {
+        /*
+         * Leave out the quotes. The closing quote is missing if the string
+         * runs to the end of the buffer.
+         */
+        tok_start += 1;
+        if (accept_state == S_STRING_END)
+        {
+            tok_end -= 1;
+        }
+    }
+
+    token->type = type;
+    token->offset = scanner->base + tok_start;
+    token->length = tok_end - tok_start;
+    token->value = value;
+}
+
+/*
+ * The preprocessor works on tokens as they are scanned rather than on text. A
+ * # that starts a line runs a directive, and macros are expanded with hide sets
+ * (Prosser's algorithm): each token carries the names of the macros whose
+ * expansion produced it, and a macro is not expanded again inside its own
+ * expansion, which is what ends recursive macros.
+ */
+#define INITIAL_PP_TOKENS_SIZE 16
+#define MAX_INCLUDE_DEPTH 200
+
+struct hideset
+{
+    int name;
+    struct hideset *next;
+};
+
+/*
+ * The tokens of a precompiled header were expanded when it was saved, so
+ * their hide set hides every macro.
+ */
+#define HIDE_EVERY_MACRO -1
+
+static struct hideset every_macro = { HIDE_EVERY_MACRO, NULL };
+
+/*
+ * A macro's parameters are interned names, and __VA_ARGS__ is the last one of
+ * a variadic macro. body is the replacement list as it was scanned.
+ */
+struct macro
+{
+    int name;
+    int function_like;
+    int variadic;
+    int params_count;
+    int *params;
+    struct pp_token *body;
+    int body_count;
+    unsigned int digest;
+};
+
+/*
+ * Where reading stopped in a file that included another.
+ */
+struct include
+{
+    char *content;
+    size_t content_len;
+    size_t position;
+    unsigned int base;
+    const char *filename;
+    struct included_file *file;
+    struct listnode *conditionals;
+    int guard_name;
+    size_t guard_end;
+};
+
+/*
+ * Every file that has been included, found by its device and inode so that a
+ * file reached by different paths is one entry, with the first path it was
+ * found by. Its content is read once, and guard is the interned name of the
+ * macro that guards the whole file, or -1.
+ */
+#define INITIAL_INCLUDED_FILES_SIZE 64
+#define FILE_HASH(device, inode) \
+    ((unsigned int)(inode) * 2654435761u ^ (unsigned int)(device))
+
+struct included_file
+{
+    dev_t device;
+    ino_t inode;
+    char *path;
+    char *content;
+    size_t content_len;
+    int guard;
+    int once;
+};
+
+static struct included_file **included_files;
+static int included_files_count;
+static int included_files_size;
+
+static struct preprocessor_stats stats;
+
+/*
+ * An #if, #ifdef or #ifndef whose groups are being read. guard is set while it
+ * may be the include guard of its file.
+ */
+struct conditional
+{
+    int else_seen;
+    int guard;
+};
+
+/*
+ * Text put together for stringizing and pasting tokens.
+ */
+struct text
+{
+    char *data;
+    size_t length;
+    size_t size;
+};
+
+static void
+report_error(struct scanner *scanner, const char *format, va_list args)
+{
+    const char *line = scanner->content;
+    const char *end = scanner->content + scanner->position;
+    int lines = 1;
+
+    while ((line = memchr(line, '\n', end - line)) != NULL)
+    {
+        lines += 1;
+        line += 1;
+    }
+
+    fprintf(stderr, "%s:%d: error: ",
+            scanner->filename != NULL ? scanner->filename : "<input>", lines);
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+static void
+preprocessor_error(struct scanner *scanner, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    report_error(scanner, format, args);
+    va_end(args);
+}
+
+void
+scanner_error(struct scanner *scanner, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    report_error(scanner, format, args);
+    va_end(args);
+}
+
+static void
+pp_tokens_append(struct pp_tokens *list, const struct pp_token *token)
+{
+    if (list->count == list->size)
+    {
+        list->size = list->size ? list->size * 2 : INITIAL_PP_TOKENS_SIZE;
+        list->items = realloc(list->items,
+                              sizeof(struct pp_token) * list->size);
+    }
+    list->items[list->count++] = *token;
+}
+
+/*
+ * Puts tokens back in front of the input, to be read again in order.
+ */
+static void
+unread_tokens(struct scanner *scanner, const struct pp_token *tokens,
+              int count)
+{
+    while (count > 0)
+    {
+        pp_tokens_append(&scanner->pending, &tokens[--count]);
+    }
+}
+
+static int
+hideset_contains(const struct hideset *hideset, int name)
+{
+    for (; hideset != NULL; hideset = hideset->next)
+    {
+        if (hideset->name == name || hideset->name == HIDE_EVERY_MACRO)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Hide sets are never changed once made, so they can share their tails.
+ */
+static struct hideset *
+hideset_add(struct scanner *scanner, struct hideset *hideset, int name)
+{
+    struct hideset *added = arena_alloc(&scanner->arena,
+                                        sizeof(struct hideset));
+
+    added->name = name;
+    added->next = hideset;
+    return added;
+}
+
+static struct hideset *
+hideset_union(struct scanner *scanner, struct hideset *a, struct hideset *b)
+{
+    for (; a != NULL; a = a->next)
+    {
+        if (!hideset_contains(b, a->name))
+        {
+            b = hideset_add(scanner, b, a->name);
+        }
+    }
+    return b;
+}
+
+static struct hideset *
+hideset_intersection(struct scanner *scanner, struct hideset *a,
+                     struct hideset *b)
+{
+    struct hideset *intersection = NULL;
+
+    for (; a != NULL; a = a->next)
+    {
+        if (hideset_contains(b, a->name))
+        {
+            intersection = hideset_add(scanner, intersection, a->name);
+        }
+    }
+    return intersection;
+}
+
+static void
+text_append(struct text *text, const char *data, size_t length)
+{
+    if (text->length + length > text->size)
+    {
+        text->size = (text->length + length) * 2;
+        text->data = realloc(text->data, text->size);
+    }
+    memcpy(&text->data[text->length], data, length);
+    text->length += length;
+}
+
+/*
+ * Keeps text as a new source for tokens to refer to, and returns its copy.
+ */
+static char *
+save_text(struct scanner *scanner, const struct text *text, unsigned int *base)
+{
+    char *content = arena_alloc(&scanner->arena, text->length + 1);
+
+    memcpy(content, text->data, text->length);
+    *base = tokens_add_source(&scanner->tokens, content, text->length);
+    return content;
+}
+
+/*
+ * The spelling of a token is its text with the quotes of a string or character
+ * constant. These return the offsets of its first byte and of the byte after.
+ */
+static int
+is_quoted(const struct pp_token *token)
+{
+    return token->type == TOK_STRING || token->type == TOK_CHARACTER;
+}
+
+static unsigned int
+spelling_start(const struct pp_token *token)
+{
+    return token->offset - is_quoted(token);
+}
+
+static unsigned int
+spelling_end(const struct pp_token *token)
+{
+    return token->offset + token->length + is_quoted(token);
+}
+
+/*
+ * Appends the spelling of a token, escaping the quotes and backslashes of
+ * strings and character constants if escape is set.
+ */
+static void
+append_spelling(struct scanner *scanner, struct text *text,
+                const struct pp_token *token, int escape)
+{
+    const char *spelling = source_text(&scanner->tokens,
+                                       spelling_start(token));
+    size_t length = spelling_end(token) - spelling_start(token), i;
+
+    if (!escape || !is_quoted(token))
+    {
+        text_append(text, spelling, length);
+        return;
+    }
+
+    for (i = 0; i < length; i++)
+    {
+        if (spelling[i] == '"' || spelling[i] == '\\')
+        {
+            text_append(text, "\\", 1);
+        }
+        text_append(text, &spelling[i], 1);
+    }
+}
+
+/*
+ * Makes the string of the # operator from the tokens of an argument. Tokens are
+ * separated by a space where there was whitespace between them.
+ */
+static void
+stringize(struct scanner *scanner, const struct pp_tokens *arg,
+          struct pp_token *token)
+{
+    struct text text = { NULL, 0, 0 };
+    unsigned int base;
+    int i;
+
+    text_append(&text, "\"", 1);
+    for (i = 0; i < arg->count; i++)
+    {
+        if (i > 0 &&
+            spelling_start(&arg->items[i]) != spelling_end(&arg->items[i - 1]))
+        {
+            text_append(&text, " ", 1);
+        }
+        append_spelling(scanner, &text, &arg->items[i], 1);
+    }
+    text_append(&text, "\"", 1);
+    save_text(scanner, &text, &base);
+
+    token->type = TOK_STRING;
+    token->offset = base + 1;
+    token->length = text.length - 2;
+    token->value = -1;
+    token->hideset = NULL;
+    free(text.data);
+}
+
+/*
+ * Replaces left with the token the ## operator makes from left and right, by
+ * scanning their spellings put together.
+ */
+static void
+paste(struct scanner *scanner, struct pp_token *left,
+      const struct pp_token *right)
+{
+    struct text text = { NULL, 0, 0 };
+    char *content = scanner->content;
+    size_t content_len = scanner->content_len;
+    size_t position = scanner->position;
+    unsigned int base = scanner->base;
+    int pasted;
+
+    append_spelling(scanner, &text, left, 0);
+    append_spelling(scanner, &text, right, 0);
+
+    scanner->content = save_text(scanner, &text, &scanner->base);
+    scanner->content_len = text.length;
+    scanner->position = 0;
+    lex(scanner, left);
+    pasted = left->type != TOK_EOF && scanner->position == text.length;
+
+    scanner->content = content;
+    scanner->content_len = content_len;
+    scanner->position = position;
+    scanner->base = base;
+    if (!pasted)
+    {
+        preprocessor_error(scanner,
+                           "pasting \"%.*s\" does not give a valid token",
+                           (int)text.length, text.data);
+    }
+    free(text.data);
+}
+
+/*
+ * Returns the macro a token names, if any.
+ */
+static struct macro *
+find_macro(struct scanner *scanner, const struct pp_token *token)
+{
+    if (token->type == TOK_IDENTIFIER)
+    {
+        return token->value < scanner->macros_size ?
+               scanner->macros[token->value] : NULL;
+    }
+    if (token->type >= TOK_VOID)
+    {
+        return scanner->keyword_macros[token->type - TOK_VOID];
+    }
+    return NULL;
+}
+
+/*
+ * Returns the slot of the macro a token would name, growing the table as
+ * needed, or NULL if a macro cannot be named by it.
+ */
+static struct macro **
+macro_slot(struct scanner *scanner, const struct pp_token *token)
+{
+    int size = scanner->macros_size;
+
+    if (token->type >= TOK_VOID)
+    {
+        return &scanner->keyword_macros[token->type - TOK_VOID];
+    }
+    if (token->type != TOK_IDENTIFIER)
+    {
+        return NULL;
+    }
+
+    if (token->value >= size)
+    {
+        while (token->value >= scanner->macros_size)
+        {
+            scanner->macros_size = scanner->macros_size ?
+                                   scanner->macros_size * 2 :
+                                   INITIAL_INTERN_SIZE;
+        }
+        scanner->macros = realloc(scanner->macros, sizeof(struct macro *) *
+                                                   scanner->macros_size);
+        memset(&scanner->macros[size], 0, sizeof(struct macro *) *
+                                          (scanner->macros_size - size));
+    }
+    return &scanner->macros[token->value];
+}
+
+static int
+find_param(const struct macro *macro, const struct pp_token *token)
+{
+    int i;
+
+    if (token->type != TOK_IDENTIFIER)
+    {
+        return -1;
+    }
+    for (i = 0; i < macro->params_count; i++)
+    {
+        if (macro->params[i] == token->value)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int
+directive_is(struct scanner *scanner, const struct pp_token *token,
+             const char *name)
+{
+    size_t length = strlen(name);
+
+    return token->length == length &&
+           memcmp(source_text(&scanner->tokens, token->offset), name,
+                  length) == 0;
+}
+
+/*
+ * Returns whether a line ends between two positions in content, at a newline
+ * that is not escaped by a backslash. Only spaces and comments lie between
+ * tokens, and a comment is one space however many lines it spans, so a newline
+ * in a comment does not end the line.
+ */
+static int
+line_ends_between(const char *content, size_t from, size_t to)
+{
+    const char *position = &content[from], *end = &content[to];
+
+    for (; position < end; position++)
+    {
+        if (*position == '\n' &&
+            (position == content || position[-1] != '\\'))
+        {
+            return 1;
+        }
+        if (*position == '/' && position + 1 < end && position[1] == '*')
+        {
+            position = content + scan_run((const unsigned char *)content,
+                                          position - content + 2, to,
+                                          RUN_COMMENT) + 1;
+        }
+    }
+    return 0;
+}
+
+
+/*
+ * Scans the tokens of the rest of a directive's line into line. The scanner is
+ * left before the first token of the next line.
+ */
+static void
+read_directive(struct scanner *scanner, struct pp_tokens *line)
+{
+    struct pp_token token;
+    size_t start, end = scanner->position;
+
+    for (;;)
+    {
+        start = scanner->position;
+        lex(scanner, &token);
+        if (token.type == TOK_EOF ||
+            line_ends_between(scanner->content, end,
+                              spelling_start(&token) - scanner->base))
+        {
+            scanner->position = start;
+            return;
+        }
+        pp_tokens_append(line, &token);
+        end = scanner->position;
+    }
+}
+
+/*
+ * Returns a hash of a macro's definition, which does not depend on where it
+ * was read from.
+ */
+static unsigned int
+macro_digest(struct scanner *scanner, const struct macro *macro)
+{
+    const char *name = interned_string(macro->name);
+    const struct pp_token *token;
+    unsigned int hash;
+    int i, flags[2];
+
+    hash = hash_bytes(HASH_INITIAL, name, strlen(name) + 1);
+    flags[0] = macro->function_like;
+    flags[1] = macro->variadic;
+    hash = hash_bytes(hash, flags, sizeof(flags));
+    for (i = 0; i < macro->params_count; i++)
+    {
+        name = interned_string(macro->params[i]);
+        hash = hash_bytes(hash, name, strlen(name) + 1);
+    }
+
+    /*
+     * Spacing matters to # in another macro, so each token adds whether it
+     * follows the one before directly.
+     */
+    for (i = 0; i < macro->body_count; i++)
+    {
+        token = &macro->body[i];
+        flags[0] = token->type;
+        flags[1] = i > 0 && spelling_start(token) == spelling_end(token - 1);
+        hash = hash_bytes(hash, flags, sizeof(flags));
+        hash = hash_bytes(hash, source_text(&scanner->tokens,
+                                            spelling_start(token)),
+                          spelling_end(token) - spelling_start(token));
+    }
+    return hash;
+}
+
+static void
+define_macro(struct scanner *scanner, const struct pp_tokens *line)
+{
+    const struct pp_token *tokens = line->items, *name = &tokens[1];
+    struct macro *macro, **slot;
+    int i = 2, j;
+
+    if (line->count < 2 || (slot = macro_slot(scanner, name)) == NULL)
+    {
+        preprocessor_error(scanner, "macro names must be identifiers");
+    }
+
+    macro = arena_alloc(&scanner->arena, sizeof(struct macro));
+    macro->name = name->type == TOK_IDENTIFIER ?
+                  name->value :
+                  intern(source_text(&scanner->tokens, name->offset),
+                         name->length);
+
+    /*
+     * A macro is function-like if a parenthesis follows its name with no space
+     * in between.
+     */
+    if (line->count > 2 && tokens[2].type == TOK_LPAREN &&
+        tokens[2].offset == name->offset + name->length)
+    {
+        macro->function_like = 1;
+        macro->params = arena_alloc(&scanner->arena,
+                                    sizeof(int) * line->count);
+        for (i = 3; ; i++)
+        {
+            if (i < line->count && tokens[i].type == TOK_RPAREN &&
+                macro->params_count == 0)
+            {
+                break;
+            }
+            if (i + 1 < line->count && tokens[i].type == TOK_ELLIPSIS &&
+                tokens[i + 1].type == TOK_RPAREN)
+            {
+                macro->variadic = 1;
+                macro->params[macro->params_count++] =
+                    intern("__VA_ARGS__", strlen("__VA_ARGS__"));
+                i += 1;
+                break;
+            }
+            if (i + 1 >= line->count || tokens[i].type != TOK_IDENTIFIER ||
+                (tokens[i + 1].type != TOK_COMMA &&
+                 tokens[i + 1].type != TOK_RPAREN))
+            {
+                preprocessor_error(scanner,
+                                   "invalid parameters of macro \"%s\"",
+                                   interned_string(macro->name));
+            }
+            macro->params[macro->params_count++] = tokens[i].value;
+            i += 1;
+            if (tokens[i].type == TOK_RPAREN)
+            {
+                break;
+            }
+        }
+        i += 1;
+    }
+
+    macro->body_count = line->count - i;
+    macro->body = arena_alloc(&scanner->arena,
+                              sizeof(struct pp_token) * macro->body_count);
+    memcpy(macro->body, &tokens[i], sizeof(struct pp_token) * macro->body_count);
+
+    for (j = 0; j < macro->body_count; j++)
+    {
+        if (macro->body[j].type == TOK_HASH_HASH &&
+            (j == 0 || j == macro->body_count - 1))
+        {
+            preprocessor_error(scanner, "'##' cannot appear at either end of "
+                               "a macro expansion");
+        }
+        if (macro->function_like && macro->body[j].type == TOK_HASH &&
+            (j == macro->body_count - 1 ||
+             find_param(macro, &macro->body[j + 1]) < 0))
+        {
+            preprocessor_error(scanner, "'#' is not followed by a macro "
+                               "parameter");
+        }
+    }
+
+    macro->digest = macro_digest(scanner, macro);
+    if (*slot != NULL)
+    {
+        scanner->macros_digest ^= (*slot)->digest;
+    }
+    scanner->macros_digest ^= macro->digest;
+    *slot = macro;
+}
+
+static void
+undefine_macro(struct scanner *scanner, const struct pp_tokens *line)
+{
+    struct macro **slot;
+
+    if (line->count < 2 || (slot = macro_slot(scanner, &line->items[1])) == NULL)
+    {
+        preprocessor_error(scanner, "macro names must be identifiers");
+    }
+    if (*slot != NULL)
+    {
+        scanner->macros_digest ^= (*slot)->digest;
+    }
+    *slot = NULL;
+}
+
+/*
+ * Returns the path of directory joined with length bytes of name.
+ */
+static char *
+join_path(const char *directory, size_t directory_len, const char *name,
+          size_t length)
+{
+    char *path = malloc(directory_len + length + 2);
+    size_t i = directory_len;
+
+    memcpy(path, directory, directory_len);
+    if (i > 0)
+    {
+        path[i++] = '/';
+    }
+    memcpy(&path[i], name, length);
+    path[i + length] = '\0';
+    return path;
+}
+
+/*
+ * Returns the entry of the file with the identity in st, adding it the first
+ * time it is seen at path.
+ */
+static struct included_file *
+included_file(const struct stat *st, const char *path)
+{
+    struct included_file **files, *file;
+    unsigned int slot, mask = included_files_size - 1;
+    int i;
+
+    if (included_files_count * 2 >= included_files_size)
+    {
+        /*
+         * Keep the table at most half full, putting every file back in its
+         * slot in the larger table.
+         */
+        files = included_files;
+        included_files_size = included_files_size ?
+                              included_files_size * 2 :
+                              INITIAL_INCLUDED_FILES_SIZE;
+        included_files = calloc(included_files_size,
+                                sizeof(struct included_file *));
+        mask = included_files_size - 1;
+        for (i = 0; i < included_files_size / 2; i++)
+        {
+            if (files != NULL && files[i] != NULL)
+            {
+                slot = FILE_HASH(files[i]->device, files[i]->inode) & mask;
+                while (included_files[slot] != NULL)
+                {
+                    slot = (slot + 1) & mask;
+                }
+                included_files[slot] = files[i];
+            }
+        }
+        free(files);
+    }
+
+    slot = FILE_HASH(st->st_dev, st->st_ino) & mask;
+    for (; (file = included_files[slot]) != NULL; slot = (slot + 1) & mask)
+    {
+        if (file->device == st->st_dev && file->inode == st->st_ino)
+        {
+            return file;
+        }
+    }
+
+    file = calloc(1, sizeof(struct included_file));
+    file->device = st->st_dev;
+    file->inode = st->st_ino;
+    file->path = malloc(strlen(path) + 1);
+    strcpy(file->path, path);
+    file->guard = -1;
+    included_files[slot] = file;
+    included_files_count += 1;
+    return file;
+}
+
+/*
+ * Reads the content of a file the first time it is needed, and returns
+ * whether it could be.
+ */
+static int
+read_included_file(struct included_file *file)
+{
+    if (file->content == NULL)
+    {
+        if ((file->content = read_source(file->path,
+                                         &file->content_len)) == NULL)
+        {
+            return 0;
+        }
+        stats.files_read += 1;
+    }
+    return 1;
+}
+
+const struct preprocessor_stats *
+preprocessor_stats(void)
+{
+    return &stats;
+}
+
+/*
+ * Finds the file an #include names and sets *path to where it was found, or
+ * returns NULL. "..." files are searched for next to the including file first,
+ * then like <...> files in the include paths. Files are only looked at with
+ * stat(), so one that is skipped is never opened.
+ */
+static struct included_file *
+find_include(struct scanner *scanner, const char *name, size_t length,
+             int quoted, char **path)
+{
+    const char *slash;
+    struct listnode *node;
+    struct stat st;
+
+    if (name[0] == '/' || quoted)
+    {
+        slash = name[0] != '/' && scanner->filename != NULL ?
+                strrchr(scanner->filename, '/') : NULL;
+        *path = join_path(scanner->filename,
+                          slash != NULL ? slash - scanner->filename : 0,
+                          name, length);
+        if (stat(*path, &st) == 0 && S_ISREG(st.st_mode))
+        {
+            return included_file(&st, *path);
+        }
+        free(*path);
+        if (name[0] == '/')
+        {
+            return NULL;
+        }
+    }
+
+    foreach(node, scanner->include_paths)
+    {
+        *path = join_path(node->data, strlen(node->data), name, length);
+        if (stat(*path, &st) == 0 && S_ISREG(st.st_mode))
+        {
+            return included_file(&st, *path);
+        }
+        free(*path);
+    }
+    return NULL;
+}
+
+/*
+ * Adds a file to the dependencies of the file being compiled, unless it is
+ * there already. The path of a file's entry is kept, so it is found by
+ * pointer.
+ */
+static void
+add_dependency(struct scanner *scanner, const struct included_file *file)
+{
+    struct listnode *node;
+
+    foreach(node, scanner->dependencies)
+    {
+        if (node->data == file->path)
+        {
+            return;
+        }
+    }
+    list_append(&scanner->dependencies, file->path);
+}
+
+/*
+ * Returns the offset of the first token at or after a position in the file
+ * being read.
+ */
+static unsigned int
+first_token_offset(struct scanner *scanner, size_t position)
+{
+    size_t saved = scanner->position;
+    struct pp_token token;
+
+    scanner->position = position;
+    lex(scanner, &token);
+    scanner->position = saved;
+    return spelling_start(&token);
+}
+
+/*
+ * A precompiled header holds the tokens that a header included by the file
+ * being compiled expands to, and every macro defined after it. It is named by
+ * a hash of the fields of its pch_header before macros_digest_after: the
+ * header's content, the paths used to find it and the files it includes, and
+ * the macros defined before it. It is used only if none of the files it read
+ * has changed since. Its sections follow the pch_header in the order of their
+ * counts, ending with the text of every token, which becomes a source of its
+ * own. Interned ids and the indexes of constants differ between processes,
+ * so names and constants are saved in sections of their own and added again
+ * when it is loaded.
+ */
+#define PCH_MAGIC "clinkpch"
+#define PCH_VERSION 3
+
+struct pch_header
+{
+    char magic[8];
+    unsigned int version;
+    unsigned int content_hash;
+    unsigned int content_length;
+    unsigned int paths_hash;
+    unsigned int macros_digest;
+    unsigned int macros_digest_after;
+    int guard;
+    int once;
+    unsigned int files_count;
+    unsigned int names_count;
+    unsigned int tokens_count;
+    unsigned int macros_count;
+    unsigned int body_count;
+    unsigned int params_count;
+    unsigned int constants_count;
+    unsigned int text_length;
+};
+
+struct pch_file
+{
+    unsigned int path;
+    unsigned int path_length;
+    unsigned int content_hash;
+    unsigned int content_length;
+    int guard;
+    int once;
+};
+
+struct pch_name
+{
+    unsigned int offset;
+    unsigned int length;
+};
+
+/*
+ * offset is into the text. The value of an identifier is its name, and that of
+ * an integer or character constant is its constant.
+ */
+struct pch_token
+{
+    int type;
+    unsigned int offset;
+    unsigned int length;
+    int value;
+};
+
+/*
+ * A constant, whose value is split so that every section is aligned to four
+ * bytes.
+ */
+struct pch_constant
+{
+    unsigned int low;
+    unsigned int high;
+    int type;
+};
+
+/*
+ * A macro named by an identifier, or by a reserved word of type. params and
+ * body are where its parameters and tokens start in their sections.
+ */
+struct pch_macro
+{
+    int type;
+    int name;
+    int function_like;
+    int variadic;
+    int params_count;
+    unsigned int params;
+    unsigned int body;
+    int body_count;
+    unsigned int digest;
+};
+
+/*
+ * The header being precompiled into path, whose tokens start at start, and the
+ * files it has included. skipped_once is set if it skipped a file with #pragma
+ * once that was read before it, which the key does not show, so it is not
+ * saved.
+ */
+struct recording
+{
+    struct pch_header header;
+    char *path;
+    struct included_file *file;
+    int start;
+    struct listnode *files;
+    int skipped_once;
+};
+
+/*
+ * The sections of a precompiled header as it is written, and the index of each
+ * interned id in names, or -1.
+ */
+struct pch_writer
+{
+    struct scanner *scanner;
+    struct text files;
+    struct text names;
+    struct text tokens;
+    struct text macros;
+    struct text body;
+    struct text params;
+    struct text constants;
+    struct text text;
+    int *name_indexes;
+    int name_indexes_size;
+    int names_count;
+};
+
+/*
+ * Sets the fields of key that a precompiled header of file, found at path, has
+ * to match, and returns the path of the precompiled header.
+ */
+static char *
+pch_path(struct scanner *scanner, const struct included_file *file,
+         const char *path, struct pch_header *key)
+{
+    struct listnode *node;
+    unsigned int hash;
+    char *pch;
+
+    memset(key, 0, sizeof(struct pch_header));
+    memcpy(key->magic, PCH_MAGIC, sizeof(key->magic));
+    key->version = PCH_VERSION;
+    key->content_hash = hash_bytes(HASH_INITIAL, file->content,
+                                   file->content_len);
+    key->content_length = file->content_len;
+    hash = hash_bytes(HASH_INITIAL, path, strlen(path) + 1);
+    foreach(node, scanner->include_paths)
+    {
+        hash = hash_bytes(hash, node->data, strlen(node->data) + 1);
+    }
+    key->paths_hash = hash;
+    key->macros_digest = scanner->macros_digest;
+
+    hash = hash_bytes(HASH_INITIAL, key,
+                      offsetof(struct pch_header, macros_digest_after));
+    pch = malloc(strlen(scanner->pch_directory) + sizeof("/01234567.pch"));
+    sprintf(pch, "%s/%08x.pch", scanner->pch_directory, hash);
+    return pch;
+}
+
+static unsigned int
+pch_text(struct pch_writer *writer, const char *data, size_t length)
+{
+    unsigned int offset = writer->text.length;
+
+    text_append(&writer->text, data, length);
+    return offset;
+}
+
+/*
+ * Returns the index of an interned name in the names section, adding it the
+ * first time.
+ */
+static int
+pch_name(struct pch_writer *writer, int id)
+{
+    const char *text = interned_string(id);
+    struct pch_name name;
+    int size = writer->name_indexes_size;
+
+    if (id >= size)
+    {
+        writer->name_indexes_size = id + 1 > size * 2 ? id + 1 : size * 2;
+        writer->name_indexes = realloc(writer->name_indexes, sizeof(int) *
+                                       writer->name_indexes_size);
+        memset(&writer->name_indexes[size], -1,
+               sizeof(int) * (writer->name_indexes_size - size));
+    }
+    if (writer->name_indexes[id] < 0)
+    {
+        name.length = strlen(text);
+        name.offset = pch_text(writer, text, name.length);
+        text_append(&writer->names, (const char *)&name, sizeof(name));
+        writer->name_indexes[id] = writer->names_count++;
+    }
+    return writer->name_indexes[id];
+}
+
+static int
+pch_constant(struct pch_writer *writer, const struct constant *constant)
+{
+    struct pch_constant saved;
+
+    saved.low = (unsigned int)constant->value;
+    saved.high = (unsigned int)(constant->value >> 32);
+    saved.type = constant->type;
+    text_append(&writer->constants, (const char *)&saved, sizeof(saved));
+    return writer->constants.length / sizeof(saved) - 1;
+}
+
+/*
+ * Adds a token to section, with its spelling after a space in the text if
+ * space is set.
+ */
+static void
+pch_token(struct pch_writer *writer, struct text *section,
+          const struct pp_token *token, int space)
+{
+    unsigned int start = spelling_start(token);
+    struct pch_token saved;
+
+    if (space)
+    {
+        pch_text(writer, " ", 1);
+    }
+    saved.type = token->type;
+    saved.offset = pch_text(writer,
+                            source_text(&writer->scanner->tokens, start),
+                            spelling_end(token) - start) + is_quoted(token);
+    saved.length = token->length;
+    saved.value = token->value;
+    if (token->type == TOK_IDENTIFIER)
+    {
+        saved.value = pch_name(writer, token->value);
+    }
+    else if (token->type == TOK_INTEGER || token->type == TOK_CHARACTER)
+    {
+        saved.value = pch_constant(writer,
+                                   &writer->scanner->tokens.constants[
+                                       token->value]);
+    }
+    text_append(section, (const char *)&saved, sizeof(saved));
+}
+
+/*
+ * Adds a macro to the macros section. Its tokens keep the spacing between
+ * them, which # in another macro can see.
+ */
+static void
+pch_macro(struct pch_writer *writer, int type, const struct macro *macro)
+{
+    struct pch_macro saved;
+    int i, name;
+
+    saved.type = type;
+    saved.name = pch_name(writer, macro->name);
+    saved.function_like = macro->function_like;
+    saved.variadic = macro->variadic;
+    saved.params_count = macro->params_count;
+    saved.params = writer->params.length / sizeof(int);
+    saved.body = writer->body.length / sizeof(struct pch_token);
+    saved.body_count = macro->body_count;
+    saved.digest = macro->digest;
+
+    for (i = 0; i < macro->params_count; i++)
+    {
+        name = pch_name(writer, macro->params[i]);
+        text_append(&writer->params, (const char *)&name, sizeof(name));
+    }
+    for (i = 0; i < macro->body_count; i++)
+    {
+        pch_token(writer, &writer->body, &macro->body[i],
+                  i > 0 && spelling_start(&macro->body[i]) !=
+                           spelling_end(&macro->body[i - 1]));
+    }
+    text_append(&writer->macros, (const char *)&saved, sizeof(saved));
+}
+
+static int
+pch_write(FILE *output, const struct text *section)
+{
+    return fwrite(section->data, 1, section->length, output) ==
+           section->length;
+}
+
+/*
+ * Saves the header that has just been read as a precompiled header. Failing to
+ * save it only means that it is not precompiled.
+ */
+static void
+save_pch(struct scanner *scanner)
+{
+    struct recording *recording = scanner->recording;
+    struct pch_header *header = &recording->header;
+    struct tokens *tokens = &scanner->tokens;
+    struct pch_writer writer;
+    struct included_file *file;
+    struct pch_file saved;
+    struct pp_token token;
+    struct listnode *node;
+    FILE *output;
+    char *path;
+    int i, written;
+
+    memset(&writer, 0, sizeof(writer));
+    writer.scanner = scanner;
+
+    foreach(node, recording->files)
+    {
+        file = node->data;
+        saved.path_length = strlen(file->path);
+        saved.path = pch_text(&writer, file->path, saved.path_length);
+        saved.content_hash = hash_bytes(HASH_INITIAL, file->content,
+                                        file->content_len);
+        saved.content_length = file->content_len;
+        saved.guard = file->guard >= 0 ? pch_name(&writer, file->guard) : -1;
+        saved.once = file->once;
+        text_append(&writer.files, (const char *)&saved, sizeof(saved));
+    }
+
+    token.hideset = NULL;
+    for (i = recording->start; i < tokens->count; i++)
+    {
+        token.type = tokens->types[i];
+        token.offset = tokens->offsets[i];
+        token.length = tokens->lengths[i];
+        token.value = tokens->values[i];
+        pch_token(&writer, &writer.tokens, &token, 0);
+    }
+
+    for (i = 0; i < scanner->macros_size; i++)
+    {
+        if (scanner->macros[i] != NULL)
+        {
+            pch_macro(&writer, TOK_IDENTIFIER, scanner->macros[i]);
+        }
+    }
+    for (i = 0; i <= TOK_TYPEDEF - TOK_VOID; i++)
+    {
+        if (scanner->keyword_macros[i] != NULL)
+        {
+            pch_macro(&writer, TOK_VOID + i, scanner->keyword_macros[i]);
+        }
+    }
+
+    header->macros_digest_after = scanner->macros_digest;
+    header->guard = recording->file->guard >= 0 ?
+                    pch_name(&writer, recording->file->guard) : -1;
+    header->once = recording->file->once;
+    header->files_count = writer.files.length / sizeof(struct pch_file);
+    header->names_count = writer.names_count;
+    header->tokens_count = writer.tokens.length / sizeof(struct pch_token);
+    header->macros_count = writer.macros.length / sizeof(struct pch_macro);
+    header->body_count = writer.body.length / sizeof(struct pch_token);
+    header->params_count = writer.params.length / sizeof(int);
+    header->constants_count = writer.constants.length /
+                              sizeof(struct pch_constant);
+    header->text_length = writer.text.length;
+
+    /*
+     * Write it under a name of its own and rename it into place, so another
+     * compile never reads half of it.
+     */
+    path = malloc(strlen(recording->path) + 32);
+    sprintf(path, "%s.%d", recording->path, (int)getpid());
+    if ((output = fopen(path, "wb")) != NULL)
+    {
+        written = fwrite(header, sizeof(struct pch_header), 1, output) == 1 &&
+                  pch_write(output, &writer.files) &&
+                  pch_write(output, &writer.names) &&
+                  pch_write(output, &writer.tokens) &&
+                  pch_write(output, &writer.macros) &&
+                  pch_write(output, &writer.body) &&
+                  pch_write(output, &writer.params) &&
+                  pch_write(output, &writer.constants) &&
+                  pch_write(output, &writer.text);
+        if (fclose(output) == 0 && written &&
+            rename(path, recording->path) == 0)
+        {
+            stats.headers_saved += 1;
+        }
+        else
+        {
+            remove(path);
+        }
+    }
+    free(path);
+
+    free(writer.files.data);
+    free(writer.names.data);
+    free(writer.tokens.data);
+    free(writer.macros.data);
+    free(writer.body.data);
+    free(writer.params.data);
+    free(writer.constants.data);
+    free(writer.text.data);
+    free(writer.name_indexes);
+}
+
+/*
+ * Reads a token of the precompiled header that was loaded last.
+ */
+static void
+pch_pp_token(struct scanner *scanner, const struct pch_token *saved,
+             struct pp_token *token)
+{
+    token->type = saved->type;
+    token->offset = scanner->replay_base + saved->offset;
+    token->length = saved->length;
+    token->value = saved->value;
+    if (saved->type == TOK_IDENTIFIER)
+    {
+        token->value = scanner->replay_names[saved->value];
+    }
+    else if (saved->type == TOK_INTEGER || saved->type == TOK_CHARACTER)
+    {
+        token->value = scanner->replay_constants[saved->value];
+    }
+    token->hideset = &every_macro;
+}
+
+/*
+ * The sections of a precompiled header that has been loaded.
+ */
+struct pch_sections
+{
+    const struct pch_header *header;
+    const struct pch_file *files;
+    const struct pch_name *names;
+    const struct pch_token *tokens;
+    const struct pch_macro *macros;
+    const struct pch_token *body;
+    const int *params;
+    const struct pch_constant *constants;
+    const char *text;
+};
+
+/*
+ * Returns the section of count items of size at *next and moves *next past it,
+ * or returns NULL if it runs past end.
+ */
+static const void *
+pch_section(const char **next, const char *end, unsigned int count,
+            size_t size)
+{
+    const char *section = *next;
+
+    if (count > (size_t)(end - section) / size)
+    {
+        return NULL;
+    }
+    *next = section + count * size;
+    return section;
+}
+
+static int
+pch_text_valid(const struct pch_sections *pch, unsigned int offset,
+               unsigned int length)
+{
+    return offset <= pch->header->text_length &&
+           length <= pch->header->text_length - offset;
+}
+
+static int
+pch_name_valid(const struct pch_sections *pch, int name)
+{
+    return name >= 0 && (unsigned int)name < pch->header->names_count;
+}
+
+/*
+ * Returns whether a saved token is spelled inside the text and names a name or
+ * constant that was saved.
+ */
+static int
+pch_token_valid(const struct pch_sections *pch, const struct pch_token *token)
+{
+    int quoted = token->type == TOK_STRING || token->type == TOK_CHARACTER;
+
+    if (token->type < 0 || token->type >= NUM_TOKEN_TYPES ||
+        token->offset < (unsigned int)quoted ||
+        !pch_text_valid(pch, token->offset - quoted, token->length) ||
+        !pch_text_valid(pch, token->offset + token->length, quoted))
+    {
+        return 0;
+    }
+    if (token->type == TOK_IDENTIFIER)
+    {
+        return pch_name_valid(pch, token->value);
+    }
+    if (token->type == TOK_INTEGER || token->type == TOK_CHARACTER)
+    {
+        return token->value >= 0 &&
+               (unsigned int)token->value < pch->header->constants_count;
+    }
+    return 1;
+}
+
+/*
+ * Finds the sections of the precompiled header in content and checks that its
+ * fields match key and that every offset and count in it stays inside it, so
+ * that a file that is cut short or damaged is not used.
+ */
+static int
+find_pch_sections(const char *content, size_t length,
+                  const struct pch_header *key, struct pch_sections *pch)
+{
+    const char *next = content, *end = content + length;
+    const struct pch_header *header;
+    const struct pch_macro *macro;
+    unsigned int i;
+
+    if ((header = pch_section(&next, end, 1,
+                              sizeof(struct pch_header))) == NULL ||
+        memcmp(header, key, offsetof(struct pch_header, macros_digest_after)))
+    {
+        return 0;
+    }
+    pch->header = header;
+    if ((pch->files = pch_section(&next, end, header->files_count,
+                                  sizeof(struct pch_file))) == NULL ||
+        (pch->names = pch_section(&next, end, header->names_count,
+                                  sizeof(struct pch_name))) == NULL ||
+        (pch->tokens = pch_section(&next, end, header->tokens_count,
+                                   sizeof(struct pch_token))) == NULL ||
+        (pch->macros = pch_section(&next, end, header->macros_count,
+                                   sizeof(struct pch_macro))) == NULL ||
+        (pch->body = pch_section(&next, end, header->body_count,
+                                 sizeof(struct pch_token))) == NULL ||
+        (pch->params = pch_section(&next, end, header->params_count,
+                                   sizeof(int))) == NULL ||
+        (pch->constants = pch_section(&next, end, header->constants_count,
+                                      sizeof(struct pch_constant))) == NULL ||
+        (pch->text = pch_section(&next, end, header->text_length, 1)) == NULL ||
+        next != end ||
+        (header->guard != -1 && !pch_name_valid(pch, header->guard)))
+    {
+        return 0;
+    }
+
+    for (i = 0; i < header->names_count; i++)
+    {
+        if (!pch_text_valid(pch, pch->names[i].offset, pch->names[i].length))
+        {
+            return 0;
+        }
+    }
+    for (i = 0; i < header->files_count; i++)
+    {
+        if (!pch_text_valid(pch, pch->files[i].path,
+                            pch->files[i].path_length) ||
+            (pch->files[i].guard != -1 &&
+             !pch_name_valid(pch, pch->files[i].guard)))
+        {
+            return 0;
+        }
+    }
+    for (i = 0; i < header->tokens_count; i++)
+    {
+        if (!pch_token_valid(pch, &pch->tokens[i]))
+        {
+            return 0;
+        }
+    }
+    for (i = 0; i < header->body_count; i++)
+    {
+        if (!pch_token_valid(pch, &pch->body[i]))
+        {
+            return 0;
+        }
+    }
+    for (i = 0; i < header->params_count; i++)
+    {
+        if (!pch_name_valid(pch, pch->params[i]))
+        {
+            return 0;
+        }
+    }
+    for (i = 0; i < header->macros_count; i++)
+    {
+        macro = &pch->macros[i];
+        if ((macro->type != TOK_IDENTIFIER &&
+             (macro->type < TOK_VOID || macro->type > TOK_TYPEDEF)) ||
+            !pch_name_valid(pch, macro->name) ||
+            macro->params_count < 0 || macro->body_count < 0 ||
+            macro->params > header->params_count ||
+            (unsigned int)macro->params_count >
+            header->params_count - macro->params ||
+            macro->body > header->body_count ||
+            (unsigned int)macro->body_count > header->body_count - macro->body)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Loads the precompiled header at path whose fields match key, if there is
+ * one, to be read instead of file. Every macro it saved replaces those that
+ * are defined, and its tokens are read next. Returns whether it was loaded.
+ */
+static int
+load_pch(struct scanner *scanner, struct included_file *file,
+         const struct pch_header *key, const char *path)
+{
+    const struct pch_header *header;
+    const struct pch_file *files;
+    const struct pch_name *names;
+    const struct pch_token *tokens, *body;
+    const struct pch_macro *macros;
+    const struct pch_constant *constants;
+    const int *params;
+    const char *text;
+    struct pch_sections pch;
+    struct included_file *included, **found;
+    struct macro *macro;
+    struct pp_token name;
+    struct stat st;
+    char *content, *file_path;
+    size_t length;
+    unsigned int i;
+    int j;
+
+    if ((content = map_file(path, &length)) == NULL)
+    {
+        return 0;
+    }
+    if (!find_pch_sections(content, length, key, &pch))
+    {
+        unmap_file(content, length);
+        return 0;
+    }
+    header = pch.header;
+    files = pch.files;
+    names = pch.names;
+    tokens = pch.tokens;
+    macros = pch.macros;
+    body = pch.body;
+    params = pch.params;
+    constants = pch.constants;
+    text = pch.text;
+
+    scanner->replay_names = realloc(scanner->replay_names, sizeof(int) *
+                                    (header->names_count + 1));
+    for (i = 0; i < header->names_count; i++)
+    {
+        scanner->replay_names[i] = intern(&text[names[i].offset],
+                                          names[i].length);
+    }
+
+    /*
+     * Every file the header included has to be as it was, and none can have
+     * been read with #pragma once since, or the header would skip it now.
+     */
+    found = malloc(sizeof(struct included_file *) * (header->files_count + 1));
+    for (i = 0; i < header->files_count; i++)
+    {
+        file_path = malloc(files[i].path_length + 1);
+        memcpy(file_path, &text[files[i].path], files[i].path_length);
+        file_path[files[i].path_length] = '\0';
+        included = NULL;
+        if (stat(file_path, &st) == 0 && S_ISREG(st.st_mode))
+        {
+            included = included_file(&st, file_path);
+        }
+        free(file_path);
+        if (included == NULL || included->once ||
+            !read_included_file(included) ||
+            included->content_len != files[i].content_length ||
+            hash_bytes(HASH_INITIAL, included->content,
+                       included->content_len) != files[i].content_hash)
+        {
+            free(found);
+            unmap_file(content, length);
+            return 0;
+        }
+        found[i] = included;
+    }
+
+    /*
+     * The files are dependencies just as if the header had been read. Whether
+     * a file is guarded depends only on its content, so that is kept as they
+     * are read.
+     */
+    for (i = 0; i < header->files_count; i++)
+    {
+        if (files[i].guard >= 0)
+        {
+            found[i]->guard = scanner->replay_names[files[i].guard];
+        }
+        found[i]->once = files[i].once;
+        add_dependency(scanner, found[i]);
+    }
+    free(found);
+
+    scanner->replay_base = tokens_add_source(&scanner->tokens, text,
+                                             header->text_length);
+    scanner->replay_constants = realloc(scanner->replay_constants,
+                                        sizeof(int) *
+                                        (header->constants_count + 1));
+    for (i = 0; i < header->constants_count; i++)
+    {
+        scanner->replay_constants[i] =
+            tokens_add_constant(&scanner->tokens,
+                                (unsigned long long)constants[i].high << 32 |
+                                constants[i].low, constants[i].type);
+    }
+    if (scanner->macros_size > 0)
+    {
+        memset(scanner->macros, 0, sizeof(struct macro *) *
+                                   scanner->macros_size);
+    }
+    memset(scanner->keyword_macros, 0, sizeof(scanner->keyword_macros));
+    for (i = 0; i < header->macros_count; i++)
+    {
+        macro = arena_alloc(&scanner->arena, sizeof(struct macro));
+        macro->name = scanner->replay_names[macros[i].name];
+        macro->function_like = macros[i].function_like;
+        macro->variadic = macros[i].variadic;
+        macro->params_count = macros[i].params_count;
+        macro->params = arena_alloc(&scanner->arena,
+                                    sizeof(int) * macro->params_count);
+        for (j = 0; j < macro->params_count; j++)
+        {
+            macro->params[j] =
+                scanner->replay_names[params[macros[i].params + j]];
+        }
+        macro->body_count = macros[i].body_count;
+        macro->body = arena_alloc(&scanner->arena, sizeof(struct pp_token) *
+                                                   macro->body_count);
+        for (j = 0; j < macro->body_count; j++)
+        {
+            pch_pp_token(scanner, &body[macros[i].body + j], &macro->body[j]);
+            macro->body[j].hideset = NULL;
+        }
+        macro->digest = macros[i].digest;
+
+        name.type = macros[i].type;
+        name.value = macro->name;
+        *macro_slot(scanner, &name) = macro;
+    }
+    scanner->macros_digest = header->macros_digest_after;
+
+    if (header->guard >= 0)
+    {
+        file->guard = scanner->replay_names[header->guard];
+    }
+    file->once = header->once;
+    scanner->replay = tokens;
+    scanner->replay_count = header->tokens_count;
+    stats.headers_loaded += 1;
+    return 1;
+}
+
+/*
+ * Reads the next token of the precompiled header that was loaded last.
+ */
+static void
+replay_token(struct scanner *scanner, struct pp_token *token)
+{
+    pch_pp_token(scanner, scanner->replay, token);
+    scanner->replay += 1;
+    scanner->replay_count -= 1;
+}
+
+/*
+ * Reads from the start of the file an #include names until it runs out. A file
+ * read before is skipped if it has #pragma once, or if its include guard is
+ * defined.
+ */
+static void
+include_file(struct scanner *scanner, const struct pp_tokens *line)
+{
+    const struct pp_token *tokens = line->items;
+    struct recording *recording;
+    struct included_file *file;
+    struct include *include;
+    const char *name = NULL;
+    char *path;
+    size_t length;
+    int i;
+
+    if (line->count >= 2 && tokens[1].type == TOK_STRING)
+    {
+        name = source_text(&scanner->tokens, tokens[1].offset);
+        length = tokens[1].length;
+    }
+    else if (line->count >= 2 && tokens[1].type == TOK_LESSTHAN)
+    {
+        /*
+         * Take the text between the brackets as it is, not as tokens.
+         */
+        for (i = 2; i < line->count; i++)
+        {
+            if (tokens[i].type == TOK_GREATERTHAN)
+            {
+                name = source_text(&scanner->tokens, tokens[1].offset + 1);
+                length = tokens[i].offset - tokens[1].offset - 1;
+                break;
+            }
+        }
+    }
+    if (name == NULL)
+    {
+        preprocessor_error(scanner, "#include expects \"FILENAME\" or "
+                           "<FILENAME>");
+    }
+    if (scanner->include_depth >= MAX_INCLUDE_DEPTH)
+    {
+        preprocessor_error(scanner, "#include nested too deeply");
+    }
+
+    file = find_include(scanner, name, length, tokens[1].type == TOK_STRING,
+                        &path);
+    if (file == NULL)
+    {
+        preprocessor_error(scanner, "%.*s: No such file or directory",
+                           (int)length, name);
+    }
+
+    add_dependency(scanner, file);
+    stats.includes += 1;
+    if (file->once ||
+        (file->guard >= 0 && file->guard < scanner->macros_size &&
+         scanner->macros[file->guard] != NULL))
+    {
+        /*
+         * A guard is a macro, so the key of a header being recorded already
+         * says whether it is defined, but nothing says which files were read
+         * with #pragma once before the header.
+         */
+        if (file->once && scanner->recording != NULL &&
+            file != scanner->recording->file &&
+            !list_contains(scanner->recording->files, file))
+        {
+            scanner->recording->skipped_once = 1;
+        }
+        stats.includes_skipped += 1;
+        free(path);
+        return;
+    }
+    if (!read_included_file(file))
+    {
+        preprocessor_error(scanner, "%s: %s", path, strerror(errno));
+    }
+
+    /*
+     * Headers the file being compiled includes are precompiled, unless they
+     * are in the arguments of a macro.
+     */
+    if (scanner->recording != NULL)
+    {
+        list_append(&scanner->recording->files, file);
+    }
+    else if (scanner->pch_directory != NULL && scanner->include_depth == 0 &&
+             scanner->arguments_depth == 0)
+    {
+        recording = calloc(1, sizeof(struct recording));
+        recording->path = pch_path(scanner, file, path, &recording->header);
+        if (load_pch(scanner, file, &recording->header, recording->path))
+        {
+            free(recording->path);
+            free(recording);
+            free(path);
+            return;
+        }
+        recording->file = file;
+        recording->start = scanner->tokens.count;
+        scanner->recording = recording;
+    }
+
+    include = malloc(sizeof(struct include));
+    include->content = scanner->content;
+    include->content_len = scanner->content_len;
+    include->position = scanner->position;
+    include->base = scanner->base;
+    include->filename = scanner->filename;
+    include->file = scanner->file;
+    include->conditionals = scanner->conditionals;
+    include->guard_name = scanner->guard_name;
+    include->guard_end = scanner->guard_end;
+    list_prepend(&scanner->includes, include);
+    scanner->include_depth += 1;
+
+    scanner->content = file->content;
+    scanner->content_len = file->content_len;
+    scanner->position = 0;
+    scanner->base = tokens_add_source(&scanner->tokens, file->content,
+                                      file->content_len);
+    scanner->filename = path;
+    scanner->file = file;
+    list_init(&scanner->conditionals);
+    scanner->guard_name = -1;
+    scanner->guard_end = 0;
+}
+
+/*
+ * Goes back to reading the file that included the current one. The file was
+ * guarded if its guard's #endif is the last thing in it, and a header that was
+ * being recorded is saved.
+ */
+static void
+end_include(struct scanner *scanner)
+{
+    struct listnode *node = scanner->includes, *files;
+    struct include *include = node->data;
+
+    if (scanner->guard_name >= 0 && scanner->guard_end > 0 &&
+        first_token_offset(scanner, scanner->guard_end) ==
+        scanner->base + scanner->content_len)
+    {
+        scanner->file->guard = scanner->guard_name;
+    }
+
+    /*
+     * A macro whose arguments are read past the end of the header expands to
+     * tokens of what follows it, so the header is not saved then.
+     */
+    if (scanner->recording != NULL && scanner->include_depth == 1)
+    {
+        if (scanner->arguments_depth == 0 && !scanner->recording->skipped_once)
+        {
+            save_pch(scanner);
+        }
+        while ((files = scanner->recording->files) != NULL)
+        {
+            scanner->recording->files = files->next;
+            free(files);
+        }
+        free(scanner->recording->path);
+        free(scanner->recording);
+        scanner->recording = NULL;
+    }
+
+    scanner->content = include->content;
+    scanner->content_len = include->content_len;
+    scanner->position = include->position;
+    scanner->base = include->base;
+    scanner->filename = include->filename;
+    scanner->file = include->file;
+    scanner->conditionals = include->conditionals;
+    scanner->guard_name = include->guard_name;
+    scanner->guard_end = include->guard_end;
+    scanner->includes = node->next;
+    scanner->include_depth -= 1;
+    free(include);
+    free(node);
+}
+
+/*
+ * Returns the position of the line after the one position is in, without
+ * scanning tokens. Lines are found with memchr(), and only a line with a "/"
+ * in it is read byte by byte, since it may start a comment that ends further
+ * on. Quotes are followed to the end of their line, and a "//" comment runs to
+ * it, so that a comment start in either is not one. A line ending in a
+ * backslash goes on to the next.
+ */
+static size_t
+skip_line(struct scanner *scanner, size_t position)
+{
+    const unsigned char *content = (const unsigned char *)scanner->content;
+    size_t length = scanner->content_len, end;
+    const unsigned char *newline;
+    int quote, c;
+
+    while (position < length)
+    {
+        newline = memchr(&content[position], '\n', length - position);
+        end = newline != NULL ? (size_t)(newline - content) : length;
+
+        if (memchr(&content[position], '/', end - position) != NULL)
+        {
+            for (quote = 0; position < end; position++)
+            {
+                c = content[position];
+                if (quote)
+                {
+                    if (c == '\\' && position + 1 < end)
+                    {
+                        position += 1;
+                    }
+                    else if (c == quote)
+                    {
+                        quote = 0;
+                    }
+                }
+                else if (c == '"' || c == '\'')
+                {
+                    quote = c;
+                }
+                else if (c == '/' && position + 1 < end &&
+                         content[position + 1] == '/')
+                {
+                    break;
+                }
+                else if (c == '/' && position + 1 < length &&
+                         content[position + 1] == '*')
+                {
+                    position = scan_run(content, position + 2, length,
+                                        RUN_COMMENT) + 1;
+                    if (position >= end)
+                    {
+                        break;
+                    }
+                }
+            }
+            if (position > end)
+            {
+                /* the comment went on past the end of the line */
+                position += 1;
+                continue;
+            }
+        }
+
+        if (end == length)
+        {
+            return length;
+        }
+        position = end + 1;
+        if (end == 0 || content[end - 1] != '\\')
+        {
+            return position;
+        }
+    }
+    return length;
+}
+
+/*
+ * Skips to the #elif, #else or #endif that ends the group being skipped and
+ * reads its tokens into line. Nested conditionals are skipped whole. Only the
+ * start of each line is looked at, and only the name of a directive there is
+ * scanned, so the text of the group is never tokenized.
+ */
+static void
+skip_group(struct scanner *scanner, struct pp_tokens *line)
+{
+    const char *content = scanner->content;
+    size_t position = scanner->position, length = scanner->content_len;
+    struct pp_token name;
+    int depth = 0;
+
+    for (;;)
+    {
+        position = skip_line(scanner, position);
+        while (position < length)
+        {
+            if (content[position] == ' ' || content[position] == '\t')
+            {
+                position += 1;
+            }
+            else if (content[position] == '/' && position + 1 < length &&
+                     content[position + 1] == '*')
+            {
+                position = scan_run((const unsigned char *)content,
+                                    position + 2, length, RUN_COMMENT) + 2;
+            }
+            else
+            {
+                break;
+            }
+        }
+        if (position >= length)
+        {
+            scanner->position = length;
+            preprocessor_error(scanner, "unterminated conditional directive");
+        }
+        if (content[position] != '#')
+        {
+            continue;
+        }
+
+        scanner->position = position + 1;
+        lex(scanner, &name);
+        if (name.type == TOK_EOF ||
+            line_ends_between(content, position,
+                              spelling_start(&name) - scanner->base))
+        {
+            continue;
+        }
+
+        if (directive_is(scanner, &name, "if") ||
+            directive_is(scanner, &name, "ifdef") ||
+            directive_is(scanner, &name, "ifndef"))
+        {
+            depth += 1;
+        }
+        else if (depth > 0 && directive_is(scanner, &name, "endif"))
+        {
+            depth -= 1;
+        }
+        else if (depth == 0 &&
+                 (directive_is(scanner, &name, "elif") ||
+                  directive_is(scanner, &name, "else") ||
+                  directive_is(scanner, &name, "endif")))
+        {
+            line->count = 0;
+            pp_tokens_append(line, &name);
+            read_directive(scanner, line);
+            return;
+        }
+    }
+}
+
+/*
+ * Ends the innermost conditional at its #endif.
+ */
+static void
+end_conditional(struct scanner *scanner)
+{
+    struct listnode *node = scanner->conditionals;
+    struct conditional *conditional;
+
+    if (node == NULL)
+    {
+        preprocessor_error(scanner, "#endif without #if");
+    }
+
+    conditional = node->data;
+    if (conditional->guard)
+    {
+        scanner->guard_end = scanner->position;
+    }
+    scanner->conditionals = node->next;
+    free(conditional);
+    free(node);
+}
+
+/*
+ * Moves the innermost conditional on to the group after an #elif or #else.
+ */
+static void
+next_group(struct scanner *scanner, const struct pp_token *name)
+{
+    struct conditional *conditional;
+
+    if (scanner->conditionals == NULL)
+    {
+        preprocessor_error(scanner, "#%.*s without #if", (int)name->length,
+                           source_text(&scanner->tokens, name->offset));
+    }
+
+    conditional = scanner->conditionals->data;
+    if (conditional->else_seen)
+    {
+        preprocessor_error(scanner, "#%.*s after #else", (int)name->length,
+                           source_text(&scanner->tokens, name->offset));
+    }
+    if (directive_is(scanner, name, "else"))
+    {
+        conditional->else_seen = 1;
+    }
+
+    /*
+     * A file with #else or #elif at the outer level is not all guarded.
+     */
+    if (conditional->guard)
+    {
+        conditional->guard = 0;
+        scanner->guard_name = -1;
+    }
+}
+
+static void expand_token(struct scanner *scanner, struct pp_token *token);
+
+/*
+ * An #if expression as it is evaluated: its tokens after macro expansion, and
+ * the next one to read.
+ */
+struct expression
+{
+    struct scanner *scanner;
+    struct pp_tokens tokens;
+    int next;
+};
+
+/*
+ * The value of an #if operand. Signed values are long and unsigned ones are
+ * unsigned long, and both are kept as the bits of an unsigned long. As in C,
+ * an operator with an unsigned operand works on both as unsigned.
+ */
+struct expression_value
+{
+    unsigned long value;
+    int is_unsigned;
+};
+
+static struct expression_value evaluate(struct expression *expression,
+                                        int evaluated);
+
+static struct expression_value
+signed_value(long value)
+{
+    struct expression_value result;
+
+    result.value = (unsigned long)value;
+    result.is_unsigned = 0;
+    return result;
+}
+
+static const struct pp_token *
+expression_token(const struct expression *expression)
+{
+    static const struct pp_token end = { TOK_EOF, 0, 0, -1, NULL };
+
+    return expression->next < expression->tokens.count ?
+           &expression->tokens.items[expression->next] : &end;
+}
+
+static void
+expect(struct expression *expression, int type, const char *message)
+{
+    if (expression_token(expression)->type != type)
+    {
+        preprocessor_error(expression->scanner, "%s", message);
+    }
+    expression->next += 1;
+}
+
+/*
+ * Evaluates a constant, a parenthesized expression or a unary operator and
+ * its operand. An identifier that is left after macro expansion is 0.
+ */
+static struct expression_value
+evaluate_unary(struct expression *expression, int evaluated)
+{
+    const struct pp_token *token = expression_token(expression);
+    struct tokens *tokens = &expression->scanner->tokens;
+    const struct constant *constant;
+    struct expression_value value;
+    const char *text;
+
+    expression->next += 1;
+    switch (token->type)
+    {
+    case TOK_INTEGER:
+    case TOK_CHARACTER:
+        /*
+         * Every type acts as long or unsigned long, so a constant that was
+         * only made unsigned int to fit is signed here. It is unsigned with a
+         * u suffix or if it is too big for long.
+         */
+        constant = &tokens->constants[token->value];
+        text = source_text(tokens, token->offset);
+        value.value = (unsigned long)constant->value;
+        value.is_unsigned =
+            (constant->type == CONSTANT_UNSIGNED_INT ||
+             constant->type == CONSTANT_UNSIGNED_LONG) &&
+            (value.value > LONG_MAX || memchr(text, 'u', token->length) ||
+             memchr(text, 'U', token->length));
+        return value;
+    case TOK_LPAREN:
+        value = evaluate(expression, evaluated);
+        expect(expression, TOK_RPAREN, "missing ')' in expression");
+        return value;
+    case TOK_PLUS:
+        return evaluate_unary(expression, evaluated);
+    case TOK_MINUS:
+        value = evaluate_unary(expression, evaluated);
+        value.value = 0UL - value.value;
+        return value;
+    case TOK_TILDE:
+        value = evaluate_unary(expression, evaluated);
+        value.value = ~value.value;
+        return value;
+    case TOK_BANG:
+        return signed_value(!evaluate_unary(expression, evaluated).value);
+    case TOK_EOF:
+        preprocessor_error(expression->scanner, "missing expression");
+    }
 
-                list_append(tokens, tok);
-            }
-            else if (i < content_len && content[i] == '=')
-            {
-                i += 1;
+    if (token->type == TOK_IDENTIFIER || token->type >= TOK_VOID)
+    {
+        return signed_value(0);
+    }
+    preprocessor_error(expression->scanner, "token \"%.*s\" is not valid in "
+                       "preprocessor expressions", (int)token->length,
+                       source_text(tokens, token->offset));
+    return signed_value(0);
+}
+
+/*
+ * Returns how tightly a binary operator binds, or 0 if the token is not one.
+ */
+static int
+binary_precedence(int type)
+{
+    switch (type)
+    {
+    case TOK_ASTERISK:
+    case TOK_BACKSLASH:
+    case TOK_MOD:
+        return 10;
+    case TOK_PLUS:
+    case TOK_MINUS:
+        return 9;
+    case TOK_SHIFTLEFT:
+    case TOK_SHIFTRIGHT:
+        return 8;
+    case TOK_LESSTHAN:
+    case TOK_GREATERTHAN:
+    case TOK_LESSTHANEQUAL:
+    case TOK_GREATERTHANEQUAL:
+        return 7;
+    case TOK_EQ:
+    case TOK_NEQ:
+        return 6;
+    case TOK_AMPERSAND:
+        return 5;
+    case TOK_CARET:
+        return 4;
+    case TOK_VERTICALBAR:
+        return 3;
+    case TOK_AMPERSAND_AMPERSAND:
+        return 2;
+    case TOK_VERTICALBAR_VERTICALBAR:
+        return 1;
+    }
+    return 0;
+}
 
-                tok = (struct token *)malloc(sizeof(struct token));
-                tok->type = TOK_GREATERTHANEQUAL;
+/*
+ * Returns whether l and r are ordered as the relational operator type says,
+ * compared as unsigned if is_unsigned is set and as signed otherwise.
+ */
+static int
+compare_values(int type, unsigned long l, unsigned long r, int is_unsigned)
+{
+    long left = (long)l, right = (long)r;
 
-                list_append(tokens, tok);
-            }
-            else
-            {
-                tok = (struct token *)malloc(sizeof(struct token));
-                tok->type = TOK_GREATERTHAN;
+    switch (type)
+    {
+    case TOK_LESSTHAN:
+        return is_unsigned ? l < r : left < right;
+    case TOK_GREATERTHAN:
+        return is_unsigned ? l > r : left > right;
+    case TOK_LESSTHANEQUAL:
+        return is_unsigned ? l <= r : left <= right;
+    }
+    return is_unsigned ? l >= r : left >= right;
+}
+
+/*
+ * Applies a binary operator other than && and ||. Dividing by zero is only an
+ * error in an operand that is evaluated. A shift has the type of its left
+ * operand, and any other operator works in unsigned if either operand is.
+ */
+static struct expression_value
+apply_binary(struct expression *expression, int type,
+             struct expression_value left, struct expression_value right,
+             int evaluated)
+{
+    unsigned long l = left.value, r = right.value;
+    struct expression_value result;
 
-                list_append(tokens, tok);
+    result.is_unsigned = left.is_unsigned || right.is_unsigned;
+    switch (type)
+    {
+    case TOK_ASTERISK:
+        result.value = l * r;
+        return result;
+    case TOK_BACKSLASH:
+    case TOK_MOD:
+        if (r == 0)
+        {
+            if (evaluated)
+            {
+                preprocessor_error(expression->scanner, "division by zero in "
+                                   "#if");
             }
+            result.value = 0;
         }
-        else if (content[i] == '<')
+        else if (result.is_unsigned)
         {
-            i += 1;
+            result.value = type == TOK_BACKSLASH ? l / r : l % r;
+        }
+        else if ((long)r == -1)
+        {
+            result.value = type == TOK_BACKSLASH ? 0UL - l : 0;
+        }
+        else
+        {
+            result.value = (unsigned long)(type == TOK_BACKSLASH ?
+                                           (long)l / (long)r :
+                                           (long)l % (long)r);
+        }
+        return result;
+    case TOK_PLUS:
+        result.value = l + r;
+        return result;
+    case TOK_MINUS:
+        result.value = l - r;
+        return result;
+    case TOK_SHIFTLEFT:
+        left.value = r < sizeof(long) * CHAR_BIT ? l << r : 0;
+        return left;
+    case TOK_SHIFTRIGHT:
+        if (left.is_unsigned || (long)l >= 0)
+        {
+            left.value = r < sizeof(long) * CHAR_BIT ? l >> r : 0;
+        }
+        else
+        {
+            left.value = r < sizeof(long) * CHAR_BIT ?
+                         (unsigned long)((long)l >> r) : 0UL - 1;
+        }
+        return left;
+    case TOK_LESSTHAN:
+    case TOK_GREATERTHAN:
+    case TOK_LESSTHANEQUAL:
+    case TOK_GREATERTHANEQUAL:
+        return signed_value(compare_values(type, l, r, result.is_unsigned));
+    case TOK_EQ:
+        return signed_value(l == r);
+    case TOK_NEQ:
+        return signed_value(l != r);
+    case TOK_AMPERSAND:
+        result.value = l & r;
+        return result;
+    case TOK_CARET:
+        result.value = l ^ r;
+        return result;
+    }
+    result.value = l | r;
+    return result;
+}
 
-            if (i < content_len && content[i] == '<')
-            {
-                i += 1;
+/*
+ * Evaluates binary operators that bind at least as tightly as precedence, by
+ * precedence climbing. The right operand of && and || is only evaluated if it
+ * decides the result.
+ */
+static struct expression_value
+evaluate_binary(struct expression *expression, int precedence, int evaluated)
+{
+    struct expression_value left = evaluate_unary(expression, evaluated);
+    struct expression_value right;
+    int type, operator_precedence;
 
-                tok = (struct token *)malloc(sizeof(struct token));
-                tok->type = TOK_SHIFTLEFT;
+    while ((operator_precedence = binary_precedence(
+                type = expression_token(expression)->type)) >= precedence)
+    {
+        expression->next += 1;
+        if (type == TOK_AMPERSAND_AMPERSAND)
+        {
+            right = evaluate_binary(expression, operator_precedence + 1,
+                                    evaluated && left.value);
+            left = signed_value(left.value && right.value);
+        }
+        else if (type == TOK_VERTICALBAR_VERTICALBAR)
+        {
+            right = evaluate_binary(expression, operator_precedence + 1,
+                                    evaluated && !left.value);
+            left = signed_value(left.value || right.value);
+        }
+        else
+        {
+            right = evaluate_binary(expression, operator_precedence + 1,
+                                    evaluated);
+            left = apply_binary(expression, type, left, right, evaluated);
+        }
+    }
+    return left;
+}
 
-                list_append(tokens, tok);
-            }
-            else if (i < content_len && content[i] == '=')
-            {
-                i += 1;
+/*
+ * Evaluates a conditional expression. evaluated is clear in an operand whose
+ * value is not used, where dividing by zero is allowed. The result is
+ * unsigned if either operand it chooses between is.
+ */
+static struct expression_value
+evaluate(struct expression *expression, int evaluated)
+{
+    struct expression_value condition, left, right;
 
-                tok = (struct token *)malloc(sizeof(struct token));
-                tok->type = TOK_LESSTHANEQUAL;
+    condition = evaluate_binary(expression, 1, evaluated);
+    if (expression_token(expression)->type != TOK_QUESTIONMARK)
+    {
+        return condition;
+    }
+    expression->next += 1;
+    left = evaluate(expression, evaluated && condition.value);
+    expect(expression, TOK_COLON, "expected ':' in expression");
+    right = evaluate(expression, evaluated && !condition.value);
 
-                list_append(tokens, tok);
-            }
-            else
-            {
-                tok = (struct token *)malloc(sizeof(struct token));
-                tok->type = TOK_LESSTHAN;
+    condition.value = condition.value ? left.value : right.value;
+    condition.is_unsigned = left.is_unsigned || right.is_unsigned;
+    return condition;
+}
 
-                list_append(tokens, tok);
-            }
+/*
+ * Returns whether the expression of an #if or #elif line is true. defined is
+ * applied before macros are expanded, so that the name it tests is not.
+ */
+static int
+evaluate_condition(struct scanner *scanner, const struct pp_tokens *line)
+{
+    struct pp_token token, end = { TOK_EOF, 0, 0, -1, NULL };
+    const struct pp_token *items = line->items, *name;
+    struct pp_tokens input = { NULL, 0, 0 };
+    struct expression expression;
+    int i, parens, value;
+
+    for (i = 1; i < line->count; i++)
+    {
+        if (items[i].type != TOK_IDENTIFIER ||
+            !directive_is(scanner, &items[i], "defined"))
+        {
+            pp_tokens_append(&input, &items[i]);
+            continue;
+        }
+
+        parens = i + 1 < line->count && items[i + 1].type == TOK_LPAREN;
+        name = i + 1 + parens < line->count ? &items[i + 1 + parens] : NULL;
+        if (name == NULL ||
+            (name->type != TOK_IDENTIFIER && name->type < TOK_VOID) ||
+            (parens && (i + 3 >= line->count ||
+                        items[i + 3].type != TOK_RPAREN)))
+        {
+            preprocessor_error(scanner, "operator \"defined\" requires an "
+                               "identifier");
         }
-        else if (content[i] == '^')
+        token = items[i];
+        token.type = TOK_INTEGER;
+        token.value = tokens_add_constant(&scanner->tokens,
+                                          find_macro(scanner, name) != NULL,
+                                          CONSTANT_INT);
+        pp_tokens_append(&input, &token);
+        i += 1 + parens * 2;
+    }
+
+    /*
+     * Expand the line on its own, ended by a TOK_EOF like an argument.
+     */
+    expression.scanner = scanner;
+    expression.tokens.items = NULL;
+    expression.tokens.count = 0;
+    expression.tokens.size = 0;
+    expression.next = 0;
+    unread_tokens(scanner, &end, 1);
+    unread_tokens(scanner, input.items, input.count);
+    for (;;)
+    {
+        expand_token(scanner, &token);
+        if (token.type == TOK_EOF)
         {
-            i += 1;
+            break;
+        }
+        pp_tokens_append(&expression.tokens, &token);
+    }
+    free(input.items);
+
+    if (expression.tokens.count == 0)
+    {
+        preprocessor_error(scanner, "#%.*s with no expression",
+                           (int)items[0].length,
+                           source_text(&scanner->tokens, items[0].offset));
+    }
+    value = evaluate(&expression, 1).value != 0;
+    if (expression.next < expression.tokens.count)
+    {
+        name = expression_token(&expression);
+        preprocessor_error(scanner, "missing binary operator before token "
+                           "\"%.*s\"", (int)name->length,
+                           source_text(&scanner->tokens, name->offset));
+    }
+    free(expression.tokens.items);
+    return value;
+}
 
-            tok = (struct token *)malloc(sizeof(struct token));
-            tok->type = TOK_CARET;
+/*
+ * Skips groups of the innermost conditional that are not compiled. If taken
+ * is set one of its groups has been compiled, and every group up to its
+ * #endif is skipped. Otherwise the group after the first #elif that is true,
+ * or after the #else, is compiled.
+ */
+static void
+skip_groups(struct scanner *scanner, int taken)
+{
+    struct pp_tokens line = { NULL, 0, 0 };
 
-            list_append(tokens, tok);
+    for (;;)
+    {
+        skip_group(scanner, &line);
+        if (directive_is(scanner, &line.items[0], "endif"))
+        {
+            end_conditional(scanner);
+            break;
         }
-        else if (content[i] == ',')
+
+        next_group(scanner, &line.items[0]);
+        if (!taken && (directive_is(scanner, &line.items[0], "else") ||
+                       evaluate_condition(scanner, &line)))
         {
-            i += 1;
+            break;
+        }
+    }
+    free(line.items);
+}
+
+/*
+ * Starts a conditional at the # at offset hash. If it tests that the macro
+ * guard names is not defined, and comes before any other token of an included
+ * file, it may be the file's include guard.
+ */
+static void
+start_conditional(struct scanner *scanner, unsigned int hash,
+                  const struct pp_token *guard)
+{
+    struct conditional *conditional = calloc(1, sizeof(struct conditional));
+
+    if (guard != NULL && guard->type == TOK_IDENTIFIER &&
+        scanner->file != NULL && scanner->conditionals == NULL &&
+        scanner->guard_end == 0 && first_token_offset(scanner, 0) == hash)
+    {
+        conditional->guard = 1;
+        scanner->guard_name = guard->value;
+    }
+    list_prepend(&scanner->conditionals, conditional);
+}
+
+/*
+ * Starts a conditional at #ifdef or #ifndef, which compiles its first group
+ * if the macro is defined or not defined as defined says.
+ */
+static void
+if_defined(struct scanner *scanner, const struct pp_tokens *line,
+           unsigned int hash, int defined)
+{
+    const struct pp_token *name = &line->items[1];
+
+    if (line->count < 2 ||
+        (name->type != TOK_IDENTIFIER && name->type < TOK_VOID))
+    {
+        preprocessor_error(scanner, "macro names must be identifiers");
+    }
 
-            tok = (struct token *)malloc(sizeof(struct token));
-            tok->type = TOK_COMMA;
+    start_conditional(scanner, hash, defined ? NULL : name);
+    if ((find_macro(scanner, name) != NULL) != defined)
+    {
+        skip_groups(scanner, 0);
+    }
+}
+
+/*
+ * Starts a conditional at #if, which compiles its first group if its
+ * expression is true. #if !defined X and #if !defined(X) guard a file just as
+ * #ifndef X does.
+ */
+static void
+if_expression(struct scanner *scanner, const struct pp_tokens *line,
+              unsigned int hash)
+{
+    const struct pp_token *items = line->items, *guard = NULL;
 
-            list_append(tokens, tok);
+    if (line->count >= 4 && items[1].type == TOK_BANG &&
+        directive_is(scanner, &items[2], "defined"))
+    {
+        if (line->count == 4)
+        {
+            guard = &items[3];
         }
-        else if (content[i] == '?')
+        else if (line->count == 6 && items[3].type == TOK_LPAREN &&
+                 items[5].type == TOK_RPAREN)
         {
-            i += 1;
+            guard = &items[4];
+        }
+    }
+
+    start_conditional(scanner, hash, guard);
+    if (!evaluate_condition(scanner, line))
+    {
+        skip_groups(scanner, 0);
+    }
+}
 
-            tok = (struct token *)malloc(sizeof(struct token));
-            tok->type = TOK_QUESTIONMARK;
+/*
+ * Runs the directive after a # that starts a line, at offset hash.
+ */
+static void
+preprocess(struct scanner *scanner, unsigned int hash)
+{
+    struct pp_tokens line = { NULL, 0, 0 };
+    const struct pp_token *name;
+    unsigned int start, end;
 
-            list_append(tokens, tok);
-        }
-        else if (content[i] == ':')
+    read_directive(scanner, &line);
+    if (line.count == 0)
+    {
+        return;
+    }
+
+    name = &line.items[0];
+    if (directive_is(scanner, name, "define"))
+    {
+        define_macro(scanner, &line);
+    }
+    else if (directive_is(scanner, name, "undef"))
+    {
+        undefine_macro(scanner, &line);
+    }
+    else if (directive_is(scanner, name, "include"))
+    {
+        include_file(scanner, &line);
+    }
+    else if (directive_is(scanner, name, "ifdef"))
+    {
+        if_defined(scanner, &line, hash, 1);
+    }
+    else if (directive_is(scanner, name, "ifndef"))
+    {
+        if_defined(scanner, &line, hash, 0);
+    }
+    else if (directive_is(scanner, name, "if"))
+    {
+        if_expression(scanner, &line, hash);
+    }
+    else if (directive_is(scanner, name, "elif") ||
+             directive_is(scanner, name, "else"))
+    {
+        /*
+         * The group before was compiled, so the rest are not.
+         */
+        next_group(scanner, name);
+        skip_groups(scanner, 1);
+    }
+    else if (directive_is(scanner, name, "endif"))
+    {
+        end_conditional(scanner);
+    }
+    else if (directive_is(scanner, name, "pragma"))
+    {
+        if (line.count > 1 && directive_is(scanner, &line.items[1], "once") &&
+            scanner->file != NULL)
         {
-            i += 1;
+            scanner->file->once = 1;
+        }
+    }
+    else if (directive_is(scanner, name, "error"))
+    {
+        start = spelling_start(name);
+        end = spelling_end(&line.items[line.count - 1]);
+        preprocessor_error(scanner, "#%.*s", (int)(end - start),
+                           source_text(&scanner->tokens, start));
+    }
+    else if (!directive_is(scanner, name, "line"))
+    {
+        preprocessor_error(scanner, "invalid preprocessing directive #%.*s",
+                           (int)name->length,
+                           source_text(&scanner->tokens, name->offset));
+    }
+    free(line.items);
+}
 
-            tok = (struct token *)malloc(sizeof(struct token));
-            tok->type = TOK_COLON;
+/*
+ * Runs the directive a # at the start of a line begins, or goes back to the
+ * including file at the end of an included one. Returns whether the token was
+ * used up.
+ */
+static int
+run_directive(struct scanner *scanner, const struct pp_token *token)
+{
+    if (token->type == TOK_HASH && scanner->hash_starts_line)
+    {
+        preprocess(scanner, token->offset);
+        return 1;
+    }
+    if (token->type == TOK_EOF)
+    {
+        if (scanner->conditionals != NULL)
+        {
+            preprocessor_error(scanner, "unterminated conditional directive");
+        }
+        if (scanner->includes != NULL)
+        {
+            end_include(scanner);
+            return 1;
+        }
+    }
+    return 0;
+}
 
-            list_append(tokens, tok);
+/*
+ * Returns the next token of the input before macro expansion.
+ */
+static void
+read_token(struct scanner *scanner, struct pp_token *token)
+{
+    do
+    {
+        if (scanner->pending.count > 0)
+        {
+            *token = scanner->pending.items[--scanner->pending.count];
+            return;
         }
-        else if (content[i] == '|')
+        if (scanner->replay_count > 0)
         {
-            i += 1;
+            replay_token(scanner, token);
+            return;
+        }
+        lex(scanner, token);
+    } while (run_directive(scanner, token));
+}
 
-            tok = (struct token *)malloc(sizeof(struct token));
-            tok->type = TOK_VERTICALBAR;
+/*
+ * Reads the arguments of a function-like macro up to the closing parenthesis,
+ * which is left in rparen. Commas inside parentheses do not separate
+ * arguments, and neither do those in the arguments of __VA_ARGS__.
+ */
+static struct pp_tokens *
+read_arguments(struct scanner *scanner, const struct macro *macro,
+               struct pp_token *rparen)
+{
+    int count = macro->params_count > 0 ? macro->params_count : 1;
+    struct pp_tokens *args = calloc(count, sizeof(struct pp_tokens));
+    int arg = 0, depth = 0;
 
-            if (i < content_len && content[i] == '|')
+    for (;;)
+    {
+        read_token(scanner, rparen);
+        if (rparen->type == TOK_EOF)
+        {
+            preprocessor_error(scanner, "unterminated argument list invoking "
+                               "macro \"%s\"", interned_string(macro->name));
+        }
+        if (depth == 0 && rparen->type == TOK_RPAREN)
+        {
+            break;
+        }
+        if (depth == 0 && rparen->type == TOK_COMMA &&
+            !(macro->variadic && arg == macro->params_count - 1))
+        {
+            if (++arg == count)
             {
-                i += 1;
-                tok->type = TOK_VERTICALBAR_VERTICALBAR;
+                preprocessor_error(scanner, "macro \"%s\" passed too many "
+                                   "arguments", interned_string(macro->name));
             }
+            continue;
+        }
 
-            list_append(tokens, tok);
+        if (rparen->type == TOK_LPAREN)
+        {
+            depth += 1;
         }
-        else if (content[i] == '.')
+        else if (rparen->type == TOK_RPAREN)
         {
-            i += 1;
+            depth -= 1;
+        }
+        pp_tokens_append(&args[arg], rparen);
+    }
+
+    if ((macro->params_count == 0 && args[0].count > 0) ||
+        (arg + 1 < macro->params_count &&
+         !(macro->variadic && arg + 2 == macro->params_count)))
+    {
+        preprocessor_error(scanner, "macro \"%s\" requires %d arguments",
+                           interned_string(macro->name), macro->params_count);
+    }
+    return args;
+}
+
+/*
+ * Appends an argument with its macros fully expanded, as a parameter is before
+ * it is substituted. The argument is read on its own, ended by a TOK_EOF, so
+ * its expansion cannot take tokens that follow the macro.
+ */
+static void
+expand_argument(struct scanner *scanner, const struct pp_tokens *arg,
+                struct pp_tokens *output)
+{
+    struct pp_token token = { TOK_EOF, 0, 0, -1, NULL };
+
+    unread_tokens(scanner, &token, 1);
+    unread_tokens(scanner, arg->items, arg->count);
+    for (;;)
+    {
+        expand_token(scanner, &token);
+        if (token.type == TOK_EOF)
+        {
+            return;
+        }
+        pp_tokens_append(output, &token);
+    }
+}
+
+/*
+ * Puts the body of a macro in front of the input with its parameters replaced
+ * by args, and adds hideset to the hide set of every token.
+ */
+static void
+substitute(struct scanner *scanner, const struct macro *macro,
+           const struct pp_tokens *args, struct hideset *hideset)
+{
+    struct pp_tokens output = { NULL, 0, 0 };
+    const struct pp_token *body = macro->body, *right;
+    struct pp_token token;
+    int i, j, param, right_count, left_start = 0;
 
-            tok = (struct token *)malloc(sizeof(struct token));
-            tok->type = TOK_DOT;
+    for (i = 0; i < macro->body_count; i++)
+    {
+        param = macro->function_like ? find_param(macro, &body[i]) : -1;
 
-            if (i < content_len + 2 && content[i] == '.' && content[i+1] == '.')
+        if (body[i].type == TOK_HASH_HASH)
+        {
+            /*
+             * Parameters on either side of ## are not expanded, and one with
+             * an empty argument leaves the other operand as it is.
+             */
+            param = macro->function_like ? find_param(macro, &body[i + 1])
+                                         : -1;
+            right = param >= 0 ? args[param].items : &body[i + 1];
+            right_count = param >= 0 ? args[param].count : 1;
+            j = 0;
+            if (output.count > left_start && right_count > 0)
             {
-                i += 2;
-                tok->type = TOK_ELLIPSIS;
+                paste(scanner, &output.items[output.count - 1], &right[0]);
+                j = 1;
             }
-
-            list_append(tokens, tok);
+            for (; j < right_count; j++)
+            {
+                pp_tokens_append(&output, &right[j]);
+            }
+            i += 1;
+            continue;
         }
-        else if (isspace(content[i]))
+
+        left_start = output.count;
+        if (macro->function_like && body[i].type == TOK_HASH)
         {
+            stringize(scanner, &args[find_param(macro, &body[i + 1])], &token);
+            pp_tokens_append(&output, &token);
             i += 1;
         }
+        else if (param >= 0 && i + 1 < macro->body_count &&
+                 body[i + 1].type == TOK_HASH_HASH)
+        {
+            for (j = 0; j < args[param].count; j++)
+            {
+                pp_tokens_append(&output, &args[param].items[j]);
+            }
+        }
+        else if (param >= 0)
+        {
+            expand_argument(scanner, &args[param], &output);
+        }
+        else
+        {
+            pp_tokens_append(&output, &body[i]);
+        }
+    }
+
+    for (i = 0; i < output.count; i++)
+    {
+        output.items[i].hideset = hideset_union(scanner,
+                                                output.items[i].hideset,
+                                                hideset);
+    }
+    unread_tokens(scanner, output.items, output.count);
+    free(output.items);
+}
+
+/*
+ * Puts the expansion of token in front of the input if it names a macro, and
+ * returns whether it did.
+ */
+static int
+expand_macro(struct scanner *scanner, const struct pp_token *token)
+{
+    struct pp_token rparen;
+    struct pp_tokens *args;
+    struct macro *macro;
+    int i;
+
+    macro = find_macro(scanner, token);
+    if (macro == NULL || hideset_contains(token->hideset, macro->name))
+    {
+        return 0;
+    }
+
+    if (!macro->function_like)
+    {
+        substitute(scanner, macro, NULL,
+                   hideset_add(scanner, token->hideset, macro->name));
+        return 1;
+    }
+
+    /*
+     * The name of a function-like macro is left alone unless arguments follow
+     * it.
+     */
+    scanner->arguments_depth += 1;
+    read_token(scanner, &rparen);
+    if (rparen.type != TOK_LPAREN)
+    {
+        unread_tokens(scanner, &rparen, 1);
+        scanner->arguments_depth -= 1;
+        return 0;
+    }
+
+    args = read_arguments(scanner, macro, &rparen);
+    scanner->arguments_depth -= 1;
+    substitute(scanner, macro, args,
+               hideset_add(scanner,
+                           hideset_intersection(scanner, token->hideset,
+                                                rparen.hideset),
+                           macro->name));
+    for (i = 0; i < macro->params_count; i++)
+    {
+        free(args[i].items);
+    }
+    free(args);
+    return 1;
+}
+
+/*
+ * Returns the next token of the input after macro expansion.
+ */
+static void
+expand_token(struct scanner *scanner, struct pp_token *token)
+{
+    do
+    {
+        read_token(scanner, token);
+    } while (expand_macro(scanner, token));
+}
+
+int
+next_token(struct scanner *scanner)
+{
+    struct pp_token token;
+
+    /*
+     * Most tokens are neither directives nor macros, so a token scanned from
+     * the file is only handed to the preprocessor if it has to be.
+     */
+    if (scanner->pending.count > 0 || scanner->replay_count > 0)
+    {
+        expand_token(scanner, &token);
+    }
+    else
+    {
+        lex(scanner, &token);
+        if (run_directive(scanner, &token) ||
+            (find_macro(scanner, &token) != NULL &&
+             expand_macro(scanner, &token)))
+        {
+            expand_token(scanner, &token);
+        }
     }
+    return tokens_append(&scanner->tokens, token.type, token.offset,
+                         token.length, token.value);
+}
+
+void
+scan(char *content, size_t content_len, struct tokens *tokens)
+{
+    struct scanner scanner;
+    int token;
+
+    scanner_init(&scanner, content, content_len);
+    do
+    {
+        token = next_token(&scanner);
+    } while (scanner.tokens.types[token] != TOK_EOF);
 
-    tok = (struct token *)malloc(sizeof(struct token));
-    tok->type = TOK_EOF;
-    list_append(tokens, tok);
+    *tokens = scanner.tokens;
 }
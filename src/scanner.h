@@ -11,6 +11,7 @@ enum token_t
     TOK_EOF = -1,
     TOK_INTEGER,
     TOK_STRING,
+    TOK_CHARACTER,
     TOK_IDENTIFIER,
     TOK_LPAREN,
     TOK_RPAREN,
@@ -37,6 +38,7 @@ enum token_t
     TOK_AMPERSAND,
     TOK_AMPERSAND_AMPERSAND,
     TOK_CARET,
+    TOK_TILDE,
     TOK_COMMA,
     TOK_DOT,
     TOK_ELLIPSIS,
@@ -53,6 +55,11 @@ enum token_t
     TOK_GREATERTHANEQUAL,
     TOK_EQ,
     TOK_NEQ,
+    TOK_HASH,
+    TOK_HASH_HASH,
+
+    /* a character that starts no other token */
+    TOK_OTHER,
 
     /* reserved words */
     TOK_VOID,
@@ -86,19 +93,258 @@ enum token_t
     TOK_STATIC,
     TOK_EXTERN,
     TOK_TYPEDEF,
+
+    NUM_TOKEN_TYPES
+};
+
+/*
+ * Types of integer and character constants. long long is no wider than long,
+ * so it is folded into long.
+ */
+enum constant_type
+{
+    CONSTANT_INT,
+    CONSTANT_UNSIGNED_INT,
+    CONSTANT_LONG,
+    CONSTANT_UNSIGNED_LONG,
+};
+
+/*
+ * The value of a constant is decoded once, when it is scanned. Signed values
+ * are stored two's complement.
+ */
+struct constant
+{
+    unsigned long long value;
+    enum constant_type type;
+};
+
+/*
+ * A source is a buffer of text that tokens refer to: a file, or text made by
+ * the preprocessor. Each source has its own range of offsets starting at base,
+ * so a token's offset alone finds its text whichever source it came from.
+ */
+#define INITIAL_SOURCES_SIZE 16
+
+struct source
+{
+    const char *content;
+    unsigned int base;
+};
+
+/*
+ * tokens is a buffer of scanned tokens kept as parallel arrays, so a token is
+ * just an index. The text of token i is lengths[i] bytes at offsets[i] in its
+ * source, leaving out the quotes of a string or character constant. Nothing is
+ * copied out of the sources, so they must outlive the buffer. values[i] is the
+ * interned id of an identifier's name, the index in constants of an integer or
+ * character constant's value, or -1 for any other token.
+ */
+#define INITIAL_TOKENS_SIZE 1024
+
+struct tokens
+{
+    signed char *types;
+    unsigned int *offsets;
+    unsigned int *lengths;
+    int *values;
+    int count;
+    int size;
+
+    struct constant *constants;
+    int constants_count;
+    int constants_size;
+
+    struct source *sources;
+    int sources_count;
+    int sources_size;
+    unsigned int end;
+};
+
+/*
+ * A token on its way through the preprocessor, with the hide set of the macros
+ * whose expansion produced it.
+ */
+struct pp_token
+{
+    signed char type;
+    unsigned int offset;
+    unsigned int length;
+    int value;
+    struct hideset *hideset;
+};
+
+struct pp_tokens
+{
+    struct pp_token *items;
+    int count;
+    int size;
+};
+
+/*
+ * scanner is a cursor over a buffer of code that produces one preprocessed
+ * token at a time into its token buffer. content is the file named filename
+ * that is being read, whose offsets start at base, and includes is the stack
+ * of files that included it. dependencies lists the path of every file that
+ * has been included, once each. conditionals is the stack of the file's open
+ * #if directives, and guard_name is the macro that may guard the whole file,
+ * whose #endif ends at guard_end. Macros are found by the interned id of their
+ * name, or by token type for reserved words, and macros_digest hashes every
+ * definition. Tokens from macro expansions wait in pending, the next one last,
+ * before more of content is read, and arguments_depth counts the macro
+ * invocations whose arguments are being read. Headers included by the file
+ * being compiled are precompiled in pch_directory if it is set: recording is
+ * the header being saved, and the replay_count tokens at replay are those of a
+ * header that was loaded, waiting to be read after pending. Its names and
+ * constants are found through replay_names and replay_constants.
+ */
+struct scanner
+{
+    char *content;
+    size_t content_len;
+    size_t position;
+    int hash_starts_line;
+    struct tokens tokens;
+
+    const char *filename;
+    unsigned int base;
+    struct included_file *file;
+    struct listnode *includes;
+    int include_depth;
+    struct listnode *include_paths;
+    struct listnode *dependencies;
+
+    struct listnode *conditionals;
+    int guard_name;
+    size_t guard_end;
+
+    struct macro **macros;
+    int macros_size;
+    struct macro *keyword_macros[TOK_TYPEDEF - TOK_VOID + 1];
+    unsigned int macros_digest;
+    struct pp_tokens pending;
+    int arguments_depth;
+
+    const char *pch_directory;
+    struct recording *recording;
+    const struct pch_token *replay;
+    int replay_count;
+    unsigned int replay_base;
+    int *replay_names;
+    int *replay_constants;
+
+    struct arena arena;
+};
+
+/*
+ * Counts kept by the preprocessor over the life of the process. A file that is
+ * guarded by #ifndef or #pragma once is read once, and any later #include of
+ * it is skipped without opening it. Precompiled headers are counted as they
+ * are loaded and saved.
+ */
+struct preprocessor_stats
+{
+    int includes;
+    int files_read;
+    int includes_skipped;
+    int headers_loaded;
+    int headers_saved;
 };
 
-struct token
+/*
+ * Implementations of the runs the scanner skips in bulk (whitespace, comments,
+ * strings and identifiers), from slowest to fastest.
+ */
+enum scanner_simd
 {
-    enum token_t type;
-    char *value;
+    SCANNER_SCALAR,
+    SCANNER_SSE2,
+    SCANNER_AVX2,
 };
 
-void preprocess(char *infile, char *outfile);
+/*
+ * Selects the fastest implementation up to level that this machine supports
+ * and returns it. scanner_init picks the fastest available on first use.
+ */
+enum scanner_simd scanner_use_simd(enum scanner_simd level);
+
+void scanner_init(struct scanner *scanner, char *content, size_t content_len);
+
+/*
+ * Names the file the scanner reads, which #include "..." searches next to and
+ * errors are reported in.
+ */
+void scanner_set_filename(struct scanner *scanner, const char *filename);
+
+/*
+ * Adds a directory that #include searches, in the order they were added.
+ */
+void scanner_add_include_path(struct scanner *scanner, const char *path);
+
+/*
+ * Saves the headers the file includes, already preprocessed, in directory, and
+ * loads them from there instead of scanning them again when they are included
+ * with the same macros defined and none of their files has changed.
+ */
+void scanner_set_pch_directory(struct scanner *scanner, const char *directory);
+
+const struct preprocessor_stats *preprocessor_stats(void);
+
+/*
+ * Reports an error at the line the scanner has read up to, and exits.
+ */
+void scanner_error(struct scanner *scanner, const char *format, ...);
+
+void tokens_init(struct tokens *tokens);
+
+/*
+ * Adds a source of length bytes to the buffer and returns the offset of its
+ * first byte.
+ */
+unsigned int tokens_add_source(struct tokens *tokens, const char *content,
+                               size_t length);
+
+/*
+ * Appends a token to the buffer, growing it as needed, and returns its index.
+ */
+int tokens_append(struct tokens *tokens, enum token_t type, size_t offset,
+                  size_t length, int value);
+
+/*
+ * Returns the text of a token in its source. It is not NUL-terminated and runs
+ * for lengths[token] bytes.
+ */
+const char *token_text(const struct tokens *tokens, int token);
+
+/*
+ * Returns the interned name of an identifier token. Names are equal exactly
+ * when the pointers are.
+ */
+const char *token_name(const struct tokens *tokens, int token);
+
+/*
+ * Returns the decoded value of an integer or character constant token.
+ */
+const struct constant *token_constant(const struct tokens *tokens, int token);
+
+/*
+ * Returns a NUL-terminated copy of the text of a token, owned by the caller.
+ */
+char *token_copy(const struct tokens *tokens, int token);
+
+void tokens_free(struct tokens *tokens);
+
+/*
+ * Scans the next token in the buffer into scanner->tokens and returns its
+ * index. Directives are run and macros expanded on the way, so the tokens are
+ * those left after preprocessing. Once the buffer is consumed every call adds
+ * a TOK_EOF token.
+ */
+int next_token(struct scanner *scanner);
 
 /*
- * Given a string of code, constructs a list of tokens
+ * Given a string of code, fills tokens with every token ending with TOK_EOF.
  */
-void scan(char *content, size_t content_len, struct listnode **tokens);
+void scan(char *content, size_t content_len, struct tokens *tokens);
 
 #endif
@@ -1,4 +1,9 @@
+#include <dirent.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <check.h>
 
@@ -7,6 +12,12 @@
 #include "scanner.h"
 #include "parser.h"
 
+static enum token_t
+next_token_type(struct scanner *scanner)
+{
+    return scanner->tokens.types[next_token(scanner)];
+}
+
 static void
 push_node_type_onto_stack(enum astnode_t type, struct listnode **stack)
 {
@@ -18,201 +29,183 @@ push_node_type_onto_stack(enum astnode_t type, struct listnode **stack)
     list_prepend(stack, node);
 }
 
-START_TEST(test_head_terminal_values_on_constant)
+START_TEST(test_first_terminals_on_constant)
 {
-    struct listnode *terminals, *checked_nodes;
+    const struct lookahead *terminals;
 
-    list_init(&terminals);
-    list_init(&checked_nodes);
+    terminals = first_terminals(AST_CONSTANT);
 
-    head_terminal_values(AST_CONSTANT, &checked_nodes, &terminals);
-
-    ck_assert_int_eq(AST_INTEGER_CONSTANT, (int)terminals->data);
-    ck_assert_int_eq(AST_CHARACTER_CONSTANT, (int)terminals->next->data);
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_INTEGER_CONSTANT));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_CHARACTER_CONSTANT));
 }
 END_TEST
 
-START_TEST(test_head_terminal_values_on_primary_expression)
+START_TEST(test_first_terminals_on_primary_expression)
 {
-    struct listnode *terminals, *checked_nodes;
-
-    list_init(&terminals);
-    list_init(&checked_nodes);
+    const struct lookahead *terminals;
 
-    head_terminal_values(AST_PRIMARY_EXPRESSION, &checked_nodes, &terminals);
+    terminals = first_terminals(AST_PRIMARY_EXPRESSION);
 
-    ck_assert_int_eq(AST_IDENTIFIER, (int)terminals->data);
-    ck_assert_int_eq(AST_INTEGER_CONSTANT, (int)terminals->next->data);
-    ck_assert_int_eq(AST_CHARACTER_CONSTANT, (int)terminals->next->next->data);
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_IDENTIFIER));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_INTEGER_CONSTANT));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_CHARACTER_CONSTANT));
 }
 END_TEST
 
-START_TEST(test_head_terminal_values_on_postfix_expression)
+START_TEST(test_first_terminals_on_postfix_expression)
 {
-    struct listnode *terminals, *checked_nodes;
+    const struct lookahead *terminals;
 
-    list_init(&terminals);
-    list_init(&checked_nodes);
+    terminals = first_terminals(AST_POSTFIX_EXPRESSION);
 
-    head_terminal_values(AST_POSTFIX_EXPRESSION, &checked_nodes, &terminals);
-
-    ck_assert_int_eq(AST_IDENTIFIER, (int)terminals->data);
-    ck_assert_int_eq(AST_INTEGER_CONSTANT, (int)terminals->next->data);
-    ck_assert_int_eq(AST_CHARACTER_CONSTANT, (int)terminals->next->next->data);
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_IDENTIFIER));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_INTEGER_CONSTANT));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_CHARACTER_CONSTANT));
 }
 END_TEST
 
-START_TEST(test_head_terminal_values_on_unary_expression)
+START_TEST(test_first_terminals_on_unary_expression)
 {
-    struct listnode *terminals, *checked_nodes;
-
-    list_init(&terminals);
-    list_init(&checked_nodes);
-
-    head_terminal_values(AST_UNARY_EXPRESSION, &checked_nodes, &terminals);
-
-    ck_assert_int_eq(AST_PLUS_PLUS, (int)terminals->data);
-    ck_assert_int_eq(AST_MINUS_MINUS, (int)terminals->next->data);
-    ck_assert_int_eq(AST_AMPERSAND, (int)terminals->next->next->data);
-    ck_assert_int_eq(AST_ASTERISK, (int)terminals->next->next->next->data);
-    ck_assert_int_eq(AST_PLUS, (int)terminals->next->next->next->next->data);
-    ck_assert_int_eq(AST_MINUS, (int)terminals->next->next->next->next->next->data);
-    ck_assert_int_eq(AST_IDENTIFIER, (int)terminals->next->next->next->next->next->next->data);
-    ck_assert_int_eq(AST_INTEGER_CONSTANT, (int)terminals->next->next->next->next->next->next->next->data);
-    ck_assert_int_eq(AST_CHARACTER_CONSTANT, (int)terminals->next->next->next->next->next->next->next->next->data);
+    const struct lookahead *terminals;
+
+    terminals = first_terminals(AST_UNARY_EXPRESSION);
+
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_PLUS_PLUS));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_MINUS_MINUS));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_AMPERSAND));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_ASTERISK));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_PLUS));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_MINUS));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_IDENTIFIER));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_INTEGER_CONSTANT));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_CHARACTER_CONSTANT));
 }
 END_TEST
 
-START_TEST(test_head_terminal_values_on_cast_expression)
+START_TEST(test_first_terminals_on_cast_expression)
 {
-    struct listnode *terminals, *checked_nodes;
-
-    list_init(&terminals);
-    list_init(&checked_nodes);
-
-    head_terminal_values(AST_CAST_EXPRESSION, &checked_nodes, &terminals);
-
-    ck_assert_int_eq(AST_PLUS_PLUS, (int)terminals->data);
-    ck_assert_int_eq(AST_MINUS_MINUS, (int)terminals->next->data);
-    ck_assert_int_eq(AST_AMPERSAND, (int)terminals->next->next->data);
-    ck_assert_int_eq(AST_ASTERISK, (int)terminals->next->next->next->data);
-    ck_assert_int_eq(AST_PLUS, (int)terminals->next->next->next->next->data);
-    ck_assert_int_eq(AST_MINUS, (int)terminals->next->next->next->next->next->data);
-    ck_assert_int_eq(AST_IDENTIFIER, (int)terminals->next->next->next->next->next->next->data);
-    ck_assert_int_eq(AST_INTEGER_CONSTANT, (int)terminals->next->next->next->next->next->next->next->data);
-    ck_assert_int_eq(AST_CHARACTER_CONSTANT, (int)terminals->next->next->next->next->next->next->next->next->data);
+    const struct lookahead *terminals;
+
+    terminals = first_terminals(AST_CAST_EXPRESSION);
+
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_PLUS_PLUS));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_MINUS_MINUS));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_AMPERSAND));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_ASTERISK));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_PLUS));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_MINUS));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_IDENTIFIER));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_INTEGER_CONSTANT));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_CHARACTER_CONSTANT));
 }
 END_TEST
 
-START_TEST(test_head_terminal_values_on_multiplicative_expression)
+START_TEST(test_first_terminals_on_multiplicative_expression)
 {
-    struct listnode *terminals, *checked_nodes;
-
-    list_init(&terminals);
-    list_init(&checked_nodes);
-
-    head_terminal_values(AST_MULTIPLICATIVE_EXPRESSION, &checked_nodes, &terminals);
-
-    ck_assert_int_eq(AST_PLUS_PLUS, (int)terminals->data);
-    ck_assert_int_eq(AST_MINUS_MINUS, (int)terminals->next->data);
-    ck_assert_int_eq(AST_AMPERSAND, (int)terminals->next->next->data);
-    ck_assert_int_eq(AST_ASTERISK, (int)terminals->next->next->next->data);
-    ck_assert_int_eq(AST_PLUS, (int)terminals->next->next->next->next->data);
-    ck_assert_int_eq(AST_MINUS, (int)terminals->next->next->next->next->next->data);
-    ck_assert_int_eq(AST_IDENTIFIER, (int)terminals->next->next->next->next->next->next->data);
-    ck_assert_int_eq(AST_INTEGER_CONSTANT, (int)terminals->next->next->next->next->next->next->next->data);
-    ck_assert_int_eq(AST_CHARACTER_CONSTANT, (int)terminals->next->next->next->next->next->next->next->next->data);
+    const struct lookahead *terminals;
+
+    terminals = first_terminals(AST_MULTIPLICATIVE_EXPRESSION);
+
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_PLUS_PLUS));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_MINUS_MINUS));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_AMPERSAND));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_ASTERISK));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_PLUS));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_MINUS));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_IDENTIFIER));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_INTEGER_CONSTANT));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_CHARACTER_CONSTANT));
 }
 END_TEST
 
-START_TEST(test_head_terminal_values_on_additive_expression)
+START_TEST(test_first_terminals_on_additive_expression)
 {
-    struct listnode *terminals, *checked_nodes;
-
-    list_init(&terminals);
-    list_init(&checked_nodes);
-
-    head_terminal_values(AST_ADDITIVE_EXPRESSION, &checked_nodes, &terminals);
-
-    ck_assert_int_eq(AST_PLUS_PLUS, (int)terminals->data);
-    ck_assert_int_eq(AST_MINUS_MINUS, (int)terminals->next->data);
-    ck_assert_int_eq(AST_AMPERSAND, (int)terminals->next->next->data);
-    ck_assert_int_eq(AST_ASTERISK, (int)terminals->next->next->next->data);
-    ck_assert_int_eq(AST_PLUS, (int)terminals->next->next->next->next->data);
-    ck_assert_int_eq(AST_MINUS, (int)terminals->next->next->next->next->next->data);
-    ck_assert_int_eq(AST_IDENTIFIER, (int)terminals->next->next->next->next->next->next->data);
-    ck_assert_int_eq(AST_INTEGER_CONSTANT, (int)terminals->next->next->next->next->next->next->next->data);
-    ck_assert_int_eq(AST_CHARACTER_CONSTANT, (int)terminals->next->next->next->next->next->next->next->next->data);
+    const struct lookahead *terminals;
+
+    terminals = first_terminals(AST_ADDITIVE_EXPRESSION);
+
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_PLUS_PLUS));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_MINUS_MINUS));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_AMPERSAND));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_ASTERISK));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_PLUS));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_MINUS));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_IDENTIFIER));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_INTEGER_CONSTANT));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_CHARACTER_CONSTANT));
 }
 END_TEST
 
-START_TEST(test_head_terminal_values_on_shift_expression)
+START_TEST(test_first_terminals_on_shift_expression)
 {
-    struct listnode *terminals, *checked_nodes;
-
-    list_init(&terminals);
-    list_init(&checked_nodes);
-
-    head_terminal_values(AST_SHIFT_EXPRESSION, &checked_nodes, &terminals);
-
-    ck_assert_int_eq(AST_PLUS_PLUS, (int)terminals->data);
-    ck_assert_int_eq(AST_MINUS_MINUS, (int)terminals->next->data);
-    ck_assert_int_eq(AST_AMPERSAND, (int)terminals->next->next->data);
-    ck_assert_int_eq(AST_ASTERISK, (int)terminals->next->next->next->data);
-    ck_assert_int_eq(AST_PLUS, (int)terminals->next->next->next->next->data);
-    ck_assert_int_eq(AST_MINUS, (int)terminals->next->next->next->next->next->data);
-    ck_assert_int_eq(AST_IDENTIFIER, (int)terminals->next->next->next->next->next->next->data);
-    ck_assert_int_eq(AST_INTEGER_CONSTANT, (int)terminals->next->next->next->next->next->next->next->data);
-    ck_assert_int_eq(AST_CHARACTER_CONSTANT, (int)terminals->next->next->next->next->next->next->next->next->data);
+    const struct lookahead *terminals;
+
+    terminals = first_terminals(AST_SHIFT_EXPRESSION);
+
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_PLUS_PLUS));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_MINUS_MINUS));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_AMPERSAND));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_ASTERISK));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_PLUS));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_MINUS));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_IDENTIFIER));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_INTEGER_CONSTANT));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_CHARACTER_CONSTANT));
 }
 END_TEST
 
-START_TEST(test_head_terminal_values_on_relational_expression)
+START_TEST(test_first_terminals_on_relational_expression)
 {
-    struct listnode *terminals, *checked_nodes;
-
-    list_init(&terminals);
-    list_init(&checked_nodes);
-
-    head_terminal_values(AST_RELATIONAL_EXPRESSION, &checked_nodes, &terminals);
-
-    ck_assert_int_eq(AST_PLUS_PLUS, (int)terminals->data);
-    ck_assert_int_eq(AST_MINUS_MINUS, (int)terminals->next->data);
-    ck_assert_int_eq(AST_AMPERSAND, (int)terminals->next->next->data);
-    ck_assert_int_eq(AST_ASTERISK, (int)terminals->next->next->next->data);
-    ck_assert_int_eq(AST_PLUS, (int)terminals->next->next->next->next->data);
-    ck_assert_int_eq(AST_MINUS, (int)terminals->next->next->next->next->next->data);
-    ck_assert_int_eq(AST_IDENTIFIER, (int)terminals->next->next->next->next->next->next->data);
-    ck_assert_int_eq(AST_INTEGER_CONSTANT, (int)terminals->next->next->next->next->next->next->next->data);
-    ck_assert_int_eq(AST_CHARACTER_CONSTANT, (int)terminals->next->next->next->next->next->next->next->next->data);
+    const struct lookahead *terminals;
+
+    terminals = first_terminals(AST_RELATIONAL_EXPRESSION);
+
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_PLUS_PLUS));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_MINUS_MINUS));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_AMPERSAND));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_ASTERISK));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_PLUS));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_MINUS));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_IDENTIFIER));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_INTEGER_CONSTANT));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_CHARACTER_CONSTANT));
 }
 END_TEST
 
-START_TEST(test_head_terminal_values_on_specifier_qualifier_list)
+START_TEST(test_first_terminals_on_specifier_qualifier_list)
 {
-    struct listnode *terminals, *checked_nodes;
+    const struct lookahead *terminals;
+
+    terminals = first_terminals(AST_SPECIFIER_QUALIFIER_LIST);
+
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_VOID));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_CHAR));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_SHORT));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_INT));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_LONG));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_FLOAT));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_DOUBLE));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_SIGNED));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_UNSIGNED));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_STRUCT));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_UNION));
+    ck_assert_int_eq(1, lookahead_contains(terminals, AST_ENUM));
 
-    list_init(&terminals);
-    list_init(&checked_nodes);
+    // FIXME: update this test...
+    //ck_assert_int_eq(1, lookahead_contains(terminals, AST_CONST));
+    //ck_assert_int_eq(1, lookahead_contains(terminals, AST_VOLATILE));
+}
+END_TEST
 
-    head_terminal_values(AST_SPECIFIER_QUALIFIER_LIST, &checked_nodes, &terminals);
+START_TEST(test_first_terminals_excludes_unreachable_terminals)
+{
+    const struct lookahead *terminals;
 
-    ck_assert_int_eq(AST_VOID, (int)terminals->data);
-    ck_assert_int_eq(AST_CHAR, (int)terminals->next->data);
-    ck_assert_int_eq(AST_SHORT, (int)terminals->next->next->data);
-    ck_assert_int_eq(AST_INT, (int)terminals->next->next->next->data);
-    ck_assert_int_eq(AST_LONG, (int)terminals->next->next->next->next->data);
-    ck_assert_int_eq(AST_FLOAT, (int)terminals->next->next->next->next->next->data);
-    ck_assert_int_eq(AST_DOUBLE, (int)terminals->next->next->next->next->next->next->data);
-    ck_assert_int_eq(AST_SIGNED, (int)terminals->next->next->next->next->next->next->next->data);
-    ck_assert_int_eq(AST_UNSIGNED, (int)terminals->next->next->next->next->next->next->next->next->data);
-    ck_assert_int_eq(AST_STRUCT, (int)terminals->next->next->next->next->next->next->next->next->next->data);
-    ck_assert_int_eq(AST_UNION, (int)terminals->next->next->next->next->next->next->next->next->next->next->data);
-    ck_assert_int_eq(AST_ENUM, (int)terminals->next->next->next->next->next->next->next->next->next->next->next->data);
+    terminals = first_terminals(AST_CONSTANT);
 
-    // FIXME: update this test...
-    //ck_assert_int_eq(AST_CONST, (int)terminals->next->next->next->next->next->next->next->next->next->next->next->next->data);
-    //ck_assert_int_eq(AST_VOLATILE, (int)terminals->next->next->next->next->next->next->next->next->next->next->next->next->next->data);
+    ck_assert_int_eq(0, lookahead_contains(terminals, AST_IDENTIFIER));
+    ck_assert_int_eq(0, lookahead_contains(terminals, AST_INVALID));
+    ck_assert_int_eq(0, is_nullable(AST_CONSTANT));
 }
 END_TEST
 
@@ -273,10 +266,10 @@ START_TEST(test_generate_items_on_postfix_expression)
         (struct rule) { AST_POSTFIX_EXPRESSION, create_, 3, { AST_POSTFIX_EXPRESSION, AST_LPAREN, AST_RPAREN } },
         *((struct item *)items->data)->rewrite_rule);
 
-    assert_rules_equal(
-        (struct rule) { AST_POSTFIX_EXPRESSION, create_, 3, { AST_POSTFIX_EXPRESSION, AST_LPAREN, AST_RPAREN } },
-        *((struct item *)items->next->data)->rewrite_rule);
-    ck_assert_int_eq(AST_LPAREN, (int)((struct item *)items->next->data)->lookahead->data);
+    ck_assert_int_eq(1, lookahead_contains(&((struct item *)items->data)->lookahead, AST_INVALID));
+    ck_assert_int_eq(1, lookahead_contains(&((struct item *)items->data)->lookahead, AST_LPAREN));
+    ck_assert_ptr_ne(((struct item *)items->data)->rewrite_rule,
+                     ((struct item *)items->next->data)->rewrite_rule);
 }
 END_TEST
 
@@ -323,31 +316,124 @@ START_TEST(test_generate_transitions_increments_cursor_position)
 }
 END_TEST
 
+START_TEST(test_merge_states_reduces_state_count)
+{
+    int clr_size, lalr_size, minimal_size;
+    int clr_reduce_reduce, lalr_reduce_reduce, minimal_reduce_reduce;
+    int shift_reduce;
+
+    generate_states();
+
+    count_states(TABLE_CLR, &clr_size, &shift_reduce, &clr_reduce_reduce);
+    count_states(TABLE_LALR, &lalr_size, &shift_reduce, &lalr_reduce_reduce);
+    count_states(TABLE_MINIMAL, &minimal_size, &shift_reduce,
+                 &minimal_reduce_reduce);
+
+    ck_assert_int_eq(1, lalr_size < clr_size);
+    ck_assert_int_eq(1, lalr_size <= minimal_size);
+    ck_assert_int_eq(1, minimal_size <= clr_size);
+    ck_assert_int_eq(1, minimal_reduce_reduce <= clr_reduce_reduce);
+}
+END_TEST
+
+START_TEST(test_parse_action_in_start_state)
+{
+    ck_assert_int_eq(1, IS_SHIFT(parse_action(0, AST_INT)));
+    ck_assert_int_eq(1, IS_SHIFT(parse_action(0, AST_IDENTIFIER)));
+    ck_assert_int_eq(NO_ACTION, parse_action(0, AST_RBRACE));
+}
+END_TEST
+
+START_TEST(test_parser_keeps_elided_type_of_collapsed_unit_rules)
+{
+    struct ast_translation_unit *ast;
+    struct ast_function *function;
+    struct astnode *statement;
+    struct scanner scanner;
+    char *content;
+
+    /*
+     * The returned expression goes through a chain of unit rules up to
+     * statement and keeps the type it was built as.
+     */
+    content = "int function()"
+              "{"
+              "    return 1 + 2;"
+              "}";
+    scanner_init(&scanner, content, strlen(content));
+
+    ast = (struct ast_translation_unit *)parse(&scanner);
+    function = (struct ast_function *)ast->translation_unit_items[0];
+    statement = function->statements->statements->items[0];
+    ck_assert_int_eq(AST_STATEMENT, statement->type);
+    ck_assert_int_eq(AST_ADDITIVE_EXPRESSION, statement->elided_type);
+}
+END_TEST
+
+#ifdef DIRECT_PARSER
+START_TEST(test_parse_direct_matches_parse)
+{
+    struct ast_translation_unit *ast, *direct_ast;
+    struct ast_function *function, *direct_function;
+    struct astnode *statement, *direct_statement;
+    struct scanner scanner;
+    char *content;
+
+    content = "int count;"
+              "int function(int a)"
+              "{"
+              "    int i;"
+              "    for (i=0; i<a; i++)"
+              "    {"
+              "        count = count + i * 2;"
+              "    }"
+              "    return count - 1;"
+              "}";
+    scanner_init(&scanner, content, strlen(content));
+
+    ast = (struct ast_translation_unit *)parse(&scanner);
+    scanner_init(&scanner, content, strlen(content));
+    direct_ast = (struct ast_translation_unit *)parse_direct(&scanner);
+    ck_assert_int_eq(ast->type, direct_ast->type);
+    ck_assert_int_eq(ast->translation_unit_items_size,
+                     direct_ast->translation_unit_items_size);
+
+    function = (struct ast_function *)ast->translation_unit_items[1];
+    direct_function =
+        (struct ast_function *)direct_ast->translation_unit_items[1];
+    ck_assert_int_eq(function->statements->statements->size,
+                     direct_function->statements->statements->size);
+
+    statement = function->statements->statements->items[1];
+    direct_statement = direct_function->statements->statements->items[1];
+    ck_assert_int_eq(statement->type, direct_statement->type);
+    ck_assert_int_eq(statement->elided_type, direct_statement->elided_type);
+}
+END_TEST
+#endif
+
 START_TEST(test_parser_can_parse_simple_declaration)
 {
     struct astnode *ast;
-    struct listnode *tokens;
+    struct scanner scanner;
     char *content;
-    list_init(&tokens);
 
     /*
      * parse global variable declaration
      */
     content = "int identifier;";
-    scan(content, strlen(content), &tokens);
+    scanner_init(&scanner, content, strlen(content));
 
-    ast = parse(tokens);
+    ast = parse(&scanner);
     ck_assert_int_eq(AST_TRANSLATION_UNIT, ast->type);
 
-    list_init(&tokens);
-
     /*
      * parse global variable declaration with multiple specifiers
      */
     content = "static int identifier;";
-    scan(content, strlen(content), &tokens);
+    scanner_init(&scanner, content, strlen(content));
 
-    ast = parse(tokens);
+    ast = parse(&scanner);
     ck_assert_int_eq(AST_TRANSLATION_UNIT, ast->type);
 }
 END_TEST
@@ -355,18 +441,17 @@ END_TEST
 START_TEST(test_parser_can_parse_multiple_simple_declarations)
 {
     struct astnode *ast;
-    struct listnode *tokens;
+    struct scanner scanner;
     char *content;
-    list_init(&tokens);
 
     /*
      * parse global variable declaration
      */
     content = "int identifier;"
               "long identifier;";
-    scan(content, strlen(content), &tokens);
+    scanner_init(&scanner, content, strlen(content));
 
-    ast = parse(tokens);
+    ast = parse(&scanner);
     ck_assert_int_eq(AST_TRANSLATION_UNIT, ast->type);
 }
 END_TEST
@@ -374,9 +459,8 @@ END_TEST
 START_TEST(test_parser_can_parse_primary_expressions)
 {
     struct astnode *ast;
-    struct listnode *tokens;
+    struct scanner scanner;
     char *content;
-    list_init(&tokens);
 
     /*
      * parse primary expression with parens
@@ -385,9 +469,9 @@ START_TEST(test_parser_can_parse_primary_expressions)
               "{"
               "    return (1 + 2) * 3;"
               "}";
-    scan(content, strlen(content), &tokens);
+    scanner_init(&scanner, content, strlen(content));
 
-    ast = parse(tokens);
+    ast = parse(&scanner);
     ck_assert_int_eq(AST_TRANSLATION_UNIT, ast->type);
 }
 END_TEST
@@ -395,9 +479,8 @@ END_TEST
 START_TEST(test_parser_can_parse_function)
 {
     struct astnode *ast;
-    struct listnode *tokens;
+    struct scanner scanner;
     char *content;
-    list_init(&tokens);
 
     /*
      * parse empty function
@@ -405,15 +488,14 @@ START_TEST(test_parser_can_parse_function)
     content = "char function()"
               "{"
               "}";
-    scan(content, strlen(content), &tokens);
+    scanner_init(&scanner, content, strlen(content));
 
-    ast = parse(tokens);
+    ast = parse(&scanner);
     ck_assert_int_eq(AST_TRANSLATION_UNIT, ast->type);
 
     /*
      * parse function with variable declarations and for loop
      */
-    list_init(&tokens);
     content = "char function()"
               "{"
               "    int identifier;"
@@ -422,53 +504,50 @@ START_TEST(test_parser_can_parse_function)
               "    {"
               "    }"
               "}";
-    scan(content, strlen(content), &tokens);
+    scanner_init(&scanner, content, strlen(content));
 
-    ast = parse(tokens);
+    ast = parse(&scanner);
     ck_assert_int_eq(AST_TRANSLATION_UNIT, ast->type);
 
     /*
      * parse function for loop with parameters
      */
-    list_init(&tokens);
     content = "char function(int i)"
               "{"
               "    for (i=1;i<5;i++)"
               "    {"
               "    }"
               "}";
-    scan(content, strlen(content), &tokens);
+    scanner_init(&scanner, content, strlen(content));
 
-    ast = parse(tokens);
+    ast = parse(&scanner);
     ck_assert_int_eq(AST_TRANSLATION_UNIT, ast->type);
 
     /*
      * parse function while loop
      */
-    list_init(&tokens);
     content = "char function(char a, char b)"
               "{"
               "    while (a == b)"
               "    {"
               "    }"
               "}";
-    scan(content, strlen(content), &tokens);
+    scanner_init(&scanner, content, strlen(content));
 
-    ast = parse(tokens);
+    ast = parse(&scanner);
     ck_assert_int_eq(AST_TRANSLATION_UNIT, ast->type);
 
     /*
      * parse function goto
      */
-    list_init(&tokens);
     content = "char function()"
               "{"
               "label1:"
               "    goto label1;"
               "}";
-    scan(content, strlen(content), &tokens);
+    scanner_init(&scanner, content, strlen(content));
 
-    ast = parse(tokens);
+    ast = parse(&scanner);
     ck_assert_int_eq(AST_TRANSLATION_UNIT, ast->type);
 }
 END_TEST
@@ -476,9 +555,8 @@ END_TEST
 START_TEST(test_parser_can_parse_function_calls)
 {
     struct astnode *ast;
-    struct listnode *tokens;
+    struct scanner scanner;
     char *content;
-    list_init(&tokens);
 
     /*
      * function with no parameters
@@ -487,35 +565,33 @@ START_TEST(test_parser_can_parse_function_calls)
               "{"
               "    afunction();"
               "}";
-    scan(content, strlen(content), &tokens);
+    scanner_init(&scanner, content, strlen(content));
 
-    ast = parse(tokens);
+    ast = parse(&scanner);
     ck_assert_int_eq(AST_TRANSLATION_UNIT, ast->type);
 
     /*
      * function with literal arguments
      */
-    list_init(&tokens);
     content = "char function()"
               "{"
               "    bfunction(1, 2);"
               "}";
-    scan(content, strlen(content), &tokens);
+    scanner_init(&scanner, content, strlen(content));
 
-    ast = parse(tokens);
+    ast = parse(&scanner);
     ck_assert_int_eq(AST_TRANSLATION_UNIT, ast->type);
 
     /*
      * function with argument variables
      */
-    list_init(&tokens);
     content = "char function()"
               "{"
               "    cfunction(myargument);"
               "}";
-    scan(content, strlen(content), &tokens);
+    scanner_init(&scanner, content, strlen(content));
 
-    ast = parse(tokens);
+    ast = parse(&scanner);
     ck_assert_int_eq(AST_TRANSLATION_UNIT, ast->type);
 }
 END_TEST
@@ -523,17 +599,16 @@ END_TEST
 START_TEST(test_parser_can_parse_function_prototype)
 {
     struct astnode *ast;
-    struct listnode *tokens;
+    struct scanner scanner;
     char *content;
-    list_init(&tokens);
 
     /*
      * parse empty function
      */
     content = "char function(int a, char *s);";
-    scan(content, strlen(content), &tokens);
+    scanner_init(&scanner, content, strlen(content));
 
-    ast = parse(tokens);
+    ast = parse(&scanner);
     ck_assert_int_eq(AST_TRANSLATION_UNIT, ast->type);
 }
 END_TEST
@@ -541,31 +616,29 @@ END_TEST
 START_TEST(test_parser_can_parse_struct)
 {
     struct astnode *ast;
-    struct listnode *tokens;
+    struct scanner scanner;
     char *content;
-    list_init(&tokens);
 
     /*
      * parse empty struct
      */
     content = "struct identifier;";
-    scan(content, strlen(content), &tokens);
+    scanner_init(&scanner, content, strlen(content));
 
-    ast = parse(tokens);
+    ast = parse(&scanner);
     ck_assert_int_eq(AST_TRANSLATION_UNIT, ast->type);
 
     /*
      * parse simple struct
      */
-    list_init(&tokens);
     content = "struct identifier"
               "{"
               "    int identifier;"
               "    char identifier;"
               "};";
-    scan(content, strlen(content), &tokens);
+    scanner_init(&scanner, content, strlen(content));
 
-    ast = parse(tokens);
+    ast = parse(&scanner);
     ck_assert_int_eq(AST_TRANSLATION_UNIT, ast->type);
 }
 END_TEST
@@ -573,29 +646,27 @@ END_TEST
 START_TEST(test_parser_can_parse_arrays)
 {
     struct astnode *ast;
-    struct listnode *tokens;
+    struct scanner scanner;
     char *content;
-    list_init(&tokens);
 
     /*
      * parse basic array
      */
     content = "int an_array[42];"
               "int another_array[size * 2];";
-    scan(content, strlen(content), &tokens);
+    scanner_init(&scanner, content, strlen(content));
 
-    ast = parse(tokens);
+    ast = parse(&scanner);
     ck_assert_int_eq(AST_TRANSLATION_UNIT, ast->type);
 
     /*
      * parse multi-dimensional array
      */
-    list_init(&tokens);
     content = "int a_multi_dimensional_array[42][2];"
               "int another_multi_dimensional_array[size*2][size*2];";
-    scan(content, strlen(content), &tokens);
+    scanner_init(&scanner, content, strlen(content));
 
-    ast = parse(tokens);
+    ast = parse(&scanner);
     ck_assert_int_eq(AST_TRANSLATION_UNIT, ast->type);
 }
 END_TEST
@@ -603,9 +674,8 @@ END_TEST
 START_TEST(test_parser_can_parse_arithmatic_statements)
 {
     struct astnode *ast;
-    struct listnode *tokens;
+    struct scanner scanner;
     char *content;
-    list_init(&tokens);
 
     /*
      * parse expressions
@@ -615,9 +685,9 @@ START_TEST(test_parser_can_parse_arithmatic_statements)
               "    int a;"
               "    a = b + c * d;"
               "}";
-    scan(content, strlen(content), &tokens);
+    scanner_init(&scanner, content, strlen(content));
 
-    ast = parse(tokens);
+    ast = parse(&scanner);
     ck_assert_int_eq(AST_TRANSLATION_UNIT, ast->type);
 }
 END_TEST
@@ -625,9 +695,8 @@ END_TEST
 START_TEST(test_parser_can_parse_conditional_statements)
 {
     struct astnode *ast;
-    struct listnode *tokens;
+    struct scanner scanner;
     char *content;
-    list_init(&tokens);
 
     /*
      * parse expressions
@@ -662,15 +731,14 @@ START_TEST(test_parser_can_parse_conditional_statements)
               "        }"
               "    }"
               "}";
-    scan(content, strlen(content), &tokens);
+    scanner_init(&scanner, content, strlen(content));
 
-    ast = parse(tokens);
+    ast = parse(&scanner);
     ck_assert_int_eq(AST_TRANSLATION_UNIT, ast->type);
 
     /*
      * switch case statements
      */
-    list_init(&tokens);
     content = "char function()"
               "{"
               "    /* switch case statement */"
@@ -683,9 +751,9 @@ START_TEST(test_parser_can_parse_conditional_statements)
               "        }"
               "    }"
               "}";
-    scan(content, strlen(content), &tokens);
+    scanner_init(&scanner, content, strlen(content));
 
-    ast = parse(tokens);
+    ast = parse(&scanner);
     ck_assert_int_eq(AST_TRANSLATION_UNIT, ast->type);
 }
 END_TEST
@@ -693,9 +761,8 @@ END_TEST
 START_TEST(test_parser_can_parse_assigment_operations)
 {
     struct astnode *ast;
-    struct listnode *tokens;
+    struct scanner scanner;
     char *content;
-    list_init(&tokens);
 
     /*
      * assigment operations
@@ -709,9 +776,9 @@ START_TEST(test_parser_can_parse_assigment_operations)
               "    a /= b;"
               "    a %= b;"
               "}";
-    scan(content, strlen(content), &tokens);
+    scanner_init(&scanner, content, strlen(content));
 
-    ast = parse(tokens);
+    ast = parse(&scanner);
     ck_assert_int_eq(AST_TRANSLATION_UNIT, ast->type);
 }
 END_TEST
@@ -745,221 +812,908 @@ START_TEST(test_list_item)
 }
 END_TEST
 
+START_TEST(test_arena_alloc)
+{
+    struct arena arena;
+    long *a, *b;
+    char *large;
+
+    arena_init(&arena);
+
+    a = arena_alloc(&arena, 3);
+    b = arena_alloc(&arena, sizeof(long));
+    ck_assert_ptr_ne(a, b);
+    ck_assert_int_eq(0, (long)b % sizeof(long));
+    ck_assert_int_eq(0, *b);
+
+    /*
+     * Allocations larger than a block get a block of their own.
+     */
+    large = arena_alloc(&arena, ARENA_BLOCK_SIZE * 2);
+    ck_assert_int_eq(0, large[ARENA_BLOCK_SIZE * 2 - 1]);
+
+    arena_free(&arena);
+    ck_assert_ptr_eq(NULL, arena.blocks);
+}
+END_TEST
+
+START_TEST(test_intern_returns_one_id_per_string)
+{
+    int a = intern("name", 4);
+
+    ck_assert_int_eq(a, intern("names", 4));
+    ck_assert_int_ne(a, intern("names", 5));
+    ck_assert_int_ne(a, intern("nam", 3));
+    ck_assert_str_eq("name", interned_string(a));
+}
+END_TEST
+
+START_TEST(test_scanner_interns_identifier_names)
+{
+    char *content = "count = count + counter;";
+    struct tokens tokens;
+
+    scan(content, strlen(content), &tokens);
+
+    ck_assert_int_eq(tokens.values[0], tokens.values[2]);
+    ck_assert_int_ne(tokens.values[0], tokens.values[4]);
+    ck_assert_int_eq(-1, tokens.values[1]);
+    ck_assert_ptr_eq(token_name(&tokens, 0), token_name(&tokens, 2));
+    ck_assert_str_eq("counter", token_name(&tokens, 4));
+    tokens_free(&tokens);
+}
+END_TEST
+
+START_TEST(test_token_to_astnode)
+{
+    struct tokens tokens;
+    struct astnode *node;
+    int token;
+
+    tokens_init(&tokens);
+    tokens_add_source(&tokens, "<", 1);
+    token = tokens_append(&tokens, TOK_LESSTHAN, 0, 1, -1);
+    node = token_to_astnode(&tokens, token);
+    ck_assert_int_eq(AST_LT, node->type);
+    ck_assert_ptr_eq(&tokens, node->tokens);
+    ck_assert_int_eq(token, node->token);
+    ck_assert_int_eq(0, node->elided_type);
+
+    token = tokens_append(&tokens, TOK_EOF, 1, 0, -1);
+    ck_assert_int_eq(AST_INVALID, token_to_astnode(&tokens, token)->type);
+    tokens_free(&tokens);
+}
+END_TEST
+
+START_TEST(test_scan_fills_token_buffer)
+{
+    char content[4 * INITIAL_TOKENS_SIZE + 1];
+    struct tokens tokens;
+    int i;
+
+    /*
+     * Enough tokens to grow the buffer, each recording where it was scanned.
+     */
+    for (i = 0; i < INITIAL_TOKENS_SIZE * 2; i++)
+    {
+        memcpy(&content[i * 2], i % 2 ? "x " : "; ", 2);
+    }
+    content[INITIAL_TOKENS_SIZE * 4] = '\0';
+
+    scan(content, strlen(content), &tokens);
+
+    ck_assert_int_eq(INITIAL_TOKENS_SIZE * 2 + 1, tokens.count);
+    ck_assert_int_eq(TOK_SEMICOLON, tokens.types[0]);
+    ck_assert_int_eq(TOK_IDENTIFIER, tokens.types[1999]);
+    ck_assert_int_eq(1999 * 2, tokens.offsets[1999]);
+    ck_assert_int_eq(1, tokens.lengths[1999]);
+    ck_assert_str_eq("x", token_copy(&tokens, 1999));
+    ck_assert_int_eq(TOK_EOF, tokens.types[tokens.count - 1]);
+    tokens_free(&tokens);
+}
+END_TEST
+
+START_TEST(test_tokens_refer_to_scanned_content)
+{
+    char *content = "name = \"str\";";
+    struct tokens tokens;
+
+    scan(content, strlen(content), &tokens);
+
+    /*
+     * Token text is a view of content, leaving out the quotes of strings.
+     */
+    ck_assert_ptr_eq(content, token_text(&tokens, 0));
+    ck_assert_int_eq(4, tokens.lengths[0]);
+    ck_assert_ptr_eq(content + 8, token_text(&tokens, 2));
+    ck_assert_int_eq(3, tokens.lengths[2]);
+    ck_assert_str_eq("str", token_copy(&tokens, 2));
+    tokens_free(&tokens);
+}
+END_TEST
+
 START_TEST(test_scanner_can_parse_integer_token)
 {
     char *content = "1234";
-    struct listnode *tokens;
-    list_init(&tokens);
+    struct tokens tokens;
 
     scan(content, strlen(content), &tokens);
 
-    ck_assert_int_eq(TOK_INTEGER, ((struct token *)tokens->data)->type);
-    ck_assert_str_eq("1234", ((struct token *)tokens->data)->value);
+    ck_assert_int_eq(TOK_INTEGER, tokens.types[0]);
+    ck_assert_str_eq("1234", token_copy(&tokens, 0));
+}
+END_TEST
+
+START_TEST(test_next_token_returns_one_token_at_a_time)
+{
+    char *content = "count /* comment */ += 1";
+    struct scanner scanner;
+
+    scanner_init(&scanner, content, strlen(content));
+
+    ck_assert_int_eq(TOK_IDENTIFIER, next_token_type(&scanner));
+    ck_assert_int_eq(TOK_PLUS_EQUAL, next_token_type(&scanner));
+    ck_assert_int_eq(TOK_INTEGER, next_token_type(&scanner));
+
+    /*
+     * The end of the buffer keeps returning TOK_EOF.
+     */
+    ck_assert_int_eq(TOK_EOF, next_token_type(&scanner));
+    ck_assert_int_eq(TOK_EOF, next_token_type(&scanner));
+}
+END_TEST
+
+START_TEST(test_scanner_decodes_integer_constants)
+{
+    char *content = "42 0x1F 017 4000000000 0xFFFFFFFF 7u 7l 7ULL 0x";
+    struct tokens tokens;
+
+    scan(content, strlen(content), &tokens);
+
+    ck_assert_int_eq(42, token_constant(&tokens, 0)->value);
+    ck_assert_int_eq(CONSTANT_INT, token_constant(&tokens, 0)->type);
+    ck_assert_int_eq(31, token_constant(&tokens, 1)->value);
+    ck_assert_int_eq(15, token_constant(&tokens, 2)->value);
+
+    /*
+     * Too big for int: a decimal constant becomes long, a hex one unsigned.
+     */
+    ck_assert_int_eq(4000000000LL, token_constant(&tokens, 3)->value);
+    ck_assert_int_eq(CONSTANT_LONG, token_constant(&tokens, 3)->type);
+    ck_assert_int_eq(CONSTANT_UNSIGNED_INT, token_constant(&tokens, 4)->type);
+
+    ck_assert_int_eq(CONSTANT_UNSIGNED_INT, token_constant(&tokens, 5)->type);
+    ck_assert_int_eq(CONSTANT_LONG, token_constant(&tokens, 6)->type);
+    ck_assert_int_eq(CONSTANT_UNSIGNED_LONG, token_constant(&tokens, 7)->type);
+    ck_assert_int_eq(7, token_constant(&tokens, 7)->value);
+
+    /*
+     * 0x without digits backs up to 0 and an identifier.
+     */
+    ck_assert_int_eq(TOK_INTEGER, tokens.types[8]);
+    ck_assert_int_eq(TOK_IDENTIFIER, tokens.types[9]);
+    tokens_free(&tokens);
+
+    /*
+     * Letters past f are not hex digits, nor are 8 and 9 octal ones.
+     */
+    content = "0x1g 0xzz 09 0778";
+    scan(content, strlen(content), &tokens);
+
+    ck_assert_int_eq(1, token_constant(&tokens, 0)->value);
+    ck_assert_int_eq(TOK_IDENTIFIER, tokens.types[1]);
+    ck_assert_int_eq(TOK_INTEGER, tokens.types[2]);
+    ck_assert_int_eq(0, token_constant(&tokens, 2)->value);
+    ck_assert_int_eq(TOK_IDENTIFIER, tokens.types[3]);
+    ck_assert_int_eq(0, token_constant(&tokens, 4)->value);
+    ck_assert_int_eq(9, token_constant(&tokens, 5)->value);
+    ck_assert_int_eq(TOK_INTEGER, tokens.types[5]);
+    ck_assert_int_eq(63, token_constant(&tokens, 6)->value);
+    ck_assert_int_eq(8, token_constant(&tokens, 7)->value);
+    ck_assert_int_eq(TOK_EOF, tokens.types[8]);
+    tokens_free(&tokens);
+}
+END_TEST
+
+START_TEST(test_scanner_decodes_character_constants)
+{
+    char *content = "'a' '\\n' '\\0' '\\x41' '\\101' '\\'' '\\\\' 'ab'";
+    struct tokens tokens;
+
+    scan(content, strlen(content), &tokens);
+
+    ck_assert_int_eq(TOK_CHARACTER, tokens.types[0]);
+    ck_assert_int_eq('a', token_constant(&tokens, 0)->value);
+    ck_assert_int_eq(CONSTANT_INT, token_constant(&tokens, 0)->type);
+    ck_assert_int_eq('\n', token_constant(&tokens, 1)->value);
+    ck_assert_int_eq(0, token_constant(&tokens, 2)->value);
+    ck_assert_int_eq('A', token_constant(&tokens, 3)->value);
+    ck_assert_int_eq('A', token_constant(&tokens, 4)->value);
+    ck_assert_int_eq('\'', token_constant(&tokens, 5)->value);
+    ck_assert_int_eq('\\', token_constant(&tokens, 6)->value);
+
+    /*
+     * Only one character fits between the quotes.
+     */
+    ck_assert_int_eq(TOK_SINGLEQUOTE, tokens.types[7]);
+    ck_assert_int_eq(TOK_IDENTIFIER, tokens.types[8]);
+    ck_assert_int_eq(TOK_SINGLEQUOTE, tokens.types[9]);
+    tokens_free(&tokens);
 }
 END_TEST
 
 START_TEST(test_scanner_can_parse_string_token)
 {
     char *content = "abcd";
-    struct listnode *tokens;
-    list_init(&tokens);
+    struct tokens tokens;
 
     scan(content, strlen(content), &tokens);
 
-    ck_assert_int_eq(TOK_IDENTIFIER, ((struct token *)tokens->data)->type);
-    ck_assert_str_eq("abcd", ((struct token *)tokens->data)->value);
+    ck_assert_int_eq(TOK_IDENTIFIER, tokens.types[0]);
+    ck_assert_str_eq("abcd", token_copy(&tokens, 0));
 }
 END_TEST
 
 START_TEST(test_scanner_can_parse_literal_string_token)
 {
     char *content = "\"abcd\"";
-    struct listnode *tokens;
-    list_init(&tokens);
+    struct tokens tokens;
 
     scan(content, strlen(content), &tokens);
 
-    ck_assert_int_eq(TOK_STRING, ((struct token *)tokens->data)->type);
-    ck_assert_str_eq("abcd", ((struct token *)tokens->data)->value);
+    ck_assert_int_eq(TOK_STRING, tokens.types[0]);
+    ck_assert_str_eq("abcd", token_copy(&tokens, 0));
 }
 END_TEST
 
 START_TEST(test_scanner_can_parse_string_token_with_integers)
 {
     char *content = "abc123";
-    struct listnode *tokens;
-    list_init(&tokens);
+    struct tokens tokens;
 
     scan(content, strlen(content), &tokens);
 
-    ck_assert_int_eq(TOK_IDENTIFIER, ((struct token *)tokens->data)->type);
-    ck_assert_str_eq("abc123", ((struct token *)tokens->data)->value);
+    ck_assert_int_eq(TOK_IDENTIFIER, tokens.types[0]);
+    ck_assert_str_eq("abc123", token_copy(&tokens, 0));
 }
 END_TEST
 
 START_TEST(test_scanner_can_parse_paren)
 {
     char *content = "()";
-    struct listnode *tokens;
-    list_init(&tokens);
+    struct tokens tokens;
 
     scan(content, strlen(content), &tokens);
 
-    ck_assert_int_eq(TOK_LPAREN, ((struct token *)tokens->data)->type);
-    ck_assert_int_eq(TOK_RPAREN, ((struct token *)tokens->next->data)->type);
+    ck_assert_int_eq(TOK_LPAREN, tokens.types[0]);
+    ck_assert_int_eq(TOK_RPAREN, tokens.types[1]);
 }
 END_TEST
 
 START_TEST(test_scanner_can_parse_two_braces)
 {
     char *content = "{}";
-    struct listnode *tokens;
-    list_init(&tokens);
+    struct tokens tokens;
 
     scan(content, strlen(content), &tokens);
 
-    ck_assert_int_eq(TOK_LBRACE, ((struct token *)tokens->data)->type);
-    ck_assert_int_eq(TOK_RBRACE, ((struct token *)tokens->next->data)->type);
+    ck_assert_int_eq(TOK_LBRACE, tokens.types[0]);
+    ck_assert_int_eq(TOK_RBRACE, tokens.types[1]);
 }
 END_TEST
 
 START_TEST(test_scanner_can_parse_two_brackets)
 {
     char *content = "[]";
-    struct listnode *tokens;
-    list_init(&tokens);
+    struct tokens tokens;
 
     scan(content, strlen(content), &tokens);
 
-    ck_assert_int_eq(TOK_LBRACKET, ((struct token *)tokens->data)->type);
-    ck_assert_int_eq(TOK_RBRACKET, ((struct token *)tokens->next->data)->type);
+    ck_assert_int_eq(TOK_LBRACKET, tokens.types[0]);
+    ck_assert_int_eq(TOK_RBRACKET, tokens.types[1]);
 }
 END_TEST
 
 START_TEST(test_scanner_can_parse_special_characters)
 {
     char *content = ";=+*&'/%<>^|?:.";
-    struct listnode *tokens;
-    list_init(&tokens);
+    struct tokens tokens;
 
     scan(content, strlen(content), &tokens);
 
-    ck_assert_int_eq(TOK_SEMICOLON, ((struct token *)tokens->data)->type);
-    ck_assert_int_eq(TOK_EQUAL, ((struct token *)tokens->next->data)->type);
-    ck_assert_int_eq(TOK_PLUS, ((struct token *)tokens->next->next->data)->type);
-    ck_assert_int_eq(TOK_ASTERISK, ((struct token *)tokens->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_AMPERSAND, ((struct token *)tokens->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_SINGLEQUOTE, ((struct token *)tokens->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_BACKSLASH, ((struct token *)tokens->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_MOD, ((struct token *)tokens->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_LESSTHAN, ((struct token *)tokens->next->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_GREATERTHAN, ((struct token *)tokens->next->next->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_CARET, ((struct token *)tokens->next->next->next->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_VERTICALBAR, ((struct token *)tokens->next->next->next->next->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_QUESTIONMARK, ((struct token *)tokens->next->next->next->next->next->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_COLON, ((struct token *)tokens->next->next->next->next->next->next->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_DOT, ((struct token *)tokens->next->next->next->next->next->next->next->next->next->next->next->next->next->next->data)->type);
+    ck_assert_int_eq(TOK_SEMICOLON, tokens.types[0]);
+    ck_assert_int_eq(TOK_EQUAL, tokens.types[1]);
+    ck_assert_int_eq(TOK_PLUS, tokens.types[2]);
+    ck_assert_int_eq(TOK_ASTERISK, tokens.types[3]);
+    ck_assert_int_eq(TOK_AMPERSAND, tokens.types[4]);
+    ck_assert_int_eq(TOK_SINGLEQUOTE, tokens.types[5]);
+    ck_assert_int_eq(TOK_BACKSLASH, tokens.types[6]);
+    ck_assert_int_eq(TOK_MOD, tokens.types[7]);
+    ck_assert_int_eq(TOK_LESSTHAN, tokens.types[8]);
+    ck_assert_int_eq(TOK_GREATERTHAN, tokens.types[9]);
+    ck_assert_int_eq(TOK_CARET, tokens.types[10]);
+    ck_assert_int_eq(TOK_VERTICALBAR, tokens.types[11]);
+    ck_assert_int_eq(TOK_QUESTIONMARK, tokens.types[12]);
+    ck_assert_int_eq(TOK_COLON, tokens.types[13]);
+    ck_assert_int_eq(TOK_DOT, tokens.types[14]);
 }
 END_TEST
 
 START_TEST(test_scanner_can_parse_combination_tokens)
 {
     char *content = "+++=---=->>><<<=>===!=&&||...";
-    struct listnode *tokens;
-    list_init(&tokens);
+    struct tokens tokens;
 
     scan(content, strlen(content), &tokens);
 
-    ck_assert_int_eq(TOK_PLUS_PLUS, ((struct token *)tokens->data)->type);
-    ck_assert_int_eq(TOK_PLUS_EQUAL, ((struct token *)tokens->next->data)->type);
-    ck_assert_int_eq(TOK_MINUS_MINUS, ((struct token *)tokens->next->next->data)->type);
-    ck_assert_int_eq(TOK_MINUS_EQUAL, ((struct token *)tokens->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_ARROW, ((struct token *)tokens->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_SHIFTRIGHT, ((struct token *)tokens->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_SHIFTLEFT, ((struct token *)tokens->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_LESSTHANEQUAL, ((struct token *)tokens->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_GREATERTHANEQUAL, ((struct token *)tokens->next->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_EQ, ((struct token *)tokens->next->next->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_NEQ, ((struct token *)tokens->next->next->next->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_AMPERSAND_AMPERSAND, ((struct token *)tokens->next->next->next->next->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_VERTICALBAR_VERTICALBAR, ((struct token *)tokens->next->next->next->next->next->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_ELLIPSIS, ((struct token *)tokens->next->next->next->next->next->next->next->next->next->next->next->next->next->data)->type);
+    ck_assert_int_eq(TOK_PLUS_PLUS, tokens.types[0]);
+    ck_assert_int_eq(TOK_PLUS_EQUAL, tokens.types[1]);
+    ck_assert_int_eq(TOK_MINUS_MINUS, tokens.types[2]);
+    ck_assert_int_eq(TOK_MINUS_EQUAL, tokens.types[3]);
+    ck_assert_int_eq(TOK_ARROW, tokens.types[4]);
+    ck_assert_int_eq(TOK_SHIFTRIGHT, tokens.types[5]);
+    ck_assert_int_eq(TOK_SHIFTLEFT, tokens.types[6]);
+    ck_assert_int_eq(TOK_LESSTHANEQUAL, tokens.types[7]);
+    ck_assert_int_eq(TOK_GREATERTHANEQUAL, tokens.types[8]);
+    ck_assert_int_eq(TOK_EQ, tokens.types[9]);
+    ck_assert_int_eq(TOK_NEQ, tokens.types[10]);
+    ck_assert_int_eq(TOK_AMPERSAND_AMPERSAND, tokens.types[11]);
+    ck_assert_int_eq(TOK_VERTICALBAR_VERTICALBAR, tokens.types[12]);
+    ck_assert_int_eq(TOK_ELLIPSIS, tokens.types[13]);
 }
 END_TEST
 
 START_TEST(test_scanner_ignores_comment_contents)
 {
     char *content = "123/*456*/789";
-    struct listnode *tokens;
-    list_init(&tokens);
+    struct tokens tokens;
 
     scan(content, strlen(content), &tokens);
 
-    ck_assert_int_eq(TOK_INTEGER, ((struct token *)tokens->data)->type);
-    ck_assert_str_eq("123", ((struct token *)tokens->data)->value);
-    ck_assert_str_eq("789", ((struct token *)tokens->next->data)->value);
+    ck_assert_int_eq(TOK_INTEGER, tokens.types[0]);
+    ck_assert_str_eq("123", token_copy(&tokens, 0));
+    ck_assert_str_eq("789", token_copy(&tokens, 1));
 }
 END_TEST
 
 START_TEST(test_scanner_ignores_comment_contents_around_strings)
 {
     char *content = "abc/*def*/ghi";
-    struct listnode *tokens;
-    list_init(&tokens);
+    struct tokens tokens;
 
     scan(content, strlen(content), &tokens);
 
-    ck_assert_int_eq(TOK_IDENTIFIER, ((struct token *)tokens->data)->type);
-    ck_assert_str_eq("abc", ((struct token *)tokens->data)->value);
-    ck_assert_str_eq("ghi", ((struct token *)tokens->next->data)->value);
+    ck_assert_int_eq(TOK_IDENTIFIER, tokens.types[0]);
+    ck_assert_str_eq("abc", token_copy(&tokens, 0));
+    ck_assert_str_eq("ghi", token_copy(&tokens, 1));
 }
 END_TEST
 
 START_TEST(test_scanner_ignores_comment_contents_that_contant_asterisks)
 {
     char *content = "abc/*d*e*f*/ghi";
-    struct listnode *tokens;
-    list_init(&tokens);
+    struct tokens tokens;
 
     scan(content, strlen(content), &tokens);
 
-    ck_assert_int_eq(TOK_IDENTIFIER, ((struct token *)tokens->data)->type);
-    ck_assert_str_eq("abc", ((struct token *)tokens->data)->value);
-    ck_assert_str_eq("ghi", ((struct token *)tokens->next->data)->value);
+    ck_assert_int_eq(TOK_IDENTIFIER, tokens.types[0]);
+    ck_assert_str_eq("abc", token_copy(&tokens, 0));
+    ck_assert_str_eq("ghi", token_copy(&tokens, 1));
 }
 END_TEST
 
 START_TEST(test_scanner_can_parse_reserved_words)
 {
     char *content = "int char goto  continue break  return if else switch case default enum struct union const volatile void short long float double signed unsigned";
-    struct listnode *tokens;
-    list_init(&tokens);
+    struct tokens tokens;
 
     scan(content, strlen(content), &tokens);
 
-    ck_assert_int_eq(TOK_INT, ((struct token *)tokens->data)->type);
-    ck_assert_int_eq(TOK_CHAR, ((struct token *)tokens->next->data)->type);
-    ck_assert_int_eq(TOK_GOTO, ((struct token *)tokens->next->next->data)->type);
-    ck_assert_int_eq(TOK_CONTINUE, ((struct token *)tokens->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_BREAK, ((struct token *)tokens->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_RETURN, ((struct token *)tokens->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_IF, ((struct token *)tokens->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_ELSE, ((struct token *)tokens->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_SWITCH, ((struct token *)tokens->next->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_CASE, ((struct token *)tokens->next->next->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_DEFAULT, ((struct token *)tokens->next->next->next->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_ENUM, ((struct token *)tokens->next->next->next->next->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_STRUCT, ((struct token *)tokens->next->next->next->next->next->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_UNION, ((struct token *)tokens->next->next->next->next->next->next->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_CONST, ((struct token *)tokens->next->next->next->next->next->next->next->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_VOLATILE, ((struct token *)tokens->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_VOID, ((struct token *)tokens->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_SHORT, ((struct token *)tokens->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_LONG, ((struct token *)tokens->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_FLOAT, ((struct token *)tokens->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_DOUBLE, ((struct token *)tokens->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_SIGNED, ((struct token *)tokens->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->data)->type);
-    ck_assert_int_eq(TOK_UNSIGNED, ((struct token *)tokens->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->next->data)->type);
+    ck_assert_int_eq(TOK_INT, tokens.types[0]);
+    ck_assert_int_eq(TOK_CHAR, tokens.types[1]);
+    ck_assert_int_eq(TOK_GOTO, tokens.types[2]);
+    ck_assert_int_eq(TOK_CONTINUE, tokens.types[3]);
+    ck_assert_int_eq(TOK_BREAK, tokens.types[4]);
+    ck_assert_int_eq(TOK_RETURN, tokens.types[5]);
+    ck_assert_int_eq(TOK_IF, tokens.types[6]);
+    ck_assert_int_eq(TOK_ELSE, tokens.types[7]);
+    ck_assert_int_eq(TOK_SWITCH, tokens.types[8]);
+    ck_assert_int_eq(TOK_CASE, tokens.types[9]);
+    ck_assert_int_eq(TOK_DEFAULT, tokens.types[10]);
+    ck_assert_int_eq(TOK_ENUM, tokens.types[11]);
+    ck_assert_int_eq(TOK_STRUCT, tokens.types[12]);
+    ck_assert_int_eq(TOK_UNION, tokens.types[13]);
+    ck_assert_int_eq(TOK_CONST, tokens.types[14]);
+    ck_assert_int_eq(TOK_VOLATILE, tokens.types[15]);
+    ck_assert_int_eq(TOK_VOID, tokens.types[16]);
+    ck_assert_int_eq(TOK_SHORT, tokens.types[17]);
+    ck_assert_int_eq(TOK_LONG, tokens.types[18]);
+    ck_assert_int_eq(TOK_FLOAT, tokens.types[19]);
+    ck_assert_int_eq(TOK_DOUBLE, tokens.types[20]);
+    ck_assert_int_eq(TOK_SIGNED, tokens.types[21]);
+    ck_assert_int_eq(TOK_UNSIGNED, tokens.types[22]);
+}
+END_TEST
+
+START_TEST(test_scanner_can_parse_storage_and_loop_reserved_words)
+{
+    char *content = "for do while auto register static extern typedef";
+    struct scanner scanner;
+
+    scanner_init(&scanner, content, strlen(content));
+
+    ck_assert_int_eq(TOK_FOR, next_token_type(&scanner));
+    ck_assert_int_eq(TOK_DO, next_token_type(&scanner));
+    ck_assert_int_eq(TOK_WHILE, next_token_type(&scanner));
+    ck_assert_int_eq(TOK_AUTO, next_token_type(&scanner));
+    ck_assert_int_eq(TOK_REGISTER, next_token_type(&scanner));
+    ck_assert_int_eq(TOK_STATIC, next_token_type(&scanner));
+    ck_assert_int_eq(TOK_EXTERN, next_token_type(&scanner));
+    ck_assert_int_eq(TOK_TYPEDEF, next_token_type(&scanner));
+}
+END_TEST
+
+START_TEST(test_scanner_does_not_match_words_close_to_reserved_words)
+{
+    char *content = "i in ints Int dent doe whiles volatiles x_for unsigneds";
+    struct scanner scanner;
+    enum token_t type;
+
+    scanner_init(&scanner, content, strlen(content));
+
+    /*
+     * Each of these shares a length, first or last character with a reserved
+     * word but is an identifier.
+     */
+    for (type = next_token_type(&scanner);
+         type != TOK_EOF;
+         type = next_token_type(&scanner))
+    {
+        ck_assert_int_eq(TOK_IDENTIFIER, type);
+    }
+}
+END_TEST
+
+START_TEST(test_scanner_takes_longest_match)
+{
+    char *content = "a..b...c>>=d /*/ x */ 12ab";
+    enum token_t expected[] = {
+        TOK_IDENTIFIER, TOK_DOT, TOK_DOT, TOK_IDENTIFIER, TOK_ELLIPSIS,
+        TOK_IDENTIFIER, TOK_SHIFTRIGHT, TOK_EQUAL, TOK_IDENTIFIER,
+        TOK_INTEGER, TOK_IDENTIFIER, TOK_EOF
+    };
+    struct scanner scanner;
+    int i;
+
+    scanner_init(&scanner, content, strlen(content));
+
+    /*
+     * ".." backs up to a single dot since it is not a token, and the comment
+     * is not closed by the "/" that opened it.
+     */
+    for (i = 0; i < sizeof(expected) / sizeof(expected[0]); i++)
+    {
+        ck_assert_int_eq(expected[i], next_token_type(&scanner));
+    }
+}
+END_TEST
+
+START_TEST(test_scanner_skips_unterminated_comment)
+{
+    char *content = "x /* y";
+    struct scanner scanner;
+
+    scanner_init(&scanner, content, strlen(content));
+
+    ck_assert_int_eq(TOK_IDENTIFIER, next_token_type(&scanner));
+    ck_assert_int_eq(TOK_EOF, next_token_type(&scanner));
+}
+END_TEST
+
+START_TEST(test_scanner_keeps_stray_characters)
+{
+    char *content = "x @ ~ \\ y\\\nz";
+    struct tokens tokens;
+
+    scan(content, strlen(content), &tokens);
+
+    ck_assert_int_eq(TOK_IDENTIFIER, tokens.types[0]);
+    ck_assert_int_eq(TOK_OTHER, tokens.types[1]);
+    ck_assert_int_eq(TOK_TILDE, tokens.types[2]);
+    ck_assert_int_eq(TOK_OTHER, tokens.types[3]);
+    ck_assert_int_eq(TOK_IDENTIFIER, tokens.types[4]);
+    ck_assert_int_eq(TOK_IDENTIFIER, tokens.types[5]);
+    ck_assert_int_eq(TOK_EOF, tokens.types[6]);
+    tokens_free(&tokens);
+}
+END_TEST
+
+START_TEST(test_scanner_simd_runs_match_scalar)
+{
+    char *content =
+        "/* a comment that is longer than one block ** with * stars */ "
+        "a_long_identifier_name_that_spans_blocks_0123456789 "
+        "\"a string that is also longer than one thirty two byte block\""
+        "                                                  x/**/y*/";
+    struct tokens expected, tokens;
+    int i, level;
+
+    scanner_use_simd(SCANNER_SCALAR);
+    scan(content, strlen(content), &expected);
+    ck_assert_int_eq(7, expected.count);
+
+    for (level = SCANNER_SSE2; level <= SCANNER_AVX2; level++)
+    {
+        scanner_use_simd(level);
+        scan(content, strlen(content), &tokens);
+        ck_assert_int_eq(expected.count, tokens.count);
+        for (i = 0; i < expected.count; i++)
+        {
+            ck_assert_int_eq(expected.types[i], tokens.types[i]);
+            ck_assert_int_eq(expected.offsets[i], tokens.offsets[i]);
+            ck_assert_int_eq(expected.lengths[i], tokens.lengths[i]);
+        }
+        tokens_free(&tokens);
+    }
+    tokens_free(&expected);
+    scanner_use_simd(SCANNER_AVX2);
+}
+END_TEST
+
+
+/*
+ * Returns the tokens left after preprocessing content, separated by spaces.
+ */
+static char *
+precompiled_text(char *content, const char *pch_directory)
+{
+    struct scanner scanner;
+    char *text = calloc(strlen(content) * 4 + 1, 1);
+    int token;
+
+    scanner_init(&scanner, content, strlen(content));
+    if (pch_directory != NULL)
+    {
+        scanner_set_pch_directory(&scanner, pch_directory);
+    }
+    while (scanner.tokens.types[token = next_token(&scanner)] != TOK_EOF)
+    {
+        if (scanner.tokens.types[token] == TOK_STRING)
+        {
+            sprintf(&text[strlen(text)], "\"%.*s\" ",
+                    scanner.tokens.lengths[token],
+                    token_text(&scanner.tokens, token));
+        }
+        else
+        {
+            sprintf(&text[strlen(text)], "%.*s ",
+                    scanner.tokens.lengths[token],
+                    token_text(&scanner.tokens, token));
+        }
+    }
+    tokens_free(&scanner.tokens);
+    return text;
+}
+
+static char *
+preprocessed_text(char *content)
+{
+    return precompiled_text(content, NULL);
+}
+
+START_TEST(test_preprocessor_expands_object_like_macros)
+{
+    char *content =
+        "#define N 10\n"
+        "#define EMPTY\n"
+        "  #  define TWICE N + N\n"
+        "int x = TWICE EMPTY;\n"
+        "#define ONE 1 /* a comment\n"
+        "   over lines */ + 1\n"
+        "int y = ONE;\n"
+        "#undef N\n"
+        "N /* c */ # define Z\n"
+        "/* c */ #define TWO 2\n"
+        "/* a comment\n"
+        "   over lines */ # define THREE 3\n"
+        "TWO THREE\n";
+
+    ck_assert_str_eq("int x = 10 + 10 ; int y = 1 + 1 ; N # define Z 2 3 ",
+                     preprocessed_text(content));
+}
+END_TEST
+
+START_TEST(test_preprocessor_expands_function_like_macros)
+{
+    char *content =
+        "#define ADD(a, b) ((a) + \\\n"
+        "                   (b))\n"
+        "#define F (x)\n"
+        "#define V(f, ...) f(__VA_ARGS__)\n"
+        "ADD(1, ADD(2, (3, 4))) ADD F V(g, 1, 2)\n";
+
+    ck_assert_str_eq("( ( 1 ) + ( ( ( 2 ) + ( ( 3 , 4 ) ) ) ) ) "
+                     "ADD ( x ) g ( 1 , 2 ) ",
+                     preprocessed_text(content));
+}
+END_TEST
+
+START_TEST(test_preprocessor_stringizes_and_pastes)
+{
+    char *content =
+        "#define S(x) #x\n"
+        "#define XS(x) S(x)\n"
+        "#define CAT(a, b, c) a ## b ## c\n"
+        "#define N 10\n"
+        "S(a  + \"b\") XS(N) CAT(x, 1, 2) CAT(, y, ) CAT(+, , =)\n";
+
+    ck_assert_str_eq("\"a + \\\"b\\\"\" \"10\" x12 y += ",
+                     preprocessed_text(content));
+}
+END_TEST
+
+START_TEST(test_preprocessor_hides_macros_in_their_expansion)
+{
+    /*
+     * The example of rescanning in C99 6.10.3.5.
+     */
+    char *content =
+        "#define x 3\n"
+        "#define f(a) f(x * (a))\n"
+        "#undef x\n"
+        "#define x 2\n"
+        "#define g f\n"
+        "#define z z[0]\n"
+        "#define t(a) a\n"
+        "f(y+1) + f(f(z)) % t(t(g)(0) + t)(1);\n";
+
+    ck_assert_str_eq("f ( 2 * ( y + 1 ) ) + f ( 2 * ( f ( 2 * ( z [ 0 ] ) "
+                     ") ) ) % f ( 2 * ( 0 ) ) + t ( 1 ) ; ",
+                     preprocessed_text(content));
+}
+END_TEST
+
+START_TEST(test_preprocessor_includes_files)
+{
+    char *content =
+        "#include \"test_clink_include.h\"\n"
+        "int y = INCLUDED;\n";
+    FILE *header = fopen("test_clink_include.h", "w");
+
+    fputs("#define INCLUDED 1\nint x;", header);
+    fclose(header);
+
+    ck_assert_str_eq("int x ; int y = 1 ; ", preprocessed_text(content));
+    remove("test_clink_include.h");
+}
+END_TEST
+
+START_TEST(test_preprocessor_skips_guarded_headers)
+{
+    char *content =
+        "#include \"test_clink_guarded.h\"\n"
+        "#include \"test_clink_guarded.h\"\n"
+        "#include \"test_clink_once.h\"\n"
+        "#include \"test_clink_once.h\"\n";
+    const struct preprocessor_stats *stats = preprocessor_stats();
+    int skipped = stats->includes_skipped;
+    FILE *header = fopen("test_clink_guarded.h", "w");
+
+    fputs("/* guarded */\n#ifndef GUARDED\n#define GUARDED\nint x;\n#endif\n",
+          header);
+    fclose(header);
+    header = fopen("test_clink_once.h", "w");
+    fputs("#pragma once\nint y;\n", header);
+    fclose(header);
+
+    ck_assert_str_eq("int x ; int y ; ", preprocessed_text(content));
+    ck_assert_int_eq(skipped + 2, stats->includes_skipped);
+    remove("test_clink_guarded.h");
+    remove("test_clink_once.h");
+}
+END_TEST
+
+START_TEST(test_preprocessor_selects_conditional_groups)
+{
+    char *content =
+        "#define A\n"
+        "#ifdef A\n"
+        "a\n"
+        "#ifndef A\n"
+        "#ifdef B\n"
+        "#endif\n"
+        "#else\n"
+        "b\n"
+        "#endif\n"
+        "#else\n"
+        "c\n"
+        "#endif\n"
+        "#ifdef B\n"
+        "d\n"
+        "#else\n"
+        "e\n"
+        "#endif\n";
+
+    ck_assert_str_eq("a b e ", preprocessed_text(content));
+}
+END_TEST
+
+START_TEST(test_preprocessor_evaluates_if_expressions)
+{
+    char *content =
+        "#define ONE 1\n"
+        "#define TWICE(x) ((x) * 2)\n"
+        "#if TWICE(ONE) == 2 && defined ONE && !defined(TWO)\n"
+        "a\n"
+        "#endif\n"
+        "#if ONE - 1\n"
+        "#elif 0 && 1 / 0\n"
+        "#elif (ONE ? 3 : 4) << 2 == 12 || NOT_DEFINED\n"
+        "b\n"
+        "#elif 1\n"
+        "#else\n"
+        "#endif\n"
+        "#if -1 < 0 && 'a' == 97 && 0x10 % 3 == 1\n"
+        "c\n"
+        "#endif\n"
+        "#if -1 < 0u || (1 ? -1 : 0u) < 0 || -2 / 2u == -1\n"
+        "#elif -1 < 0xFFFFFFFF && 0xFFFFFFFFFFFFFFFF > 0 && -2 >> 1 == -1\n"
+        "d\n"
+        "#endif\n"
+        "#if ~0 == -1 && ~0u > 0 && ~-1 == 0 && (~0u >> 63) == 1\n"
+        "e\n"
+        "#endif\n";
+
+    ck_assert_str_eq("a b c d e ", preprocessed_text(content));
+}
+END_TEST
+
+START_TEST(test_preprocessor_skips_inactive_groups_by_line)
+{
+    char *content =
+        "#if 0\n"
+        "/* #endif\n"
+        "#endif */ \"/*\" '\"' \\\n"
+        "#endif\n"
+        "  #  if 1\n"
+        "#else\n"
+        "  #  endif\n"
+        "#else\n"
+        "a\n"
+        "#endif\n"
+        "#if 0\n"
+        "// see a/*b, don't\n"
+        "/* c */ #else\n"
+        "b\n"
+        "/* c */ #endif\n"
+        "c\n";
+
+    ck_assert_str_eq("a b c ", preprocessed_text(content));
+}
+END_TEST
+
+START_TEST(test_preprocessor_lists_dependencies)
+{
+    char *content =
+        "#include \"test_clink_outer.h\"\n"
+        "#include \"test_clink_outer.h\"\n";
+    struct scanner scanner;
+    FILE *header = fopen("test_clink_outer.h", "w");
+
+    fputs("#ifndef OUTER\n#define OUTER\n#include \"test_clink_inner.h\"\n"
+          "#endif\n", header);
+    fclose(header);
+    header = fopen("test_clink_inner.h", "w");
+    fputs("int inner;\n", header);
+    fclose(header);
+
+    scanner_init(&scanner, content, strlen(content));
+    while (next_token_type(&scanner) != TOK_EOF)
+    {
+    }
+    ck_assert_str_eq("test_clink_outer.h", list_item(&scanner.dependencies, 0));
+    ck_assert_str_eq("test_clink_inner.h", list_item(&scanner.dependencies, 1));
+    ck_assert_ptr_eq(NULL, scanner.dependencies->next->next);
+    remove("test_clink_outer.h");
+    remove("test_clink_inner.h");
+}
+END_TEST
+
+static void
+remove_pch_directory(const char *name)
+{
+    DIR *directory = opendir(name);
+    struct dirent *entry;
+    char path[300];
+
+    while ((entry = readdir(directory)) != NULL)
+    {
+        sprintf(path, "%.32s/%.256s", name, entry->d_name);
+        remove(path);
+    }
+    closedir(directory);
+    remove(name);
+}
+
+START_TEST(test_preprocessor_loads_precompiled_headers)
+{
+    char *content =
+        "#include \"test_clink_prelude.h\"\n"
+        "char *s = XS(SPACED); int z = MAX(x, 2);\n";
+    char *expected =
+        "int x ; char * s = \"a +b\" ; int z = ( ( x ) > ( 2 ) ? ( x ) : "
+        "( 2 ) ) ; ";
+    const struct preprocessor_stats *stats = preprocessor_stats();
+    int loaded = stats->headers_loaded;
+    FILE *header = fopen("test_clink_prelude.h", "w");
+    struct dirent *entry;
+    struct stat st;
+    char path[300];
+    DIR *directory;
+
+    fputs("#define S(x) #x\n#define XS(x) S(x)\n#define SPACED a   +b\n"
+          "#define MAX(a, b) ((a) > (b) ? (a) : (b))\nint x;\n", header);
+    fclose(header);
+    mkdir("test_clink_pch", 0777);
+
+    ck_assert_str_eq(expected, precompiled_text(content, "test_clink_pch"));
+    ck_assert_int_eq(loaded, stats->headers_loaded);
+    ck_assert_str_eq(expected, precompiled_text(content, "test_clink_pch"));
+    ck_assert_int_eq(loaded + 1, stats->headers_loaded);
+
+    /*
+     * One that is cut short is read again from the header and saved anew.
+     */
+    directory = opendir("test_clink_pch");
+    while ((entry = readdir(directory)) != NULL)
+    {
+        sprintf(path, "test_clink_pch/%.256s", entry->d_name);
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode))
+        {
+            ck_assert_int_eq(0, truncate(path, st.st_size / 2));
+        }
+    }
+    closedir(directory);
+    ck_assert_str_eq(expected, precompiled_text(content, "test_clink_pch"));
+    ck_assert_int_eq(loaded + 1, stats->headers_loaded);
+    ck_assert_str_eq(expected, precompiled_text(content, "test_clink_pch"));
+    ck_assert_int_eq(loaded + 2, stats->headers_loaded);
+
+    remove_pch_directory("test_clink_pch");
+    remove("test_clink_prelude.h");
+}
+END_TEST
+
+START_TEST(test_preprocessor_keeps_pragma_once_in_precompiled_headers)
+{
+    char *content = "#include \"test_clink_pch_outer.h\"\n";
+    const struct preprocessor_stats *stats = preprocessor_stats();
+    int loaded = stats->headers_loaded, saved = stats->headers_saved;
+    FILE *header = fopen("test_clink_pch_once.h", "w");
+
+    fputs("#pragma once\nint x;\n", header);
+    fclose(header);
+    header = fopen("test_clink_pch_outer.h", "w");
+    fputs("#include \"test_clink_pch_once.h\"\nint y;\n", header);
+    fclose(header);
+    mkdir("test_clink_pch_once", 0777);
+
+    /*
+     * Once test_clink_pch_once.h has been read, the outer header skips it, so
+     * the header saved before it was is not loaded and one that skips it is
+     * not saved.
+     */
+    ck_assert_str_eq("int x ; int y ; ",
+                     precompiled_text(content, "test_clink_pch_once"));
+    ck_assert_int_eq(saved + 1, stats->headers_saved);
+    ck_assert_str_eq("int y ; ",
+                     precompiled_text(content, "test_clink_pch_once"));
+    ck_assert_int_eq(loaded, stats->headers_loaded);
+    ck_assert_int_eq(saved + 1, stats->headers_saved);
+
+    remove_pch_directory("test_clink_pch_once");
+    remove("test_clink_pch_once.h");
+    remove("test_clink_pch_outer.h");
 }
 END_TEST
 
@@ -972,21 +1726,28 @@ main(void)
     SRunner *runner = srunner_create(suite);
 
     suite_add_tcase(suite, testcase);
-    tcase_add_test(testcase, test_head_terminal_values_on_constant);
-    tcase_add_test(testcase, test_head_terminal_values_on_primary_expression);
-    tcase_add_test(testcase, test_head_terminal_values_on_postfix_expression);
-    tcase_add_test(testcase, test_head_terminal_values_on_unary_expression);
-    tcase_add_test(testcase, test_head_terminal_values_on_cast_expression);
-    tcase_add_test(testcase, test_head_terminal_values_on_multiplicative_expression);
-    tcase_add_test(testcase, test_head_terminal_values_on_additive_expression);
-    tcase_add_test(testcase, test_head_terminal_values_on_shift_expression);
-    tcase_add_test(testcase, test_head_terminal_values_on_relational_expression);
-    tcase_add_test(testcase, test_head_terminal_values_on_specifier_qualifier_list);
+    tcase_add_test(testcase, test_first_terminals_on_constant);
+    tcase_add_test(testcase, test_first_terminals_on_primary_expression);
+    tcase_add_test(testcase, test_first_terminals_on_postfix_expression);
+    tcase_add_test(testcase, test_first_terminals_on_unary_expression);
+    tcase_add_test(testcase, test_first_terminals_on_cast_expression);
+    tcase_add_test(testcase, test_first_terminals_on_multiplicative_expression);
+    tcase_add_test(testcase, test_first_terminals_on_additive_expression);
+    tcase_add_test(testcase, test_first_terminals_on_shift_expression);
+    tcase_add_test(testcase, test_first_terminals_on_relational_expression);
+    tcase_add_test(testcase, test_first_terminals_on_specifier_qualifier_list);
+    tcase_add_test(testcase, test_first_terminals_excludes_unreachable_terminals);
     tcase_add_test(testcase, test_generate_items_on_constant);
     tcase_add_test(testcase, test_generate_items_on_primary_expression);
     tcase_add_test(testcase, test_generate_items_on_postfix_expression);
     tcase_add_test(testcase, test_generate_items_on_unary_expression);
     tcase_add_test(testcase, test_generate_transitions_increments_cursor_position);
+    tcase_add_test(testcase, test_merge_states_reduces_state_count);
+    tcase_add_test(testcase, test_parse_action_in_start_state);
+    tcase_add_test(testcase, test_parser_keeps_elided_type_of_collapsed_unit_rules);
+#ifdef DIRECT_PARSER
+    tcase_add_test(testcase, test_parse_direct_matches_parse);
+#endif
     tcase_add_test(testcase, test_parser_can_parse_simple_declaration);
     tcase_add_test(testcase, test_parser_can_parse_multiple_simple_declarations);
     tcase_add_test(testcase, test_parser_can_parse_primary_expressions);
@@ -1000,7 +1761,16 @@ main(void)
     tcase_add_test(testcase, test_parser_can_parse_assigment_operations);
     tcase_add_test(testcase, test_list_append);
     tcase_add_test(testcase, test_list_item);
+    tcase_add_test(testcase, test_arena_alloc);
+    tcase_add_test(testcase, test_intern_returns_one_id_per_string);
+    tcase_add_test(testcase, test_scanner_interns_identifier_names);
+    tcase_add_test(testcase, test_token_to_astnode);
     tcase_add_test(testcase, test_scanner_can_parse_integer_token);
+    tcase_add_test(testcase, test_next_token_returns_one_token_at_a_time);
+    tcase_add_test(testcase, test_scan_fills_token_buffer);
+    tcase_add_test(testcase, test_tokens_refer_to_scanned_content);
+    tcase_add_test(testcase, test_scanner_decodes_integer_constants);
+    tcase_add_test(testcase, test_scanner_decodes_character_constants);
     tcase_add_test(testcase, test_scanner_can_parse_string_token);
     tcase_add_test(testcase, test_scanner_can_parse_literal_string_token);
     tcase_add_test(testcase, test_scanner_can_parse_string_token_with_integers);
@@ -1013,6 +1783,24 @@ main(void)
     tcase_add_test(testcase, test_scanner_ignores_comment_contents_around_strings);
     tcase_add_test(testcase, test_scanner_ignores_comment_contents_that_contant_asterisks);
     tcase_add_test(testcase, test_scanner_can_parse_reserved_words);
+    tcase_add_test(testcase, test_scanner_can_parse_storage_and_loop_reserved_words);
+    tcase_add_test(testcase, test_scanner_does_not_match_words_close_to_reserved_words);
+    tcase_add_test(testcase, test_scanner_takes_longest_match);
+    tcase_add_test(testcase, test_scanner_skips_unterminated_comment);
+    tcase_add_test(testcase, test_scanner_keeps_stray_characters);
+    tcase_add_test(testcase, test_scanner_simd_runs_match_scalar);
+    tcase_add_test(testcase, test_preprocessor_expands_object_like_macros);
+    tcase_add_test(testcase, test_preprocessor_expands_function_like_macros);
+    tcase_add_test(testcase, test_preprocessor_stringizes_and_pastes);
+    tcase_add_test(testcase, test_preprocessor_hides_macros_in_their_expansion);
+    tcase_add_test(testcase, test_preprocessor_includes_files);
+    tcase_add_test(testcase, test_preprocessor_skips_guarded_headers);
+    tcase_add_test(testcase, test_preprocessor_selects_conditional_groups);
+    tcase_add_test(testcase, test_preprocessor_evaluates_if_expressions);
+    tcase_add_test(testcase, test_preprocessor_skips_inactive_groups_by_line);
+    tcase_add_test(testcase, test_preprocessor_lists_dependencies);
+    tcase_add_test(testcase, test_preprocessor_loads_precompiled_headers);
+    tcase_add_test(testcase, test_preprocessor_keeps_pragma_once_in_precompiled_headers);
 
     srunner_run_all(runner, CK_ENV);
     return 0;
@@ -1,6 +1,10 @@
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "utilities.h"
 
@@ -63,6 +67,22 @@ list_item(struct listnode **head, int index)
     return t->data;
 }
 
+int
+list_contains(struct listnode *head, void *data)
+{
+    struct listnode *t;
+
+    for (t=head; t!=NULL; t=t->next)
+    {
+        if (t->data == data)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
 int
 list_equal(struct listnode *a, struct listnode *b)
 {
@@ -116,3 +136,241 @@ list_equal(struct listnode *a, struct listnode *b)
 
     return 1;
 }
+
+void
+arena_init(struct arena *arena)
+{
+    arena->blocks = NULL;
+}
+
+void *
+arena_alloc(struct arena *arena, size_t size)
+{
+    struct arena_block *block = arena->blocks;
+    size_t block_size;
+    void *data;
+
+    /*
+     * Keep every allocation aligned for any scalar type.
+     */
+    size = (size + sizeof(long) - 1) & ~(sizeof(long) - 1);
+
+    if (block == NULL || block->used + size > block->size)
+    {
+        block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = calloc(1, sizeof(struct arena_block) + block_size);
+        block->size = block_size;
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+
+    data = block->data + block->used;
+    block->used += size;
+    return data;
+}
+
+void
+arena_free(struct arena *arena)
+{
+    struct arena_block *block, *next;
+
+    for (block=arena->blocks; block!=NULL; block=next)
+    {
+        next = block->next;
+        free(block);
+    }
+    arena->blocks = NULL;
+}
+
+/*
+ * The intern table is open addressed with linear probing. slots hold ids, or
+ * -1 when empty, and the table doubles before it is half full. The text of
+ * every string lives in an arena, since none of it is ever released.
+ */
+static struct arena interned_text;
+static const char **interned_strings;
+static size_t *interned_lengths;
+static unsigned int *interned_hashes;
+static int interned_count;
+static int interned_size;
+static int *intern_slots;
+static unsigned int intern_slots_size;
+
+unsigned int
+hash_bytes(unsigned int hash, const void *data, size_t length)
+{
+    const unsigned char *bytes = data;
+    size_t i;
+
+    /* FNV-1a */
+    for (i=0; i<length; i++)
+    {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void
+grow_intern_slots(void)
+{
+    unsigned int i, slot;
+
+    free(intern_slots);
+    intern_slots_size = intern_slots_size ? intern_slots_size * 2
+                                          : INITIAL_INTERN_SIZE * 2;
+    intern_slots = malloc(sizeof(int) * intern_slots_size);
+    memset(intern_slots, -1, sizeof(int) * intern_slots_size);
+
+    for (i=0; i<interned_count; i++)
+    {
+        slot = interned_hashes[i] & (intern_slots_size - 1);
+        while (intern_slots[slot] != -1)
+        {
+            slot = (slot + 1) & (intern_slots_size - 1);
+        }
+        intern_slots[slot] = i;
+    }
+}
+
+int
+intern(const char *text, size_t length)
+{
+    unsigned int hash, slot;
+    char *copy;
+    int id;
+
+    if (interned_count * 2 >= intern_slots_size)
+    {
+        grow_intern_slots();
+    }
+
+    hash = hash_bytes(HASH_INITIAL, text, length);
+    for (slot = hash & (intern_slots_size - 1);
+         (id = intern_slots[slot]) != -1;
+         slot = (slot + 1) & (intern_slots_size - 1))
+    {
+        if (interned_hashes[id] == hash && interned_lengths[id] == length &&
+            memcmp(interned_strings[id], text, length) == 0)
+        {
+            return id;
+        }
+    }
+
+    if (interned_count == interned_size)
+    {
+        interned_size = interned_size ? interned_size * 2 : INITIAL_INTERN_SIZE;
+        interned_strings = realloc(interned_strings,
+                                   sizeof(char *) * interned_size);
+        interned_lengths = realloc(interned_lengths,
+                                   sizeof(size_t) * interned_size);
+        interned_hashes = realloc(interned_hashes,
+                                  sizeof(unsigned int) * interned_size);
+    }
+
+    /* arena memory is zeroed, so the copy is already terminated */
+    copy = arena_alloc(&interned_text, length + 1);
+    memcpy(copy, text, length);
+
+    id = interned_count++;
+    interned_strings[id] = copy;
+    interned_lengths[id] = length;
+    interned_hashes[id] = hash;
+    intern_slots[slot] = id;
+    return id;
+}
+
+const char *
+interned_string(int id)
+{
+    return interned_strings[id];
+}
+
+char *
+map_file(const char *filename, size_t *length)
+{
+    struct stat st;
+    char *content = NULL;
+    int fd;
+
+    if ((fd = open(filename, O_RDONLY)) < 0)
+    {
+        return NULL;
+    }
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        content = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (content == MAP_FAILED)
+        {
+            content = NULL;
+        }
+        *length = st.st_size;
+    }
+    close(fd);
+    return content;
+}
+
+void
+unmap_file(char *content, size_t length)
+{
+    munmap(content, length);
+}
+
+/*
+ * Returns the contents of a source file. Regular files are mapped read-only, so
+ * the scanner reads straight from the page cache and concurrent compiles of
+ * the same headers share it. Standard input ("-"), pipes and anything else
+ * mmap() refuses are read() into a growing buffer instead. Returns NULL if the
+ * file cannot be opened and exits on other errors.
+ */
+char *
+read_source(const char *filename, size_t *length)
+{
+    struct stat st;
+    size_t size;
+    ssize_t count;
+    char *buffer;
+    int fd;
+
+    if (strcmp(filename, "-") == 0)
+    {
+        fd = STDIN_FILENO;
+    }
+    else if ((fd = open(filename, O_RDONLY)) < 0)
+    {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        buffer = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (buffer != MAP_FAILED)
+        {
+            close(fd);
+            *length = st.st_size;
+            return buffer;
+        }
+    }
+
+    size = 65536;
+    buffer = malloc(size);
+    *length = 0;
+    while ((count = read(fd, buffer + *length, size - *length)) != 0)
+    {
+        if (count < 0)
+        {
+            perror(filename);
+            exit(1);
+        }
+        *length += count;
+        if (*length == size)
+        {
+            size *= 2;
+            buffer = realloc(buffer, size);
+        }
+    }
+    if (fd != STDIN_FILENO)
+    {
+        close(fd);
+    }
+    return buffer;
+}
@@ -1,6 +1,8 @@
 #ifndef __UTILITIES_H__
 #define __UTILITIES_H__
 
+#include <stddef.h>
+
 struct pair
 {
     char *key;
@@ -16,6 +18,37 @@ struct listnode
     void *data;
 };
 
+/*
+ * arena hands out zeroed memory by bumping a pointer through large blocks.
+ * Nothing is released until arena_free() releases everything at once.
+ */
+#define ARENA_BLOCK_SIZE 65536
+
+struct arena_block
+{
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    char data[0];
+};
+
+struct arena
+{
+    struct arena_block *blocks;
+};
+
+/*
+ * Interned strings are kept once for the life of the process, so two strings
+ * are equal exactly when their ids, or the pointers interned_string() returns
+ * for them, are equal.
+ */
+#define INITIAL_INTERN_SIZE 1024
+
+/*
+ * Hashes are 32-bit FNV-1a, started from HASH_INITIAL.
+ */
+#define HASH_INITIAL 2166136261u
+
 #define foreach(item, list) \
     for (item=list; item!=NULL; item=item->next)
 
@@ -27,6 +60,41 @@ void list_append(struct listnode **head, void *data);
 
 void *list_item(struct listnode **head, int index);
 
+int list_contains(struct listnode *head, void *data);
+
 int list_equal(struct listnode *a, struct listnode *b);
 
+void arena_init(struct arena *arena);
+
+void *arena_alloc(struct arena *arena, size_t size);
+
+void arena_free(struct arena *arena);
+
+/*
+ * Returns the id of the string of length bytes at text, adding a NUL-terminated
+ * copy to the table the first time it is seen.
+ */
+int intern(const char *text, size_t length);
+
+/*
+ * Returns hash with length bytes of data added to it.
+ */
+unsigned int hash_bytes(unsigned int hash, const void *data, size_t length);
+
+const char *interned_string(int id);
+
+/*
+ * Returns the contents of a source file, or standard input for "-", and sets
+ * length to its size. The contents stay valid for the life of the process.
+ */
+char *read_source(const char *filename, size_t *length);
+
+/*
+ * Maps a regular file that is not empty read-only and sets length to its size,
+ * or returns NULL. The mapping stays until it is passed to unmap_file().
+ */
+char *map_file(const char *filename, size_t *length);
+
+void unmap_file(char *content, size_t length);
+
 #endif